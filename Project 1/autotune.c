@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/**
+ * Adaptive thread pools (--auto). The traversal and analysis pools start one
+ * thread per available core and the WFD pool two, and a gate lets only as
+ * many of a pool's threads work at once as the pool has permits. A controller
+ * thread samples the queue depths, the process's CPU use and the system's I/O
+ * wait every AUTO_INTERVAL_MS and moves permits between the pools. The
+ * permits of all pools add up to the available cores, plus the share of them
+ * the last interval spent waiting on I/O (a thread blocked on a read holds no
+ * core), but every pool keeps at least one. Every change is logged for --stats.
+ **/
+#define AUTO_INTERVAL_MS 100
+#define AUTO_MAX_EVENTS 64
+
+/**
+ * Gate of one pool: a thread holds a permit while it works on one item.
+ **/
+typedef struct PoolGate {
+    const char* name;
+    int threads;            // threads started
+    int permits;            // threads allowed to work at once
+    int running;
+    unsigned long items;    // items finished
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} PoolGate;
+
+/**
+ * Depth of a work queue, read under the queue's own lock.
+ **/
+typedef int (*QueueDepth)(void* queue);
+
+typedef struct AutoEvent {
+    double at;              // seconds since the controller started
+    int permits[3];
+    int depth[3];
+    int cpu;                // percent of the available cores used
+    int iowait;             // percent of system time waiting on I/O
+} AutoEvent;
+
+enum {
+    POOL_TRAVERSE,
+    POOL_WFD,
+    POOL_ANALYSIS
+};
+
+typedef struct AutoTuner {
+    int cores;
+    char coreSource[64];
+    PoolGate pools[3];
+    QueueDepth depth[3];
+    void* queue[3];
+    struct timespec start;
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t controller;
+    AutoEvent events[AUTO_MAX_EVENTS];
+    int numEvents;
+    int droppedEvents;
+} AutoTuner;
+
+/**
+ * Tuner of the run with --auto, or NULL.
+ **/
+AutoTuner* autoTuner = NULL;
+
+void gate_init(PoolGate* G, const char* name, int threads, int permits) {
+    G->name = name;
+    G->threads = threads;
+    G->permits = permits;
+    G->running = 0;
+    G->items = 0;
+    pthread_mutex_init(&G->lock, NULL);
+    pthread_cond_init(&G->wake, NULL);
+}
+
+/**
+ * Waits for a permit of the pool. A NULL gate (no --auto) never waits.
+ **/
+void gate_enter(PoolGate* G) {
+    if (G == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&G->lock);
+    while (G->running >= G->permits) {
+        pthread_cond_wait(&G->wake, &G->lock);
+    }
+    G->running++;
+    pthread_mutex_unlock(&G->lock);
+}
+
+/**
+ * Returns a permit once an item is done.
+ **/
+void gate_leave(PoolGate* G) {
+    if (G == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&G->lock);
+    G->running--;
+    G->items++;
+    pthread_cond_signal(&G->wake);
+    pthread_mutex_unlock(&G->lock);
+}
+
+void gate_set(PoolGate* G, int permits) {
+    pthread_mutex_lock(&G->lock);
+    G->permits = permits;
+    pthread_cond_broadcast(&G->wake);
+    pthread_mutex_unlock(&G->lock);
+}
+
+/**
+ * Gate of a pool of the running tuner, or NULL.
+ **/
+PoolGate* autoGate(int pool) {
+    return autoTuner ? &autoTuner->pools[pool] : NULL;
+}
+
+/**
+ * Cores this process may use: the CPUs in its affinity mask, capped by a
+ * cgroup CPU quota (v2 cpu.max or v1 cfs quota) rounded up.
+ **/
+int availableCores(char* source, size_t size) {
+    cpu_set_t set;
+    int cores = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+    snprintf(source, size, "affinity");
+
+    long quota = -1;
+    long period = 0;
+    char max[32];
+    FILE* in = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (in != NULL) {
+        if (fscanf(in, "%31s %ld", max, &period) == 2 && strcmp(max, "max") != 0) {
+            quota = atol(max);
+        }
+        fclose(in);
+    } else if ((in = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL) {
+        if (fscanf(in, "%ld", &quota) != 1) {
+            quota = -1;
+        }
+        fclose(in);
+        if ((in = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != NULL) {
+            if (fscanf(in, "%ld", &period) != 1) {
+                period = 0;
+            }
+            fclose(in);
+        }
+    }
+    if (quota > 0 && period > 0) {
+        int limit = (int) ((quota + period - 1) / period);
+        if (limit < cores) {
+            cores = limit;
+            snprintf(source, size, "cgroup quota");
+        }
+    }
+    return cores;
+}
+
+/**
+ * Busy and I/O-wait jiffies of the whole system, from /proc/stat.
+ **/
+void readSystemTimes(unsigned long long* total, unsigned long long* iowait) {
+    unsigned long long user, nice, system, idle, wait, irq, softirq;
+    *total = 0;
+    *iowait = 0;
+    FILE* in = fopen("/proc/stat", "r");
+    if (in == NULL) {
+        return;
+    }
+    if (fscanf(in, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &wait, &irq, &softirq) == 7) {
+        *total = user + nice + system + idle + wait + irq + softirq;
+        *iowait = wait;
+    }
+    fclose(in);
+}
+
+/**
+ * CPU seconds used by this process so far.
+ **/
+double processCPUTime() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+double secondsSince(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Splits a budget of permits between the pools from their queue depths.
+ * Traversal gets more than one permit only while directories are waiting and
+ * the WFD pool is running out of files. Pipelined analysis gets an even share
+ * while both it and the WFD pool have a backlog, and everything but one
+ * permit each once no files or directories are left. The WFD pool gets the rest.
+ **/
+void autoSplit(int budget, int* depth, int analysisStarted, int* permits) {
+    int traverse = 1;
+    if (depth[POOL_TRAVERSE] > 0 && depth[POOL_WFD] < budget) {
+        traverse = depth[POOL_TRAVERSE] < budget / 2 ? depth[POOL_TRAVERSE] : budget / 2;
+        if (traverse < 1) {
+            traverse = 1;
+        }
+    }
+    int analysis = 0;
+    if (analysisStarted) {
+        analysis = 1;
+        if (depth[POOL_ANALYSIS] > 0) {
+            if (depth[POOL_WFD] == 0 && depth[POOL_TRAVERSE] == 0) {
+                analysis = budget - 2;
+            } else {
+                analysis = (budget - traverse) / 2;
+            }
+        }
+        if (analysis < 1) {
+            analysis = 1;
+        }
+    }
+    int wfd = budget - traverse - analysis;
+    permits[POOL_TRAVERSE] = traverse;
+    permits[POOL_WFD] = wfd < 1 ? 1 : wfd;
+    permits[POOL_ANALYSIS] = analysis;
+}
+
+/**
+ * Logs the current permits of the pools. Called with the tuner's lock held.
+ **/
+void autoRecord(AutoTuner* T, double at, int* depth, double cpu, double iowait) {
+    if (T->numEvents == AUTO_MAX_EVENTS) {
+        T->droppedEvents++;
+        return;
+    }
+    AutoEvent* event = &T->events[T->numEvents++];
+    event->at = at;
+    int p;
+    for (p = 0; p < 3; ++p) {
+        event->permits[p] = T->pools[p].permits;
+        event->depth[p] = depth[p];
+    }
+    event->cpu = (int) (cpu * 100 + 0.5);
+    event->iowait = (int) (iowait * 100 + 0.5);
+}
+
+/**
+ * Controller thread: rebalances the pools every AUTO_INTERVAL_MS until the
+ * collection phase is over.
+ **/
+void* autoController(void* argPtr) {
+    AutoTuner* T = argPtr;
+    unsigned long long lastTotal, lastWait;
+    readSystemTimes(&lastTotal, &lastWait);
+    double lastCPU = processCPUTime();
+    double lastAt = 0;
+
+    pthread_mutex_lock(&T->lock);
+    while (!T->finished) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += AUTO_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&T->wake, &T->lock, &deadline);
+        if (T->finished) {
+            break;
+        }
+        pthread_mutex_unlock(&T->lock);
+
+        int depth[3];
+        int p;
+        for (p = 0; p < 3; ++p) {
+            depth[p] = T->depth[p] ? T->depth[p](T->queue[p]) : 0;
+        }
+        unsigned long long total, wait;
+        readSystemTimes(&total, &wait);
+        double cpuTime = processCPUTime();
+        double at = secondsSince(&T->start);
+        double iowait = total > lastTotal ? (double) (wait - lastWait) / (double) (total - lastTotal) : 0;
+        double cpu = at > lastAt ? (cpuTime - lastCPU) / ((at - lastAt) * T->cores) : 0;
+        lastTotal = total;
+        lastWait = wait;
+        lastCPU = cpuTime;
+        lastAt = at;
+
+        int budget = T->cores + (int) (T->cores * iowait);
+        int permits[3];
+        autoSplit(budget, depth, T->depth[POOL_ANALYSIS] != NULL, permits);
+        int changed = 0;
+        for (p = 0; p < 3; ++p) {
+            if (permits[p] > T->pools[p].threads) {
+                permits[p] = T->pools[p].threads;
+            }
+            if (permits[p] > 0 && permits[p] != T->pools[p].permits) {
+                gate_set(&T->pools[p], permits[p]);
+                changed = 1;
+            }
+        }
+
+        pthread_mutex_lock(&T->lock);
+        if (changed) {
+            autoRecord(T, at, depth, cpu, iowait);
+        }
+    }
+    pthread_mutex_unlock(&T->lock);
+    return NULL;
+}
+
+/**
+ * Sizes the pools for the available cores. The analysis pool is only
+ * controlled if it runs during collection (pipelined analysis).
+ **/
+AutoTuner* autotune_create(int pipelined) {
+    AutoTuner* T = malloc(sizeof(AutoTuner));
+    if (T == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    T->cores = availableCores(T->coreSource, sizeof(T->coreSource));
+    int permits[3];
+    int depth[3] = { 1, 0, 0 };
+    autoSplit(T->cores, depth, pipelined, permits);
+    gate_init(&T->pools[POOL_TRAVERSE], "traversal", T->cores, permits[POOL_TRAVERSE]);
+    gate_init(&T->pools[POOL_WFD], "WFD", 2 * T->cores, permits[POOL_WFD]);
+    gate_init(&T->pools[POOL_ANALYSIS], "analysis", T->cores, pipelined ? permits[POOL_ANALYSIS] : T->cores);
+    int p;
+    for (p = 0; p < 3; ++p) {
+        T->depth[p] = NULL;
+        T->queue[p] = NULL;
+    }
+    T->finished = 0;
+    T->numEvents = 0;
+    T->droppedEvents = 0;
+    pthread_mutex_init(&T->lock, NULL);
+    pthread_cond_init(&T->wake, NULL);
+    return T;
+}
+
+/**
+ * Starts the controller over the queues of the pools; analysisDepth is NULL
+ * unless analysis is pipelined.
+ **/
+void autotune_run(AutoTuner* T, QueueDepth traverseDepth, void* traverseQueue, QueueDepth wfdDepth, void* wfdQueue,
+        QueueDepth analysisDepth, void* analysisQueue) {
+    T->depth[POOL_TRAVERSE] = traverseDepth;
+    T->queue[POOL_TRAVERSE] = traverseQueue;
+    T->depth[POOL_WFD] = wfdDepth;
+    T->queue[POOL_WFD] = wfdQueue;
+    T->depth[POOL_ANALYSIS] = analysisDepth;
+    T->queue[POOL_ANALYSIS] = analysisQueue;
+    clock_gettime(CLOCK_MONOTONIC, &T->start);
+    int depth[3] = { 0, 0, 0 };
+    autoRecord(T, 0, depth, 0, 0);
+    pthread_create(&T->controller, NULL, autoController, T);
+}
+
+/**
+ * Stops the controller once collection is over. Whatever pipelined analysis
+ * is left gets every core.
+ **/
+void autotune_stop(AutoTuner* T) {
+    pthread_mutex_lock(&T->lock);
+    T->finished = 1;
+    pthread_cond_signal(&T->wake);
+    pthread_mutex_unlock(&T->lock);
+    pthread_join(T->controller, NULL);
+    if (T->depth[POOL_ANALYSIS] != NULL && T->pools[POOL_ANALYSIS].permits != T->cores) {
+        int depth[3] = { 0, 0, T->depth[POOL_ANALYSIS](T->queue[POOL_ANALYSIS]) };
+        gate_set(&T->pools[POOL_ANALYSIS], T->cores);
+        autoRecord(T, secondsSince(&T->start), depth, 0, 0);
+    }
+}
+
+/**
+ * Prints the pools and every decision of the controller (--stats).
+ **/
+void autotune_report(AutoTuner* T, FILE* out) {
+    fprintf(out, "auto: %d cores (%s)\n", T->cores, T->coreSource);
+    int p;
+    for (p = 0; p < 3; ++p) {
+        if (T->pools[p].threads > 0) {
+            fprintf(out, "auto: %s pool: %d threads, %lu items\n", T->pools[p].name, T->pools[p].threads, T->pools[p].items);
+        }
+    }
+    int e;
+    for (e = 0; e < T->numEvents; ++e) {  // cpu and iowait are not sampled at start and stop
+        AutoEvent* event = &T->events[e];
+        fprintf(out, "auto: %7.3fs permits traversal %d, WFD %d, analysis %d (queued %d dirs, %d files, %d pair blocks; cpu %d%%, iowait %d%%)\n",
+                event->at, event->permits[POOL_TRAVERSE], event->permits[POOL_WFD], event->permits[POOL_ANALYSIS],
+                event->depth[POOL_TRAVERSE], event->depth[POOL_WFD], event->depth[POOL_ANALYSIS], event->cpu, event->iowait);
+    }
+    if (T->droppedEvents > 0) {
+        fprintf(out, "auto: %d later decisions not shown\n", T->droppedEvents);
+    }
+}
+
+void autotune_destroy(AutoTuner* T) {
+    int p;
+    for (p = 0; p < 3; ++p) {
+        pthread_mutex_destroy(&T->pools[p].lock);
+        pthread_cond_destroy(&T->pools[p].wake);
+    }
+    pthread_mutex_destroy(&T->lock);
+    pthread_cond_destroy(&T->wake);
+    free(T);
+}
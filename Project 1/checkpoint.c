@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+ * Checkpoints of an all-pairs analysis. The pairs are split into chunks of
+ * CHECKPOINT_CHUNK that the analysis threads claim one at a time; a writer
+ * thread periodically saves every finished chunk. All fields are native-endian:
+ *
+ *   header:  magic[8] "WFDCKPT1", uint64 fingerprint, uint64 numPairs,
+ *            uint64 chunkSize, uint64 numSaved
+ *   chunk:   uint64 chunk, double JSD[pairs in the chunk]
+ *
+ * The fingerprint covers the metric, the term mode and the names and distributions of the
+ * compared WFDs in order, so a checkpoint is only resumed against the same input.
+ **/
+#define CHECKPOINT_MAGIC "WFDCKPT1"
+#define CHECKPOINT_CHUNK 65536
+#define CHECKPOINT_INTERVAL 30
+
+typedef struct Checkpoint {
+    const char* path;
+    PairResults* results;
+    uint64_t fingerprint;
+    size_t numChunks;
+    unsigned char* done;    // per chunk, set (release) once its JSDs are written
+    size_t nextChunk;       // claim cursor (atomic)
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t writer;
+} Checkpoint;
+
+/**
+ * Mixes bytes into a 64-bit FNV-1a hash.
+ **/
+uint64_t hashBytes(uint64_t h, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/**
+ * Fingerprint of the WFDs of a result array, in order.
+ **/
+uint64_t fingerprintPairs(PairResults* results) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = hashBytes(h, &results->numFiles, sizeof(unsigned));
+    h = hashBytes(h, &pairMetric, sizeof(int));
+    h = hashBytes(h, &hashBits, sizeof(int));
+    h = hashBytes(h, &ngramSize, sizeof(int));
+    unsigned i;
+    for (i = 0; i < results->numFiles; ++i) {
+        WFDNode* wfd = results->files[i];
+        h = hashBytes(h, wfd->filename, strlen(wfd->filename) + 1);
+        h = hashBytes(h, &wfd->wordCount, sizeof(int));
+        h = hashBytes(h, &wfd->numTerms, sizeof(unsigned));
+        h = hashBytes(h, wfd->counts, sizeof(unsigned) * wfd->numTerms);
+        if (wfd->termPool != NULL && wfd->numTerms > 0) {
+            unsigned last = wfd->numTerms - 1;
+            h = hashBytes(h, wfd->termPool, wfd->termOffsets[last] + strlen(wfd->termPool + wfd->termOffsets[last]));
+        }
+    }
+    return h;
+}
+
+/**
+ * Pairs [*start, *end) of a chunk.
+ **/
+void checkpoint_range(Checkpoint* ck, size_t chunk, size_t* start, size_t* end) {
+    *start = chunk * CHECKPOINT_CHUNK;
+    *end = *start + CHECKPOINT_CHUNK < ck->results->numPairs ? *start + CHECKPOINT_CHUNK : ck->results->numPairs;
+}
+
+/**
+ * Loads the finished chunks of a previous run. Returns how many were loaded,
+ * or -1 if the file is missing or belongs to another input.
+ **/
+long checkpoint_load(Checkpoint* ck) {
+    FILE* in = fopen(ck->path, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    char magic[8];
+    uint64_t header[4];
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0
+            || fread(header, sizeof(uint64_t), 4, in) != 4
+            || header[0] != ck->fingerprint || header[1] != ck->results->numPairs
+            || header[2] != CHECKPOINT_CHUNK) {
+        fclose(in);
+        return -1;
+    }
+    long loaded = 0;
+    uint64_t s;
+    for (s = 0; s < header[3]; ++s) {
+        uint64_t chunk;
+        size_t start, end;
+        if (fread(&chunk, sizeof(uint64_t), 1, in) != 1 || chunk >= ck->numChunks) {
+            break;
+        }
+        checkpoint_range(ck, chunk, &start, &end);
+        if (fread(ck->results->score + start, sizeof(double), end - start, in) != end - start) {
+            break;
+        }
+        ck->done[chunk] = 1;
+        if (pairClusters != NULL) {
+            cluster_range(pairClusters, ck->results, start, end);
+        }
+        ++loaded;
+    }
+    fclose(in);
+    return loaded;
+}
+
+/**
+ * Saves every finished chunk. The checkpoint is written next to its path and
+ * renamed into place, so a crash never leaves a partial checkpoint behind.
+ * Only finished chunks are read, so the analysis threads are never paused.
+ **/
+int checkpoint_write(Checkpoint* ck) {
+    char* tmp = malloc(strlen(ck->path) + 5);
+    if (tmp == NULL) {
+        perror("Malloc failed\n");
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", ck->path);
+    FILE* out = fopen(tmp, "wb");
+    if (out == NULL) {
+        perror(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    unsigned char* snapshot = malloc(ck->numChunks > 0 ? ck->numChunks : 1);
+    if (snapshot == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    uint64_t header[4] = { ck->fingerprint, ck->results->numPairs, CHECKPOINT_CHUNK, 0 };
+    size_t c;
+    for (c = 0; c < ck->numChunks; ++c) {
+        snapshot[c] = __atomic_load_n(&ck->done[c], __ATOMIC_ACQUIRE);
+        header[3] += snapshot[c];
+    }
+    fwrite(CHECKPOINT_MAGIC, 1, 8, out);
+    fwrite(header, sizeof(uint64_t), 4, out);
+    for (c = 0; c < ck->numChunks; ++c) {
+        if (snapshot[c]) {
+            uint64_t chunk = c;
+            size_t start, end;
+            checkpoint_range(ck, c, &start, &end);
+            fwrite(&chunk, sizeof(uint64_t), 1, out);
+            fwrite(ck->results->score + start, sizeof(double), end - start, out);
+        }
+    }
+    free(snapshot);
+
+    if (fflush(out) != 0 || ferror(out) || fsync(fileno(out)) != 0) {
+        perror(tmp);
+        fclose(out);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    fclose(out);
+    if (rename(tmp, ck->path) != 0) {
+        perror(ck->path);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+/**
+ * Writer thread: saves a checkpoint every CHECKPOINT_INTERVAL seconds until
+ * the analysis finishes.
+ **/
+void* checkpointWriter(void* argPtr) {
+    Checkpoint* ck = argPtr;
+    pthread_mutex_lock(&ck->lock);
+    while (!ck->finished) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CHECKPOINT_INTERVAL;
+        if (pthread_cond_timedwait(&ck->wake, &ck->lock, &deadline) == ETIMEDOUT && !ck->finished) {
+            pthread_mutex_unlock(&ck->lock);
+            checkpoint_write(ck);
+            pthread_mutex_lock(&ck->lock);
+        }
+    }
+    pthread_mutex_unlock(&ck->lock);
+    return NULL;
+}
+
+/**
+ * Sets up checkpointing of a result array and starts the writer thread.
+ * With resume set, the finished chunks of a matching checkpoint are loaded.
+ **/
+void checkpoint_start(Checkpoint* ck, const char* path, PairResults* results, int resume) {
+    ck->path = path;
+    ck->results = results;
+    ck->fingerprint = fingerprintPairs(results);
+    ck->numChunks = (results->numPairs + CHECKPOINT_CHUNK - 1) / CHECKPOINT_CHUNK;
+    ck->done = calloc(ck->numChunks > 0 ? ck->numChunks : 1, 1);
+    if (ck->done == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    ck->nextChunk = 0;
+    ck->finished = 0;
+    if (resume) {
+        long loaded = checkpoint_load(ck);
+        if (loaded < 0) {
+            fprintf(stderr, "%s: no checkpoint for these files, starting over\n", path);
+        } else {
+            fprintf(stderr, "%s: resuming, %ld of %zu chunks done\n", path, loaded, ck->numChunks);
+        }
+    }
+    pthread_mutex_init(&ck->lock, NULL);
+    pthread_cond_init(&ck->wake, NULL);
+    pthread_create(&ck->writer, NULL, checkpointWriter, ck);
+}
+
+/**
+ * Claims the next chunk that is not done yet; returns 0 when none are left.
+ **/
+int checkpoint_claim(Checkpoint* ck, size_t* chunk) {
+    while (1) {
+        size_t c = __atomic_fetch_add(&ck->nextChunk, 1, __ATOMIC_RELAXED);
+        if (c >= ck->numChunks) {
+            return 0;
+        }
+        if (!ck->done[c]) {
+            *chunk = c;
+            return 1;
+        }
+    }
+}
+
+/**
+ * Analysis worker: computes claimed chunks until none are left.
+ **/
+void* computeCheckpointJSD(void* argPtr) {
+    Checkpoint* ck = argPtr;
+    size_t chunk;
+    while (checkpoint_claim(ck, &chunk)) {
+        size_t start, end;
+        checkpoint_range(ck, chunk, &start, &end);
+        computePairRange(ck->results, start, end);
+        if (pairClusters != NULL) {
+            cluster_range(pairClusters, ck->results, start, end);
+        }
+        __atomic_store_n(&ck->done[chunk], 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * Stops the writer thread once every chunk is done. The checkpoint is of no
+ * further use, so it is removed.
+ **/
+void checkpoint_finish(Checkpoint* ck) {
+    pthread_mutex_lock(&ck->lock);
+    ck->finished = 1;
+    pthread_cond_signal(&ck->wake);
+    pthread_mutex_unlock(&ck->lock);
+    pthread_join(ck->writer, NULL);
+    unlink(ck->path);
+    free(ck->done);
+    pthread_mutex_destroy(&ck->lock);
+    pthread_cond_destroy(&ck->wake);
+}
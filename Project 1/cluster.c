@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * Threshold clustering (-g): instead of listing every pair, the files are
+ * grouped by the graph whose edges are the pairs scoring under a threshold.
+ * Analysis threads feed each range of pairs they finish into a union-find
+ * over the distinct WFDs of the run (by id), linked with compare-and-swap so
+ * no lock is taken. The edges are kept as well, to print the tightest pairs
+ * of each group; only the near pairs are stored, not all n(n-1)/2.
+ **/
+#define CLUSTER_BATCH 256
+
+typedef struct ClusterEdge {
+    WFDNode* fileA;
+    WFDNode* fileB;
+    double score;
+} ClusterEdge;
+
+typedef struct Clusters {
+    double threshold;
+    unsigned numUnits;
+    unsigned* parent;       // union-find forest over WFD ids; parent[x] <= x
+    ClusterEdge* edges;
+    size_t numEdges;
+    size_t capacity;
+    pthread_mutex_t edgeLock;
+} Clusters;
+
+/**
+ * Clusters being fed by the current analysis, or NULL when pairs are listed.
+ **/
+Clusters* pairClusters = NULL;
+
+/**
+ * Initializes clustering over numUnits distinct WFDs, each in its own group.
+ **/
+Clusters* cluster_create(unsigned numUnits, double threshold) {
+    Clusters* C = malloc(sizeof(Clusters));
+    if (C == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    C->threshold = threshold;
+    C->numUnits = numUnits;
+    C->parent = malloc(sizeof(unsigned) * (numUnits > 0 ? numUnits : 1));
+    if (C->parent == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned x;
+    for (x = 0; x < numUnits; ++x) {
+        C->parent[x] = x;
+    }
+    C->edges = NULL;
+    C->numEdges = 0;
+    C->capacity = 0;
+    pthread_mutex_init(&C->edgeLock, NULL);
+    return C;
+}
+
+/**
+ * Root of x's group. Halves the path as it goes; a stale read only makes the
+ * walk longer, since every parent is at most its child.
+ **/
+unsigned cluster_find(Clusters* C, unsigned x) {
+    while (1) {
+        unsigned p = __atomic_load_n(&C->parent[x], __ATOMIC_RELAXED);
+        if (p == x) {
+            return x;
+        }
+        unsigned g = __atomic_load_n(&C->parent[p], __ATOMIC_RELAXED);
+        if (g != p) {
+            __atomic_compare_exchange_n(&C->parent[x], &p, g, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        x = g;
+    }
+}
+
+/**
+ * Merges the groups of a and b: the higher root is linked under the lower
+ * one, retrying if another thread linked either root first.
+ **/
+void cluster_union(Clusters* C, unsigned a, unsigned b) {
+    while (1) {
+        a = cluster_find(C, a);
+        b = cluster_find(C, b);
+        if (a == b) {
+            return;
+        }
+        unsigned lo = a < b ? a : b;
+        unsigned hi = a < b ? b : a;
+        unsigned expected = hi;
+        if (__atomic_compare_exchange_n(&C->parent[hi], &expected, lo, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Sets an edge with its files in name order, so ties print the same every run.
+ **/
+void cluster_edge(ClusterEdge* edge, WFDNode* fileA, WFDNode* fileB, double score) {
+    int swap = strcmp(fileA->filename, fileB->filename) > 0;
+    edge->fileA = swap ? fileB : fileA;
+    edge->fileB = swap ? fileA : fileB;
+    edge->score = score;
+}
+
+/**
+ * Appends a batch of edges.
+ **/
+void cluster_flush(Clusters* C, ClusterEdge* batch, unsigned count) {
+    if (count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&C->edgeLock);
+    if (C->numEdges + count > C->capacity) {
+        size_t capacity = C->capacity ? C->capacity * 2 : 1024;
+        while (capacity < C->numEdges + count) {
+            capacity *= 2;
+        }
+        ClusterEdge* edges = realloc(C->edges, sizeof(ClusterEdge) * capacity);
+        if (edges == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        C->edges = edges;
+        C->capacity = capacity;
+    }
+    memcpy(C->edges + C->numEdges, batch, sizeof(ClusterEdge) * count);
+    C->numEdges += count;
+    pthread_mutex_unlock(&C->edgeLock);
+}
+
+/**
+ * Feeds one finished pair into a batch of edges, flushing the batch when it
+ * fills: a pair under the threshold joins the groups of its two WFDs.
+ **/
+void cluster_pair(Clusters* C, ClusterEdge* batch, unsigned* count, WFDNode* fileA, WFDNode* fileB, double score) {
+    if (score >= C->threshold) {
+        return;
+    }
+    if (fileA->canon != NULL || fileB->canon != NULL) {
+        return;     // copies are grouped with the file they copy when printing
+    }
+    cluster_union(C, fileA->id, fileB->id);
+    cluster_edge(&batch[*count], fileA, fileB, score);
+    if (++*count == CLUSTER_BATCH) {
+        cluster_flush(C, batch, *count);
+        *count = 0;
+    }
+}
+
+/**
+ * Feeds the finished pairs [start, end) of a result array.
+ **/
+void cluster_range(Clusters* C, PairResults* results, size_t start, size_t end) {
+    ClusterEdge batch[CLUSTER_BATCH];
+    unsigned count = 0;
+    size_t k;
+    for (k = start; k < end; ++k) {
+        cluster_pair(C, batch, &count, results->files[results->fileA[k]], results->files[results->fileB[k]], results->score[k]);
+    }
+    cluster_flush(C, batch, count);
+}
+
+/**
+ * Orders WFDs by group, then by file name.
+ **/
+int compareClusterMembers(const void* x, const void* y, void* arg) {
+    Clusters* C = arg;
+    WFDNode* a = *(WFDNode* const*) x;
+    WFDNode* b = *(WFDNode* const*) y;
+    unsigned ra = C->parent[a->id];
+    unsigned rb = C->parent[b->id];
+    if (ra != rb) {
+        return ra < rb ? -1 : 1;
+    }
+    return strcmp(a->filename, b->filename);
+}
+
+/**
+ * Orders edges by group, then tightest first.
+ **/
+int compareClusterEdges(const void* x, const void* y, void* arg) {
+    Clusters* C = arg;
+    const ClusterEdge* a = x;
+    const ClusterEdge* b = y;
+    unsigned ra = C->parent[a->fileA->id];
+    unsigned rb = C->parent[b->fileA->id];
+    if (ra != rb) {
+        return ra < rb ? -1 : 1;
+    }
+    if (a->score != b->score) {
+        return a->score < b->score ? -1 : 1;
+    }
+    int c = strcmp(a->fileA->filename, b->fileA->filename);
+    return c != 0 ? c : strcmp(a->fileB->filename, b->fileB->filename);
+}
+
+/**
+ * Groups of a run, largest first.
+ **/
+typedef struct ClusterGroup {
+    unsigned firstMember;
+    unsigned numMembers;
+    size_t firstEdge;
+    size_t numEdges;
+} ClusterGroup;
+
+int compareClusterGroups(const void* x, const void* y, void* arg) {
+    WFDNode** members = arg;
+    const ClusterGroup* a = x;
+    const ClusterGroup* b = y;
+    if (a->numMembers != b->numMembers) {
+        return a->numMembers > b->numMembers ? -1 : 1;
+    }
+    return strcmp(members[a->firstMember]->filename, members[b->firstMember]->filename);
+}
+
+/**
+ * Prints every group of two or more files: its members, then its at most
+ * maxPairs tightest internal pairs. Copies of one file are in one group and
+ * score 0 against each other.
+ **/
+void printClusters(Clusters* C, WFDNode** files, unsigned numFiles, unsigned maxPairs) {
+    // Flatten the forest so each parent entry is its group's root
+    unsigned x;
+    for (x = 0; x < C->numUnits; ++x) {
+        C->parent[x] = cluster_find(C, x);
+    }
+
+    // Copies pair up with the file they copy
+    unsigned f;
+    for (f = 0; f < numFiles; ++f) {
+        if (files[f]->canon != NULL) {
+            ClusterEdge edge;
+            cluster_edge(&edge, files[f]->canon, files[f], 0);
+            cluster_flush(C, &edge, 1);
+        }
+    }
+
+    WFDNode** members = malloc(sizeof(WFDNode*) * (numFiles > 0 ? numFiles : 1));
+    ClusterGroup* groups = malloc(sizeof(ClusterGroup) * (numFiles > 0 ? numFiles : 1));
+    if (members == NULL || groups == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    memcpy(members, files, sizeof(WFDNode*) * numFiles);
+    qsort_r(members, numFiles, sizeof(WFDNode*), compareClusterMembers, C);
+    qsort_r(C->edges, C->numEdges, sizeof(ClusterEdge), compareClusterEdges, C);
+
+    unsigned numGroups = 0;
+    size_t e = 0;
+    f = 0;
+    while (f < numFiles) {
+        unsigned root = C->parent[members[f]->id];
+        unsigned g = f;
+        while (g < numFiles && C->parent[members[g]->id] == root) {
+            ++g;
+        }
+        while (e < C->numEdges && C->parent[C->edges[e].fileA->id] < root) {
+            ++e;
+        }
+        size_t firstEdge = e;
+        while (e < C->numEdges && C->parent[C->edges[e].fileA->id] == root) {
+            ++e;
+        }
+        if (g - f > 1) {
+            groups[numGroups].firstMember = f;
+            groups[numGroups].numMembers = g - f;
+            groups[numGroups].firstEdge = firstEdge;
+            groups[numGroups].numEdges = e - firstEdge;
+            ++numGroups;
+        }
+        f = g;
+    }
+    qsort_r(groups, numGroups, sizeof(ClusterGroup), compareClusterGroups, members);
+
+    unsigned n;
+    for (n = 0; n < numGroups; ++n) {
+        ClusterGroup* group = &groups[n];
+        printf("group %u: %u files\n", n + 1, group->numMembers);
+        for (f = group->firstMember; f < group->firstMember + group->numMembers; ++f) {
+            printf("  %s\n", members[f]->filename);
+        }
+        size_t k;
+        for (k = 0; k < group->numEdges && k < maxPairs; ++k) {
+            ClusterEdge* edge = &C->edges[group->firstEdge + k];
+            printf("  %f %s %s\n", edge->score, edge->fileA->filename, edge->fileB->filename);
+        }
+    }
+    free(groups);
+    free(members);
+}
+
+/**
+ * Frees a clustering.
+ **/
+void cluster_destroy(Clusters* C) {
+    free(C->parent);
+    free(C->edges);
+    pthread_mutex_destroy(&C->edgeLock);
+    free(C);
+}
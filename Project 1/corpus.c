@@ -0,0 +1,984 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * A whole compare run: the collection phase, with its directory and file
+ * queues and threads, followed by the analysis or the store, query or daemon
+ * mode the options ask for.
+ **/
+#ifndef S_ISDIR
+#define S_ISDIR
+#endif
+
+struct direct_arg {
+	struct direct_queue *input_Q;
+	struct file_queue *second_Q;
+	PathFilter *filter;
+};
+
+struct file_arg{
+	struct file_queue *input_Q;
+	struct direct_queue *second_Q;
+	WFDRegistry *registry;
+	char* alphabet;
+	DedupTable *dedup;
+	Pipeline *pipeline;
+};
+
+struct a_arg{
+	size_t range_start;
+	size_t range_end;
+	PairResults *results;
+};
+
+struct direct_queue{
+	struct directNode *head;
+	struct directNode *end;
+	struct dirIdentity *identities;
+	int active_threads;
+	int capacity;
+	pthread_mutex_t dLock;
+	pthread_cond_t ready; 
+	
+};
+
+struct file_queue{
+	struct fileNode *head;
+	struct fileNode *end;
+	int files_read;
+	int active_threads;
+	int capacity;
+	pthread_mutex_t fLock;
+	pthread_cond_t ready;
+};
+
+/**
+ * (dev, inode) of a queued directory, linked to the directory it was found in
+ * so that symlink loops can be detected, and its depth below its root.
+ **/
+struct dirIdentity {
+	dev_t dev;
+	ino_t ino;
+	int depth;
+	struct dirIdentity *parent;
+	struct dirIdentity *nextAlloc;
+};
+
+struct directNode {
+	char *directName;
+	struct dirIdentity *ident;
+	struct directNode *next;
+};
+
+struct fileNode {
+	char *fileName;
+	dev_t dev;
+	ino_t ino;
+	struct fileNode *next;
+};
+
+/**
+ * Enqueues directory nodes into the unbounded directory queue.
+ **/
+void direct_enqueue(struct directNode *node, struct direct_queue *Q){
+	if (Q->head == NULL){
+		Q->head = node;
+		Q->end = node;
+		Q->capacity++;
+	} else {
+		node->next = Q->head;
+		Q->end->next = node;
+		Q->end = node;
+		Q->capacity++;	
+	}
+}
+
+/**
+ * Dequeues directory nodes out of the unbounded directory queue.
+ **/
+char *direct_dequeue(struct direct_queue *Q, struct dirIdentity **ident){
+	char *name = Q->head->directName;
+	*ident = Q->head->ident;
+	struct directNode *temp = Q->head;
+	if (Q->capacity == 2){
+		Q->head = Q->end;
+		Q->end = Q->head;
+	}
+	else if (Q->capacity == 1){
+		Q->head = NULL;
+		Q->end = NULL;
+	}
+	else {	
+		Q->end->next = Q->head->next;
+		Q->head = Q->head->next;
+	}
+	Q->capacity--;
+	free(temp);
+	return name;
+}
+
+/**
+ * Enqueues file nodes into the unbounded file queue.
+ **/
+void file_enqueue(struct fileNode *node, struct file_queue *Q){
+	if (Q->head == NULL){
+		Q->head = node;
+		Q->end = node;
+		Q->capacity++;
+	} else {
+		node->next = Q->head;
+		Q->end->next = node;
+		Q->end = node;
+		Q->capacity++;	
+	}
+}
+
+/**
+ * Dequeues directory nodes out of the unbounded file queue.
+ **/
+char *file_dequeue(struct file_queue *Q, dev_t *dev, ino_t *ino){
+	char *name = Q->head->fileName;
+	*dev = Q->head->dev;
+	*ino = Q->head->ino;
+	struct fileNode *temp = Q->head;
+	if (Q->capacity == 2){
+		Q->head = Q->end;
+		Q->end = Q->head;
+	}
+	else if (Q->capacity == 1){
+		Q->head = NULL;
+		Q->end = NULL;
+	}
+	else {	
+		Q->end->next = Q->head->next;
+		Q->head = Q->head->next;
+	}
+	Q->capacity--;
+	free(temp);
+	return name;
+}
+
+/**
+ * Initializes the unbounded directory queue.
+ **/
+void direct_queue_init(struct direct_queue *Q){
+	Q->head = NULL;
+	Q->end = NULL;
+	Q->identities = NULL;
+	Q->capacity = 0;
+	Q->active_threads = 0;
+	pthread_mutex_init(&Q->dLock, NULL);
+	pthread_cond_init(&Q->ready, NULL);
+}
+
+/**
+ * Records the identity of a directory about to be queued. Returns NULL if the
+ * directory is one of its own ancestors (a symlink loop). Called with dLock held.
+ **/
+struct dirIdentity *direct_identity(struct direct_queue *Q, struct dirIdentity *parent, int fd){
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		return NULL;
+	}
+	for (struct dirIdentity *ptr = parent; ptr != NULL; ptr = ptr->parent){
+		if (ptr->dev == st.st_dev && ptr->ino == st.st_ino){
+			return NULL;
+		}
+	}
+	struct dirIdentity *ident = malloc(sizeof(struct dirIdentity));
+	if (!ident) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	ident->dev = st.st_dev;
+	ident->ino = st.st_ino;
+	ident->depth = parent != NULL ? parent->depth + 1 : 0;
+	ident->parent = parent;
+	ident->nextAlloc = Q->identities;
+	Q->identities = ident;
+	return ident;
+}
+
+/**
+ * Frees the directory identities once traversal is over.
+ **/
+void direct_identity_free(struct direct_queue *Q){
+	while (Q->identities != NULL){
+		struct dirIdentity *next = Q->identities->nextAlloc;
+		free(Q->identities);
+		Q->identities = next;
+	}
+}
+
+/**
+ * Initializes the unbounded file queue.
+ **/
+void file_queue_init(struct file_queue *Q){
+	Q->head = NULL;
+	Q->end = NULL;
+	Q->active_threads = 0;
+	Q->files_read = 0;
+	Q->capacity = 0;
+	pthread_mutex_init(&Q->fLock, NULL);
+	pthread_cond_init(&Q->ready, NULL);
+}
+
+/**
+ * Directories waiting in the directory queue (--auto).
+ **/
+int direct_depth(void *queue){
+	struct direct_queue *Q = queue;
+	pthread_mutex_lock(&Q->dLock);
+	int depth = Q->capacity;
+	pthread_mutex_unlock(&Q->dLock);
+	return depth;
+}
+
+/**
+ * Files waiting in the file queue (--auto).
+ **/
+int file_depth(void *queue){
+	struct file_queue *Q = queue;
+	pthread_mutex_lock(&Q->fLock);
+	int depth = Q->capacity;
+	pthread_mutex_unlock(&Q->fLock);
+	return depth;
+}
+
+/**
+ * Traverses through the file and directory queues
+ * to enqueue and dequeue as needed.
+ **/
+void *traverse(void *argptr){
+	struct direct_arg *args = argptr;
+	struct direct_queue *Q = args->input_Q;
+	struct file_queue *Q2 = args->second_Q;
+	PathFilter *filter = args->filter;
+	int go = 1; int active = 0;
+	while (go == 1){
+		pthread_mutex_lock(&Q->dLock);
+		if (Q->capacity != 0){
+			if (active == 0){
+				active = 1;
+				Q->active_threads++;
+			}
+			struct dirIdentity *ident;
+			char *name = direct_dequeue(Q, &ident);
+			pthread_mutex_unlock(&Q->dLock);
+			gate_enter(autoGate(POOL_TRAVERSE));
+			DIR *dirp = opendir(name);
+			struct dirent *de;
+			int fd;
+			while ((de = readdir(dirp))){
+				// Hidden entries (and . and ..) are never read
+				if (de->d_name[0] == '.'){
+					continue;
+				}
+				char *new_name = malloc(sizeof(char) * (2 + strlen(name) + strlen(de->d_name)));
+				if (!new_name) {
+					perror("Malloc failed\n");
+					exit(1);
+				}
+				for (int x = 0; x < strlen(name); x++){
+					new_name[x] = name[x];
+				}
+				new_name[strlen(name)] = '/'; new_name[strlen(name) + 1] = '\0';
+				for (int x = 0; x < strlen(de->d_name); x++){
+					new_name[strlen(name) + 1 + x] = de->d_name[x];
+				}
+				new_name[strlen(name) + strlen(de->d_name) + 1] = '\0';
+
+				// Excluded subtrees and files are dropped by name, before anything is opened
+				if (filter_excluded(filter, new_name, de->d_name)){
+					free(new_name);
+					continue;
+				}
+				int isDir = de->d_type == DT_DIR;
+				if (de->d_type != DT_DIR && de->d_type != DT_REG){
+					// Symlink, or a file system that does not report types
+					struct stat st;
+					if (stat(new_name, &st) != 0){
+						free(new_name);
+						continue;
+					}
+					isDir = S_ISDIR(st.st_mode);
+				}
+
+				// Enqueues a subdirectory
+				if (isDir){
+					int depth = ident != NULL ? ident->depth + 1 : 1;
+					DIR *dirp2 = filter_descend(filter, depth) ? opendir(new_name) : NULL;
+					if (dirp2 == NULL){
+						free(new_name);
+						continue;
+					}
+					//printf("enqueuing %s\n", new_name);
+					pthread_mutex_lock(&Q->dLock);
+					struct dirIdentity *sub = direct_identity(Q, ident, dirfd(dirp2));
+					if (sub == NULL){
+						// Symlink back into its own ancestry
+						pthread_mutex_unlock(&Q->dLock);
+						free(new_name);
+						closedir(dirp2);
+						continue;
+					}
+					struct directNode *d_node = malloc(sizeof(struct directNode));
+					if (!d_node) {
+						perror("Malloc failed\n");
+						exit(1);
+					}
+					d_node->directName = new_name;
+					d_node->ident = sub;
+					direct_enqueue(d_node, Q);
+					pthread_mutex_unlock(&Q->dLock);
+					closedir(dirp2);
+
+				// Enqueues valid files based on matching suffix and globs
+				} else if (filter_file(filter, new_name, de->d_name) && (fd = open(new_name, O_RDONLY)) != -1){
+					struct stat st;
+					fstat(fd, &st);
+					struct fileNode *f_node = malloc(sizeof(struct fileNode));
+					if (!f_node) {
+						perror("Malloc failed\n");
+						exit(1);
+					}
+					f_node->fileName = new_name;
+					f_node->dev = st.st_dev;
+					f_node->ino = st.st_ino;
+					//printf("ENQUEUEING FILE: %s\n", new_name);
+					pthread_mutex_lock(&Q2->fLock);
+					file_enqueue(f_node, Q2);
+					pthread_mutex_unlock(&Q2->fLock);
+					close(fd);
+				} else {
+					free(new_name);
+				}
+			}
+			free(name);
+			closedir(dirp);
+			gate_leave(autoGate(POOL_TRAVERSE));
+		} else if (Q->capacity == 0){
+			if (active == 1){
+				active = 0;
+				Q->active_threads--;
+			}
+			if (Q->active_threads > 0){
+				pthread_cond_wait(&Q->ready, &Q->dLock);
+				pthread_mutex_unlock(&Q->dLock);
+				return NULL;
+			}
+			else {
+				pthread_cond_broadcast(&Q->ready);
+				pthread_mutex_unlock(&Q->dLock);
+				go = 0;
+				return NULL;
+			}
+		}
+			
+	}
+	return NULL;
+}
+
+/**
+ * Performs the WFD computation for each file.
+ **/
+void *computeWFD(void *argptr){
+	struct file_arg *args = argptr;
+	struct file_queue *Q = args->input_Q;
+	struct direct_queue *Q2 = args->second_Q;	
+	WFDRegistry *registry = args->registry;
+	char* alphabet = args->alphabet;
+	DedupTable *dedup = args->dedup;
+	int go = 1; int active = 0;
+	while (go == 1){
+		pthread_mutex_lock(&Q->fLock);
+		if (Q->capacity != 0){
+			if (active == 0){
+				Q->active_threads++;
+				active = 1;
+			}
+			dev_t dev; ino_t ino;
+			char *name = file_dequeue(Q, &dev, &ino);
+			Q->files_read++;
+			pthread_mutex_unlock(&Q->fLock);
+			gate_enter(autoGate(POOL_WFD));
+			WFDNode *new_node;
+			DedupEntry *entry = NULL;
+			DedupEntry *copyOf = dedup ? dedup_claim(dedup, name, dev, ino, &entry) : NULL;
+			if (copyOf != NULL){
+				// Hardlink, symlink or identical copy: shares the WFD of the first one
+				new_node = createDuplicateWFD(name, copyOf);
+			} else {
+				new_node = createFileWFD(name, alphabet); 
+				if (entry != NULL){
+					dedup_publish(dedup, entry, new_node);
+				}
+			}
+			gate_leave(autoGate(POOL_WFD));
+			if (new_node == NULL){
+				free(name);
+				continue;
+			}
+			unsigned index = registry_append(registry, new_node);
+			if (args->pipeline != NULL && copyOf == NULL){
+				// Pair the new WFD with every earlier one while the rest are built
+				pipeline_publish(args->pipeline, index);
+			}
+			
+		} 
+		else if (Q->capacity == 0){
+			Q->active_threads--;
+			if (Q->active_threads > 0){
+				pthread_cond_wait(&Q->ready, &Q->fLock);
+				pthread_mutex_lock(&Q2->dLock);
+				if (Q2->capacity == 0){
+					pthread_mutex_unlock(&Q->fLock);
+					pthread_mutex_unlock(&Q2->dLock);
+					return NULL;
+				}	
+				pthread_mutex_unlock(&Q2->dLock);
+				Q->active_threads++;
+				pthread_mutex_unlock(&Q->fLock);
+				continue;
+			}
+			else {
+				pthread_mutex_lock(&Q2->dLock);
+				if (Q2->active_threads <= 0){
+					pthread_cond_broadcast(&Q->ready);
+					pthread_mutex_unlock(&Q->fLock);
+					if (Q2->capacity == 0){
+						pthread_mutex_unlock(&Q2->dLock);
+						return NULL;
+					}
+					pthread_mutex_unlock(&Q2->dLock);
+					pthread_mutex_lock(&Q->fLock);
+					Q->active_threads++;
+					pthread_mutex_unlock(&Q->fLock);
+					continue;
+				}
+				pthread_mutex_unlock(&Q->fLock);
+				pthread_mutex_unlock(&Q2->dLock);
+				continue;
+			}
+		} 
+	}
+	return NULL;
+}
+
+/**
+ * Computes the JSD values for each JSD value pairs.
+ **/
+void* computeJSD(void *argPtr) {
+	struct a_arg *args = argPtr;
+	// Each thread owns its own interval of the result arrays
+	computePairRange(args->results, args->range_start, args->range_end);
+	if (pairClusters != NULL) {
+		cluster_range(pairClusters, args->results, args->range_start, args->range_end);
+	}
+	return NULL;
+
+}
+	
+/**
+ * Runs the analysis threads over the pairs of a result array, claiming
+ * chunks and saving them to a checkpoint file.
+ **/
+void analyzeCheckpointPairs(PairResults *results, int athreads, const char *checkpointPath, int resume){
+	Checkpoint ck;
+	checkpoint_start(&ck, checkpointPath, results, resume);
+	pthread_t *athreadIDs = malloc(sizeof(pthread_t) * athreads);
+	if (!athreadIDs) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	for (int q = 0; q < athreads; ++q) {
+		pthread_create(&athreadIDs[q], NULL, computeCheckpointJSD, &ck);
+	}
+	for (int q = 0; q < athreads; ++q) {
+		pthread_join(athreadIDs[q], NULL);
+	}
+	free(athreadIDs);
+	checkpoint_finish(&ck);
+}
+
+/**
+ * Runs the analysis threads over the pairs of a result array.
+ **/
+void analyzePairs(PairResults *results, int athreads, int useIndex, const char *checkpointPath, int resume){
+	size_t numPairs = results->numPairs;
+	if (numPairs == 0){
+		return;
+	}
+	if (useIndex == 1) {
+		// Inverted-index engine: only pairs that share a term are visited
+		indexAllPairsJSD(results, athreads);
+		return;
+	}
+	if (checkpointPath != NULL) {
+		analyzeCheckpointPairs(results, athreads, checkpointPath, resume);
+		return;
+	}
+
+   struct a_arg *a_args;
+   a_args = malloc(sizeof(struct a_arg) * athreads);
+	if (!a_args) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	pthread_t* athreadIDs;
+	athreadIDs = malloc(sizeof(pthread_t)*athreads);
+	if (!athreadIDs) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+
+	// Assign threads to non-overlapping intervals of comparison segments
+	size_t quotient = numPairs / athreads;
+	size_t remainder = numPairs % athreads;
+
+	int p;
+	size_t marker = 0;
+	for (p = 0; p < athreads; ++p) {
+		a_args[p].range_start = marker;
+		a_args[p].range_end = marker + quotient + (p < remainder ? 1 : 0);
+		a_args[p].results = results;
+		marker = a_args[p].range_end;
+	}
+
+	int q;
+	int athread_counter = 0;
+	for (q = 0; q < athreads; ++q) {
+		if (a_args[q].range_end > a_args[q].range_start) {
+			++athread_counter;
+			pthread_create(&athreadIDs[q], NULL, computeJSD, &a_args[q]);
+		}
+	}
+
+	int i;
+	for (i = 0; i < athread_counter; i++){
+		pthread_join(athreadIDs[i], NULL);
+	}
+
+	free(a_args);
+	free(athreadIDs);
+}
+
+/**
+ * Analysis when some paths are copies of each other: the distinct WFDs are
+ * compared once and each path pair reads the result of its canonical pair.
+ **/
+void analyzeDuplicatePairs(PairResults *results, unsigned numUnique, int athreads, int useIndex, const char *checkpointPath, int resume){
+	WFDNode **unique = malloc(sizeof(WFDNode*) * numUnique);
+	if (!unique) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	WFDNode **files = results->files;
+	for (unsigned f = 0; f < results->numFiles; ++f){
+		if (files[f]->canon == NULL){
+			unique[files[f]->id] = files[f];
+		}
+	}
+
+	PairResults *uniquePairs = createPairResults(unique, numUnique);
+	analyzePairs(uniquePairs, athreads, useIndex, checkpointPath, resume);
+
+	for (size_t k = 0; k < results->numPairs; ++k){
+		unsigned ia = files[results->fileA[k]]->id;
+		unsigned ib = files[results->fileB[k]]->id;
+		if (ia == ib){
+			results->score[k] = 0;
+		} else if (ia < ib){
+			results->score[k] = uniquePairs->score[pairIndex(ia, ib, numUnique)];
+		} else {
+			results->score[k] = uniquePairs->score[pairIndex(ib, ia, numUnique)];
+		}
+	}
+	freePairResults(uniquePairs);
+	free(unique);
+}
+
+/**
+ * Orders WFDs by file name.
+ **/
+int compareFilenames(const void *x, const void *y){
+	return strcmp((*(WFDNode* const*) x)->filename, (*(WFDNode* const*) y)->filename);
+}
+
+/**
+ * Enqueues a file given on the command line if it passes the filter.
+ **/
+void enqueueArgument(char *path, PathFilter *filter, struct file_queue *Q){
+	int fd = open(path, O_RDONLY);
+	if (fd == -1){
+		printf("invalid input\n");
+		return;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	if (filter_file(filter, path, baseName(path))){
+		struct fileNode *new_file = malloc(sizeof(struct fileNode));
+		if (!new_file) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		new_file->fileName = malloc(sizeof(char)*(strlen(path)+1));
+		if (!new_file->fileName) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		strcpy(new_file->fileName, path);
+		new_file->dev = st.st_dev;
+		new_file->ino = st.st_ino;
+		new_file->next = NULL;
+		file_enqueue(new_file, Q);
+	}
+	close(fd);
+}
+
+/**
+ * Runs compare over files and directories: collects their WFDs, then lists
+ * every pair to sink or runs the mode the options select.
+ **/
+int runCorpus(const WFDOptions *opts, char **paths, int numPaths, char *alphabet, WFDPairSink sink, void *ctx){
+	int dthreads = opts->dirThreads;
+	int fthreads = opts->fileThreads;
+	int athreads = opts->analysisThreads;
+	const char *storeOut = opts->storeOut;
+	const char *storeIn = opts->storeIn;
+	const char *storeAll = opts->storeAll;
+	const char *daemonSocket = opts->daemonSocket;
+	const char *checkpointPath = opts->checkpoint;
+	double clusterThreshold = opts->groupThreshold;
+	if (dthreads <= 0 || fthreads <= 0 || athreads <= 0){
+		fprintf(stderr, "Thread counts must be positive\n");
+		return EXIT_FAILURE;
+	}
+	if (hashBits > 0 && (opts->useIndex || storeOut || storeIn || storeAll || daemonSocket)){
+		// Hashed WFDs have no words to index or store
+		fprintf(stderr, "-b cannot be combined with -i, -w, -q, -o or -D\n");
+		return EXIT_FAILURE;
+	}
+	if (clusterThreshold > 0 && (storeOut || storeIn || daemonSocket)){
+		fprintf(stderr, "-g cannot be combined with -w, -q or -D\n");
+		return EXIT_FAILURE;
+	}
+	if (opts->pipelined && (checkpointPath || opts->useIndex)){
+		// Pipelined pairs are scored as the WFDs arrive, by neither engine
+		fprintf(stderr, "-p cannot be combined with -c or -i\n");
+		return EXIT_FAILURE;
+	}
+	if (opts->useIndex && checkpointPath){
+		// Checkpoints record chunks of the default engine's pairs
+		fprintf(stderr, "-i cannot be combined with -c\n");
+		return EXIT_FAILURE;
+	}
+	if (opts->resume && checkpointPath == NULL){
+		fprintf(stderr, "--resume needs a checkpoint file (-c)\n");
+		return EXIT_FAILURE;
+	}
+
+	struct direct_queue *direct_Q = malloc(sizeof(struct direct_queue));
+	struct file_queue *file_Q = malloc(sizeof(struct file_queue));
+	WFDRegistry *registry = malloc(sizeof(WFDRegistry));
+	char **roots = malloc(sizeof(char*) * (numPaths > 0 ? numPaths : 1));
+	// Include globs replace the default suffix
+	PathFilter filter;
+	filter.suffix = strdup(opts->suffix != NULL ? opts->suffix : opts->numInclude > 0 ? "" : ".txt");
+	filter.include = opts->include;
+	filter.numInclude = opts->numInclude;
+	filter.exclude = opts->exclude;
+	filter.numExclude = opts->numExclude;
+	filter.maxDepth = opts->maxDepth;
+	if (!direct_Q || !file_Q || !registry || !roots || !filter.suffix) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	direct_queue_init(direct_Q);
+	file_queue_init(file_Q);
+	registry_init(registry);
+
+	// Directories are walked by the directory threads; files are queued now
+	int numRoots = 0;
+	for (int i = 0; i < numPaths; i++){
+		DIR *dirp = opendir(paths[i]);
+		if (dirp == NULL){
+			enqueueArgument(paths[i], &filter, file_Q);
+			continue;
+		}
+		struct directNode *new_direct = malloc(sizeof(struct directNode));
+		if (!new_direct) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		new_direct->next = NULL;
+		new_direct->directName = strdup(paths[i]);
+		if (!new_direct->directName) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		new_direct->ident = direct_identity(direct_Q, NULL, dirfd(dirp));
+		direct_enqueue(new_direct, direct_Q);
+		roots[numRoots++] = paths[i];
+		closedir(dirp);
+	}
+
+	int pipelineOn = opts->pipelined && daemonSocket == NULL && storeOut == NULL && storeIn == NULL && storeAll == NULL;
+	if (opts->autoThreads){
+		// Pool sizes come from the available cores instead of -d, -f and -a
+		autoTuner = autotune_create(pipelineOn);
+		dthreads = autoTuner->pools[POOL_TRAVERSE].threads;
+		fthreads = autoTuner->pools[POOL_WFD].threads;
+		athreads = autoTuner->pools[POOL_ANALYSIS].threads;
+	}
+
+	struct direct_arg *direct_args = malloc(sizeof(struct direct_arg) * dthreads);
+	if (!direct_args) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+
+	pthread_t* dthreadIDs;
+	dthreadIDs = malloc(sizeof(pthread_t)*dthreads);
+	if (!dthreadIDs) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+
+	pthread_t* fthreadIDs;
+	fthreadIDs = malloc(sizeof(pthread_t)*fthreads);
+	if (!fthreadIDs) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+
+	// Copies are shared by (dev, inode), and by content with -H. The daemon
+	// replaces WFDs in place, so it keeps every path separate.
+	DedupTable *dedup = NULL;
+	if (daemonSocket == NULL){
+		dedup = malloc(sizeof(DedupTable));
+		if (!dedup) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		dedup_init(dedup, opts->hashContent);
+	}
+	// Pipelined analysis: the analysis threads compare pairs as WFDs are published
+	Pipeline *pipeline = NULL;
+	pthread_t *pthreadIDs = NULL;
+	if (pipelineOn){
+		pipeline = malloc(sizeof(Pipeline));
+		pthreadIDs = malloc(sizeof(pthread_t) * athreads);
+		if (!pipeline || !pthreadIDs) {
+			perror("Malloc failed\n");
+			exit(1);
+		}
+		pipeline_init(pipeline, registry);
+		for (int i = 0; i < athreads; i++){
+			pthread_create(&pthreadIDs[i], NULL, computePipelineJSD, pipeline);
+		}
+	}
+	if (autoTuner != NULL){
+		autotune_run(autoTuner, direct_depth, direct_Q, file_depth, file_Q, pipeline ? pipeline_depth : NULL, pipeline);
+	}
+	struct timespec collectStart;
+	clock_gettime(CLOCK_MONOTONIC, &collectStart);
+	// Start directory threads
+	for (int i = 0; i < dthreads; i++){
+		direct_args[i].input_Q = direct_Q;
+		direct_args[i].second_Q = file_Q;
+		direct_args[i].filter = &filter;
+		pthread_create(&dthreadIDs[i], NULL, traverse, &direct_args[i]);
+	}
+	struct file_arg *file_args = malloc(sizeof(struct file_arg) * fthreads);
+	if (!file_args) {
+		perror("Malloc failed\n");
+		exit(1);
+	}
+	// Start file threads
+	for (int i = 0; i < fthreads; i++){
+		file_args[i].input_Q = file_Q;
+		file_args[i].second_Q = direct_Q;
+		file_args[i].registry = registry;
+		file_args[i].alphabet = alphabet;
+		file_args[i].dedup = dedup;
+		file_args[i].pipeline = pipeline;
+		pthread_create(&fthreadIDs[i], NULL, computeWFD, &file_args[i]);
+	} 
+	// Join directory threads; join file threads
+	for (int i = 0; i < dthreads; i++){
+		pthread_join(dthreadIDs[i], NULL);	
+	}
+	for (int i = 0; i < fthreads; i++){
+		pthread_join(fthreadIDs[i], NULL);
+	}
+	if (autoTuner != NULL){
+		autotune_stop(autoTuner);
+	}
+	if (pipeline != NULL){
+		pipeline_close(pipeline);
+		for (int i = 0; i < athreads; i++){
+			pthread_join(pthreadIDs[i], NULL);
+		}
+		free(pthreadIDs);
+	}
+	if (opts->showStats){
+		fprintf(stderr, "stats: collection %.3fs, %u files, %d traversal and %d WFD threads\n",
+				secondsSince(&collectStart), registry_size(registry), dthreads, fthreads);
+		if (autoTuner != NULL){
+			autotune_report(autoTuner, stderr);
+		}
+	}
+	if (autoTuner != NULL){
+		autotune_destroy(autoTuner);
+		autoTuner = NULL;
+	}
+	free(file_args);
+	free(direct_args); 
+
+	pthread_mutex_destroy(&file_Q->fLock);
+	pthread_cond_destroy(&file_Q->ready);
+	free(file_Q);
+
+	direct_identity_free(direct_Q);
+	pthread_mutex_destroy(&direct_Q->dLock);
+	pthread_cond_destroy(&direct_Q->ready);
+	free(direct_Q);
+	free(dthreadIDs);
+	free(fthreadIDs);
+
+	// Daemon mode: serve queries over the collected WFDs until interrupted
+	unsigned numFiles = registry_size(registry);
+	if (daemonSocket != NULL){
+		WFDNode **files = registry_toArray(registry, numFiles);
+		int status = runDaemon(daemonSocket, files, numFiles, roots, numRoots, alphabet, &filter, athreads);
+		free(files);
+		free(roots);
+		registry_free(registry, 0);
+		free(registry);
+		free(filter.suffix);
+		return status;
+	}
+	free(roots);
+	free(filter.suffix);
+
+	// Duplicates borrow the distribution of the copy that was tokenized
+	WFDNode **files = registry_toArray(registry, numFiles);
+	if (checkpointPath != NULL){
+		// A checkpoint refers to pairs by position, so fix the order across runs
+		qsort(files, numFiles, sizeof(WFDNode*), compareFilenames);
+	}
+	unsigned numUnique = resolveDuplicates(files, &numFiles);
+	dedup_destroy(dedup);
+	free(dedup);
+
+	// Exit if there are not enough valid files (with the appropriate suffix) to compare
+	int status = EXIT_SUCCESS;
+	if (storeAll == NULL && numFiles < ((storeOut || storeIn) ? 1 : 2)){
+		perror("Not enough files\n");
+		status = EXIT_FAILURE;
+
+	// Store mode: save the WFDs as a corpus for later queries
+	// Query mode: compare the WFDs against a stored corpus
+	// Out-of-core mode: compare every pair of a stored corpus, tile by tile
+	} else if (storeAll != NULL){
+		WFDStore *store = openStore(storeAll);
+		if (store == NULL){
+			status = EXIT_FAILURE;
+		} else if (store->numFiles < 2){
+			fprintf(stderr, "Not enough files\n");
+			closeStore(store);
+			status = EXIT_FAILURE;
+		} else {
+			// The pairs stream to sorted runs on disk, or into the clusters
+			size_t numPairs = (size_t) store->numFiles * (store->numFiles - 1) / 2;
+			OOCSpill spill;
+			if (clusterThreshold > 0){
+				pairClusters = cluster_create(store->numFiles, clusterThreshold);
+			} else if (ooc_spill_init(&spill) != 0){
+				status = EXIT_FAILURE;
+			}
+			if (status == EXIT_SUCCESS){
+				struct timespec analysisStart;
+				clock_gettime(CLOCK_MONOTONIC, &analysisStart);
+				analyzeStore(store, pairClusters == NULL ? &spill : NULL, opts->blockBytes, athreads);
+				if (opts->showStats){
+					fprintf(stderr, "stats: analysis %.3fs, %zu pairs, %d threads\n", secondsSince(&analysisStart), numPairs, athreads);
+				}
+				if (pairClusters != NULL){
+					printClusters(pairClusters, store->files, store->numFiles, opts->topK);
+				} else {
+					emitSpill(&spill, store->files, sink, ctx);
+					ooc_spill_free(&spill);
+				}
+			}
+			if (pairClusters != NULL){
+				cluster_destroy(pairClusters);
+				pairClusters = NULL;
+			}
+			closeStore(store);
+		}
+	} else if (storeOut != NULL){
+		if (writeStore(storeOut, files, numFiles) != 0){
+			status = EXIT_FAILURE;
+		}
+	} else if (storeIn != NULL){
+		WFDStore *store = openStore(storeIn);
+		if (store == NULL){
+			status = EXIT_FAILURE;
+		} else {
+			queryCorpus(store, files, numFiles, opts->topK, athreads);
+			closeStore(store);
+		}
+	} else {
+		// ANALYSIS THREAD ACTIONS
+		// Every pair's result lives in one flat allocation, in row-major order
+		struct timespec analysisStart;
+		clock_gettime(CLOCK_MONOTONIC, &analysisStart);
+		PairResults *results = createPairResults(files, numFiles);
+		if (clusterThreshold > 0) {
+			// Near pairs are grouped as they are computed, by distinct WFD
+			pairClusters = cluster_create(numUnique, clusterThreshold);
+		}
+
+		if (pipeline != NULL) {
+			pipeline_collect(pipeline, results);
+		} else if (numUnique == numFiles) {
+			analyzePairs(results, athreads, opts->useIndex, checkpointPath, opts->resume);
+		} else {
+			// Only the distinct WFDs are compared; every path pair then copies the
+			// result of its canonical pair, and copies of one file score 0
+			analyzeDuplicatePairs(results, numUnique, athreads, opts->useIndex, checkpointPath, opts->resume);
+		}
+		if (opts->showStats) {
+			fprintf(stderr, "stats: analysis %.3fs, %zu pairs, %d threads\n", secondsSince(&analysisStart), results->numPairs, athreads);
+		}
+
+		if (pairClusters != NULL) {
+			printClusters(pairClusters, files, numFiles, opts->topK);
+			cluster_destroy(pairClusters);
+			pairClusters = NULL;
+		} else {
+			// Order the pairs by combined word count for output
+			sortPairResults(results);
+			emitPairResults(results, sink, ctx);
+		}
+		freePairResults(results);
+	}
+	if (pipeline != NULL) {
+		pipeline_destroy(pipeline);
+		free(pipeline);
+	}
+	free(files);
+	registry_free(registry, 1);
+	free(registry);
+	return status;
+}
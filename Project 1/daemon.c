@@ -0,0 +1,721 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/**
+ * Resident corpus served by the daemon.
+ * files is guarded by lock; writers (the inotify thread) take it exclusively,
+ * queries share it. The term index is rebuilt lazily by the first query that
+ * finds it stale and is dropped by every writer.
+ **/
+typedef struct Corpus {
+    WFDNode** files;
+    unsigned numFiles;
+    unsigned capacity;
+    pthread_rwlock_t lock;
+    TermIndex* index;
+    unsigned* byTotal;
+    pthread_mutex_t indexLock;
+    char* alphabet;
+    PathFilter* filter;
+} Corpus;
+
+typedef struct ClientQueue {
+    int* fds;
+    unsigned head;
+    unsigned size;
+    unsigned capacity;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} ClientQueue;
+
+typedef struct Watcher {
+    int fd;
+    char** dirs;        // dirs[wd]: path of a watched directory
+    int* depths;        // depths[wd]: its depth below its root
+    int numDirs;
+} Watcher;
+
+struct daemon_arg {
+    Corpus* corpus;
+    ClientQueue* clients;
+    Watcher* watcher;
+};
+
+volatile sig_atomic_t daemonRunning = 1;
+
+void daemonHandler(int signal) {
+    daemonRunning = 0;
+}
+
+/**
+ * Position of a file in the corpus, or -1.
+ **/
+int findCorpusFile(Corpus* corpus, const char* name) {
+    unsigned i;
+    for (i = 0; i < corpus->numFiles; ++i) {
+        if (strcmp(corpus->files[i]->filename, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Drop the term index after the corpus changed. Caller holds the write lock.
+ **/
+void invalidateIndex(Corpus* corpus) {
+    if (corpus->index != NULL) {
+        freeTermIndex(corpus->index);
+        free(corpus->byTotal);
+        corpus->index = NULL;
+        corpus->byTotal = NULL;
+    }
+}
+
+/**
+ * (Re)tokenize a file and publish its WFD, replacing any previous version.
+ **/
+void corpusUpdate(Corpus* corpus, const char* path) {
+    char* name = strdup(path);
+    if (name == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    WFDNode* wfd = createFileWFD(name, corpus->alphabet);
+    if (wfd == NULL) {
+        free(name);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&corpus->lock);
+    int pos = findCorpusFile(corpus, path);
+    if (pos >= 0) {
+        freeWFD(corpus->files[pos]);
+        corpus->files[pos] = wfd;
+    } else {
+        if (corpus->numFiles == corpus->capacity) {
+            corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 16;
+            WFDNode** files = realloc(corpus->files, sizeof(WFDNode*) * corpus->capacity);
+            if (files == NULL) {
+                perror("Malloc failed\n");
+                exit(1);
+            }
+            corpus->files = files;
+        }
+        corpus->files[corpus->numFiles++] = wfd;
+    }
+    invalidateIndex(corpus);
+    pthread_rwlock_unlock(&corpus->lock);
+}
+
+/**
+ * Remove a file, or every file under a directory prefix, from the corpus.
+ **/
+void corpusRemove(Corpus* corpus, const char* path, int isDir) {
+    size_t len = strlen(path);
+    pthread_rwlock_wrlock(&corpus->lock);
+    unsigned i = 0;
+    int changed = 0;
+    while (i < corpus->numFiles) {
+        const char* name = corpus->files[i]->filename;
+        if (strcmp(name, path) == 0 || (isDir && strncmp(name, path, len) == 0 && name[len] == '/')) {
+            freeWFD(corpus->files[i]);
+            corpus->files[i] = corpus->files[--corpus->numFiles];
+            changed = 1;
+        } else {
+            ++i;
+        }
+    }
+    if (changed) {
+        invalidateIndex(corpus);
+    }
+    pthread_rwlock_unlock(&corpus->lock);
+}
+
+/**
+ * Get the term index, rebuilding it if a writer dropped it.
+ * Caller holds the read lock, so the files cannot change underneath it.
+ **/
+TermIndex* corpusIndex(Corpus* corpus) {
+    pthread_mutex_lock(&corpus->indexLock);
+    if (corpus->index == NULL) {
+        unsigned n = corpus->numFiles;
+        corpus->index = buildTermIndex(corpus->files, n);
+        corpus->byTotal = malloc(sizeof(unsigned) * (n > 0 ? n : 1));
+        if (corpus->byTotal == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        sortByTotal(corpus->files, n, corpus->byTotal);
+    }
+    TermIndex* index = corpus->index;
+    pthread_mutex_unlock(&corpus->indexLock);
+    return index;
+}
+
+/**
+ * Watch a directory and everything below it that the filter lets through;
+ * with load set, also tokenize the files found (used for directories created
+ * after start-up). depth is the directory's depth below its root.
+ **/
+void watchTree(Watcher* watcher, Corpus* corpus, const char* path, int depth, int load) {
+    int wd = inotify_add_watch(watcher->fd, path,
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF);
+    if (wd < 0) {
+        perror(path);
+        return;
+    }
+    if (wd >= watcher->numDirs) {
+        int n = wd + 16;
+        char** dirs = realloc(watcher->dirs, sizeof(char*) * n);
+        int* depths = realloc(watcher->depths, sizeof(int) * n);
+        if (dirs == NULL || depths == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        memset(dirs + watcher->numDirs, 0, sizeof(char*) * (n - watcher->numDirs));
+        watcher->dirs = dirs;
+        watcher->depths = depths;
+        watcher->numDirs = n;
+    }
+    free(watcher->dirs[wd]);
+    watcher->dirs[wd] = strdup(path);
+    watcher->depths[wd] = depth;
+
+    DIR* dirp = opendir(path);
+    if (dirp == NULL) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dirp))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char* child = malloc(strlen(path) + strlen(de->d_name) + 2);
+        if (child == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        sprintf(child, "%s/%s", path, de->d_name);
+        struct stat st;
+        if (!filter_excluded(corpus->filter, child, de->d_name) && stat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                if (filter_descend(corpus->filter, depth + 1)) {
+                    watchTree(watcher, corpus, child, depth + 1, load);
+                }
+            } else if (load && filter_file(corpus->filter, child, de->d_name)) {
+                corpusUpdate(corpus, child);
+            }
+        }
+        free(child);
+    }
+    closedir(dirp);
+}
+
+/**
+ * Applies inotify events to the corpus.
+ **/
+void* watchCorpus(void* argPtr) {
+    struct daemon_arg* args = argPtr;
+    Corpus* corpus = args->corpus;
+    Watcher* watcher = args->watcher;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while (daemonRunning) {
+        ssize_t len = read(watcher->fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            return NULL;
+        }
+        char* ptr;
+        for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event*) ptr)->len) {
+            struct inotify_event* ev = (struct inotify_event*) ptr;
+            if (ev->mask & IN_DELETE_SELF) {
+                if (ev->wd < watcher->numDirs) {
+                    free(watcher->dirs[ev->wd]);
+                    watcher->dirs[ev->wd] = NULL;
+                }
+                continue;
+            }
+            if (ev->len == 0 || ev->wd >= watcher->numDirs || watcher->dirs[ev->wd] == NULL || ev->name[0] == '.') {
+                continue;
+            }
+            const char* dir = watcher->dirs[ev->wd];
+            char* path = malloc(strlen(dir) + strlen(ev->name) + 2);
+            if (path == NULL) {
+                perror("Malloc failed\n");
+                exit(1);
+            }
+            sprintf(path, "%s/%s", dir, ev->name);
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    int depth = watcher->depths[ev->wd] + 1;
+                    if (!filter_excluded(corpus->filter, path, ev->name) && filter_descend(corpus->filter, depth)) {
+                        watchTree(watcher, corpus, path, depth, 1);
+                    }
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    corpusRemove(corpus, path, 1);
+                }
+            } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                if (filter_file(corpus->filter, path, ev->name)) {
+                    corpusUpdate(corpus, path);
+                }
+            } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                corpusRemove(corpus, path, 0);
+            }
+            free(path);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * SIM <k> <path>: the k corpus files closest to a file.
+ * The file is used from the corpus when present, otherwise tokenized for the query.
+ **/
+void serveSimilar(Corpus* corpus, FILE* out, unsigned k, char* path) {
+    WFDNode* own = NULL;
+    pthread_rwlock_rdlock(&corpus->lock);
+    int pos = findCorpusFile(corpus, path);
+    WFDNode* query;
+    if (pos >= 0) {
+        query = corpus->files[pos];
+    } else {
+        pthread_rwlock_unlock(&corpus->lock);
+        char* name = strdup(path);
+        own = name ? createFileWFD(name, corpus->alphabet) : NULL;
+        if (own == NULL) {
+            free(name);
+            fprintf(out, "ERR cannot read %s\n", path);
+            return;
+        }
+        query = own;
+        pthread_rwlock_rdlock(&corpus->lock);
+    }
+
+    QueryJob job;
+    unsigned n = corpus->numFiles;
+    job.index = corpusIndex(corpus);
+    job.store = NULL;
+    job.files = corpus->files;
+    job.numFiles = n;
+    job.queries = &query;
+    job.numQueries = 1;
+    job.topK = k + (pos >= 0 ? 1 : 0);  // the file matches itself
+    job.byTotal = corpus->byTotal;
+    QueryMatch* result = NULL;
+    unsigned numResults = 0;
+    job.results = &result;
+    job.numResults = &numResults;
+
+    double* acc = malloc(sizeof(double) * (n > 0 ? n : 1));
+    char* seen = calloc(n > 0 ? n : 1, 1);
+    unsigned* touched = malloc(sizeof(unsigned) * (n > 0 ? n : 1));
+    QueryMatch* cand = malloc(sizeof(QueryMatch) * (n + job.topK + 1));
+    if (!acc || !seen || !touched || !cand) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    runQuery(&job, 0, acc, seen, touched, cand);
+
+    unsigned shown = 0, i;
+    for (i = 0; i < numResults; ++i) {
+        if ((int) result[i].file != pos && shown < k) {
+            ++shown;
+        }
+    }
+    fprintf(out, "OK %u\n", shown);
+    shown = 0;
+    for (i = 0; i < numResults && shown < k; ++i) {
+        if ((int) result[i].file != pos) {
+            fprintf(out, "%f %s\n", result[i].score, corpus->files[result[i].file]->filename);
+            ++shown;
+        }
+    }
+    pthread_rwlock_unlock(&corpus->lock);
+
+    free(result);
+    free(acc);
+    free(seen);
+    free(touched);
+    free(cand);
+    if (own != NULL) {
+        freeWFD(own);
+    }
+}
+
+/**
+ * Keeps the k closest pairs in a max-heap ordered by score.
+ **/
+typedef struct PairMatch {
+    unsigned fileA;
+    unsigned fileB;
+    double score;
+} PairMatch;
+
+void offerPair(PairMatch* heap, unsigned* size, unsigned k, PairMatch m) {
+    unsigned i;
+    if (*size < k) {
+        i = (*size)++;
+        while (i > 0 && heap[(i - 1) / 2].score < m.score) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = m;
+        return;
+    }
+    if (k == 0 || m.score >= heap[0].score) {
+        return;
+    }
+    i = 0;
+    while (1) {
+        unsigned c = 2 * i + 1;
+        if (c >= k) {
+            break;
+        }
+        if (c + 1 < k && heap[c + 1].score > heap[c].score) {
+            ++c;
+        }
+        if (heap[c].score <= m.score) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = m;
+}
+
+int comparePairMatches(const void* a, const void* b) {
+    const PairMatch* x = a;
+    const PairMatch* y = b;
+    return (x->score > y->score) - (x->score < y->score);
+}
+
+/**
+ * TOP <k>: the k closest pairs in the corpus.
+ * Rows are accumulated through the term index; pairs without a shared word
+ * only cost the closed-form total.
+ **/
+void serveTopPairs(Corpus* corpus, FILE* out, unsigned k) {
+    pthread_rwlock_rdlock(&corpus->lock);
+    TermIndex* index = corpusIndex(corpus);
+    unsigned n = corpus->numFiles;
+    double* acc = calloc(n > 0 ? n : 1, sizeof(double));
+    PairMatch* heap = malloc(sizeof(PairMatch) * (k > 0 ? k : 1));
+    if (!acc || !heap) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned size = 0;
+    unsigned i, j;
+    for (i = 0; i + 1 < n; ++i) {
+        accumulateRow(index, acc, i);
+        for (j = i + 1; j < n; ++j) {
+            PairMatch m;
+            m.fileA = i;
+            m.fileB = j;
+            m.score = queryScore(index->files[i], index->files[j], acc[j]);
+            acc[j] = 0;
+            offerPair(heap, &size, k, m);
+        }
+    }
+    qsort(heap, size, sizeof(PairMatch), comparePairMatches);
+    fprintf(out, "OK %u\n", size);
+    for (i = 0; i < size; ++i) {
+        fprintf(out, "%f %s %s\n", heap[i].score, corpus->files[heap[i].fileA]->filename,
+            corpus->files[heap[i].fileB]->filename);
+    }
+    pthread_rwlock_unlock(&corpus->lock);
+    free(acc);
+    free(heap);
+}
+
+/**
+ * Serves the requests of one client connection, one per line.
+ **/
+void serveClient(Corpus* corpus, int fd) {
+    FILE* in = fdopen(fd, "r");
+    int outFd = dup(fd);
+    FILE* out = outFd >= 0 ? fdopen(outFd, "w") : NULL;
+    if (in == NULL || out == NULL) {
+        if (in != NULL) { fclose(in); } else { close(fd); }
+        if (outFd >= 0 && out == NULL) { close(outFd); }
+        return;
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        char* rest = NULL;
+        unsigned long k = 0;
+        if (strncmp(line, "SIM ", 4) == 0) {
+            k = strtoul(line + 4, &rest, 10);
+            if (rest != line + 4 && *rest == ' ' && k > 0) {
+                serveSimilar(corpus, out, k, rest + 1);
+            } else {
+                fprintf(out, "ERR usage: SIM <k> <path>\n");
+            }
+        } else if (strncmp(line, "TOP ", 4) == 0) {
+            k = strtoul(line + 4, &rest, 10);
+            if (rest != line + 4 && *rest == '\0' && k > 0) {
+                serveTopPairs(corpus, out, k);
+            } else {
+                fprintf(out, "ERR usage: TOP <k>\n");
+            }
+        } else {
+            fprintf(out, "ERR unknown request\n");
+        }
+        fflush(out);
+    }
+    free(line);
+    fclose(out);
+    fclose(in);
+}
+
+/**
+ * Worker: serves connections handed over by the accept loop.
+ **/
+void* serveClients(void* argPtr) {
+    struct daemon_arg* args = argPtr;
+    ClientQueue* Q = args->clients;
+    while (1) {
+        pthread_mutex_lock(&Q->lock);
+        while (Q->size == 0 && !Q->closed) {
+            pthread_cond_wait(&Q->ready, &Q->lock);
+        }
+        if (Q->size == 0) {
+            pthread_mutex_unlock(&Q->lock);
+            return NULL;
+        }
+        int fd = Q->fds[Q->head];
+        Q->head = (Q->head + 1) % Q->capacity;
+        Q->size--;
+        pthread_mutex_unlock(&Q->lock);
+        serveClient(args->corpus, fd);
+    }
+}
+
+/**
+ * Hands a connection to the worker pool.
+ **/
+void client_enqueue(ClientQueue* Q, int fd) {
+    pthread_mutex_lock(&Q->lock);
+    if (Q->size == Q->capacity) {
+        unsigned capacity = Q->capacity ? Q->capacity * 2 : 16;
+        int* fds = malloc(sizeof(int) * capacity);
+        if (fds == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        unsigned i;
+        for (i = 0; i < Q->size; ++i) {
+            fds[i] = Q->fds[(Q->head + i) % Q->capacity];
+        }
+        free(Q->fds);
+        Q->fds = fds;
+        Q->head = 0;
+        Q->capacity = capacity;
+    }
+    Q->fds[(Q->head + Q->size) % Q->capacity] = fd;
+    Q->size++;
+    pthread_cond_signal(&Q->ready);
+    pthread_mutex_unlock(&Q->lock);
+}
+
+/**
+ * Daemon mode: keeps the WFDs resident, follows the root directories with
+ * inotify and answers SIM/TOP requests on a Unix-domain socket.
+ **/
+int runDaemon(const char* socketPath, WFDNode** files, unsigned numFiles, char** roots, int numRoots,
+        char* alphabet, PathFilter* filter, int workers) {
+    Corpus corpus;
+    corpus.files = NULL;
+    corpus.numFiles = 0;
+    corpus.capacity = 0;
+    corpus.index = NULL;
+    corpus.byTotal = NULL;
+    corpus.alphabet = alphabet;
+    corpus.filter = filter;
+    pthread_rwlock_init(&corpus.lock, NULL);
+    pthread_mutex_init(&corpus.indexLock, NULL);
+    corpus.capacity = numFiles > 16 ? numFiles : 16;
+    corpus.files = malloc(sizeof(WFDNode*) * corpus.capacity);
+    if (corpus.files == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    memcpy(corpus.files, files, sizeof(WFDNode*) * numFiles);
+    corpus.numFiles = numFiles;
+
+    Watcher watcher;
+    watcher.dirs = NULL;
+    watcher.depths = NULL;
+    watcher.numDirs = 0;
+    watcher.fd = inotify_init();
+    if (watcher.fd < 0) {
+        perror("inotify");
+        return EXIT_FAILURE;
+    }
+    int r;
+    for (r = 0; r < numRoots; ++r) {
+        watchTree(&watcher, &corpus, roots[r], 0, 0);
+    }
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (sfd < 0 || strlen(socketPath) >= sizeof(addr.sun_path)) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socketPath);
+    unlink(socketPath);
+    if (bind(sfd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(sfd, 16) != 0) {
+        perror(socketPath);
+        close(sfd);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction act;
+    act.sa_handler = daemonHandler;
+    act.sa_flags = 0;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    ClientQueue clients;
+    clients.fds = NULL;
+    clients.head = 0;
+    clients.size = 0;
+    clients.capacity = 0;
+    clients.closed = 0;
+    pthread_mutex_init(&clients.lock, NULL);
+    pthread_cond_init(&clients.ready, NULL);
+
+    struct daemon_arg args;
+    args.corpus = &corpus;
+    args.clients = &clients;
+    args.watcher = &watcher;
+
+    // Only the accept loop takes the signals
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    pthread_t watchID;
+    pthread_t* workerIDs = malloc(sizeof(pthread_t) * workers);
+    if (workerIDs == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    pthread_create(&watchID, NULL, watchCorpus, &args);
+    int w;
+    for (w = 0; w < workers; ++w) {
+        pthread_create(&workerIDs[w], NULL, serveClients, &args);
+    }
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+    while (daemonRunning) {
+        int cfd = accept(sfd, NULL, NULL);
+        if (cfd < 0) {
+            continue;
+        }
+        client_enqueue(&clients, cfd);
+    }
+
+    pthread_mutex_lock(&clients.lock);
+    clients.closed = 1;
+    pthread_cond_broadcast(&clients.ready);
+    pthread_mutex_unlock(&clients.lock);
+    for (w = 0; w < workers; ++w) {
+        pthread_join(workerIDs[w], NULL);
+    }
+    pthread_cancel(watchID);
+    pthread_join(watchID, NULL);
+    close(watcher.fd);
+
+    close(sfd);
+    unlink(socketPath);
+    invalidateIndex(&corpus);
+    unsigned i;
+    for (i = 0; i < corpus.numFiles; ++i) {
+        freeWFD(corpus.files[i]);
+    }
+    for (r = 0; r < watcher.numDirs; ++r) {
+        free(watcher.dirs[r]);
+    }
+    free(watcher.dirs);
+    free(watcher.depths);
+    free(corpus.files);
+    free(clients.fds);
+    free(workerIDs);
+    pthread_rwlock_destroy(&corpus.lock);
+    pthread_mutex_destroy(&corpus.indexLock);
+    pthread_mutex_destroy(&clients.lock);
+    pthread_cond_destroy(&clients.ready);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Client mode: sends one request line to a daemon and prints the reply.
+ **/
+int runClient(const char* socketPath, int argc, char** argv) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (fd < 0 || strlen(socketPath) >= sizeof(addr.sun_path)) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socketPath);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror(socketPath);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = fdopen(fd, "r+");
+    int i;
+    for (i = 0; i < argc; ++i) {
+        fprintf(out, i == 0 ? "%s" : " %s", argv[i]);
+    }
+    fprintf(out, "\n");
+    fflush(out);
+    shutdown(fd, SHUT_WR);
+
+    char buf[4096];
+    size_t bytes;
+    int status = EXIT_SUCCESS;
+    int first = 1;
+    while ((bytes = fread(buf, 1, sizeof(buf), out)) > 0) {
+        if (first && bytes >= 3 && strncmp(buf, "ERR", 3) == 0) {
+            status = EXIT_FAILURE;
+        }
+        first = 0;
+        fwrite(buf, 1, bytes, stdout);
+    }
+    fclose(out);
+    return status;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define DEDUP_BUCKETS 4096
+
+/**
+ * One distinct file identity seen by the WFD threads.
+ * An entry is keyed by (dev, inode) and, with content hashing, also by
+ * (hash, size). canon links an entry whose bytes matched an earlier file.
+ **/
+typedef struct DedupEntry {
+    dev_t dev;
+    ino_t ino;
+    uint64_t hash;
+    off_t size;
+    char* path;                 // a copy: the file's own name is freed if it cannot be read
+    WFDNode* wfd;               // set once the canonical copy is tokenized
+    struct DedupEntry* canon;
+    struct DedupEntry* nextInode;
+    struct DedupEntry* nextContent;
+    struct DedupEntry* nextAll;
+} DedupEntry;
+
+typedef struct DedupTable {
+    DedupEntry* inodes[DEDUP_BUCKETS];
+    DedupEntry* contents[DEDUP_BUCKETS];
+    DedupEntry* all;
+    int hashContent;
+    pthread_mutex_t lock;
+} DedupTable;
+
+/**
+ * Initializes the deduplication table.
+ **/
+void dedup_init(DedupTable* table, int hashContent) {
+    memset(table->inodes, 0, sizeof(table->inodes));
+    memset(table->contents, 0, sizeof(table->contents));
+    table->all = NULL;
+    table->hashContent = hashContent;
+    pthread_mutex_init(&table->lock, NULL);
+}
+
+/**
+ * Frees the table entries (the WFDs belong to the WFD list).
+ **/
+void dedup_destroy(DedupTable* table) {
+    DedupEntry* ptr = table->all;
+    while (ptr != NULL) {
+        DedupEntry* next = ptr->nextAll;
+        free(ptr->path);
+        free(ptr);
+        ptr = next;
+    }
+    pthread_mutex_destroy(&table->lock);
+}
+
+/**
+ * 64-bit hash of a file's bytes; returns -1 if it cannot be read.
+ **/
+int hashFile(const char* path, uint64_t* hash, off_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    off_t total = 0;
+    unsigned char buf[65536];
+    ssize_t bytes;
+    while ((bytes = read(fd, buf, sizeof(buf))) > 0) {
+        ssize_t i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            h = (h ^ w) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        for (; i < bytes; ++i) {
+            h = (h ^ buf[i]) * 0x100000001b3ull;
+        }
+        total += bytes;
+    }
+    close(fd);
+    if (bytes < 0) {
+        return -1;
+    }
+    *hash = h ^ (uint64_t) total;
+    *size = total;
+    return 0;
+}
+
+/**
+ * Byte-for-byte comparison of two files (1 if identical).
+ **/
+int sameContent(const char* a, const char* b) {
+    int fa = open(a, O_RDONLY);
+    int fb = open(b, O_RDONLY);
+    int same = fa != -1 && fb != -1;
+    unsigned char bufA[65536];
+    unsigned char bufB[65536];
+    while (same) {
+        ssize_t na = read(fa, bufA, sizeof(bufA));
+        ssize_t nb = 0;
+        while (na > 0 && nb < na) {
+            ssize_t r = read(fb, bufB + nb, na - nb);
+            if (r <= 0) {
+                break;
+            }
+            nb += r;
+        }
+        if (na < 0 || nb != na || memcmp(bufA, bufB, na) != 0) {
+            same = 0;
+        } else if (na == 0) {
+            same = read(fb, bufB, 1) == 0;
+            break;
+        }
+    }
+    if (fa != -1) { close(fa); }
+    if (fb != -1) { close(fb); }
+    return same;
+}
+
+/**
+ * Claims a file for tokenization.
+ * Returns NULL if this path is the first copy seen and must be tokenized into
+ * *entry (then published with dedup_publish); otherwise returns the entry of
+ * the copy it duplicates.
+ **/
+DedupEntry* dedup_claim(DedupTable* table, const char* path, dev_t dev, ino_t ino, DedupEntry** entry) {
+    unsigned b = (unsigned) ((dev * 31 + ino) % DEDUP_BUCKETS);
+    pthread_mutex_lock(&table->lock);
+    DedupEntry* ptr;
+    for (ptr = table->inodes[b]; ptr != NULL; ptr = ptr->nextInode) {
+        if (ptr->dev == dev && ptr->ino == ino) {
+            pthread_mutex_unlock(&table->lock);
+            return ptr;
+        }
+    }
+    DedupEntry* e = calloc(1, sizeof(DedupEntry));
+    if (e == NULL || (e->path = strdup(path)) == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    e->dev = dev;
+    e->ino = ino;
+    e->nextInode = table->inodes[b];
+    table->inodes[b] = e;
+    e->nextAll = table->all;
+    table->all = e;
+    pthread_mutex_unlock(&table->lock);
+    *entry = e;
+
+    if (!table->hashContent || hashFile(path, &e->hash, &e->size) != 0) {
+        return NULL;
+    }
+
+    // Same (hash, size) as an earlier file: confirm the bytes before sharing
+    b = (unsigned) (e->hash % DEDUP_BUCKETS);
+    pthread_mutex_lock(&table->lock);
+    DedupEntry* match = NULL;
+    for (ptr = table->contents[b]; ptr != NULL; ptr = ptr->nextContent) {
+        if (ptr->hash == e->hash && ptr->size == e->size) {
+            match = ptr;
+            break;
+        }
+    }
+    if (match == NULL) {
+        e->nextContent = table->contents[b];
+        table->contents[b] = e;
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    if (match != NULL && sameContent(path, match->path)) {
+        e->canon = match;
+        return match;
+    }
+    return NULL;
+}
+
+/**
+ * Records the WFD of a file claimed with dedup_claim.
+ **/
+void dedup_publish(DedupTable* table, DedupEntry* entry, WFDNode* wfd) {
+    pthread_mutex_lock(&table->lock);
+    entry->wfd = wfd;
+    pthread_mutex_unlock(&table->lock);
+}
+
+/**
+ * Creates the WFD of a duplicate path; its distribution is filled in by
+ * resolveDuplicates once every canonical copy is done.
+ **/
+WFDNode* createDuplicateWFD(char* filename, DedupEntry* entry) {
+    TrieNode* root = NULL;
+    WFDNode* wfd = initializeWFD(&root, filename, 0);
+    if (wfd == NULL) {
+        exit(1);
+    }
+    wfd->dedup = entry;
+    return wfd;
+}
+
+/**
+ * Points every duplicate at its canonical WFD and numbers the distinct WFDs.
+ * A copy of a file that could not be read cannot be read either: it is
+ * reported and dropped from files, and *numFiles is updated (the WFD stays
+ * with the registry). Sets each WFD's id to its position among the distinct
+ * ones and returns how many distinct WFDs there are.
+ **/
+unsigned resolveDuplicates(WFDNode** files, unsigned* numFiles) {
+    unsigned numUnique = 0;
+    unsigned i, kept = 0;
+    for (i = 0; i < *numFiles; ++i) {
+        DedupEntry* entry = files[i]->dedup;
+        while (entry != NULL && entry->canon != NULL) {
+            entry = entry->canon;
+        }
+        if (entry != NULL && entry->wfd == NULL) {
+            fprintf(stderr, "%s: copy of %s, which could not be read\n", files[i]->filename, entry->path);
+            continue;
+        }
+        if (entry == NULL) {
+            files[i]->id = numUnique++;
+        }
+        files[kept++] = files[i];
+    }
+    *numFiles = kept;
+    for (i = 0; i < kept; ++i) {
+        WFDNode* wfd = files[i];
+        if (wfd->dedup == NULL) {
+            continue;
+        }
+        DedupEntry* entry = wfd->dedup;
+        while (entry->canon != NULL) {
+            entry = entry->canon;
+        }
+        WFDNode* canon = entry->wfd;
+        wfd->canon = canon;
+        wfd->id = canon->id;
+        wfd->wordCount = canon->wordCount;
+        wfd->termPool = canon->termPool;
+        wfd->termOffsets = canon->termOffsets;
+        wfd->counts = canon->counts;
+        wfd->freqs = canon->freqs;
+        wfd->numTerms = canon->numTerms;
+        wfd->totalFreq = canon->totalFreq;
+        wfd->sumSquares = canon->sumSquares;
+    }
+    return numUnique;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+/**
+ * Which paths a run reads: the -s suffix, --include and --exclude globs and
+ * --max-depth. Everything here looks at names only, so a directory or file
+ * that is filtered out is never opened. A glob without '/' is matched against
+ * the last component of a path, one with '/' against the whole path (where
+ * '*' also matches '/'). A compressed file is matched both with and without
+ * its .gz or .zst extension.
+ **/
+typedef struct PathFilter {
+    char* suffix;               // "" for every file
+    const char** include;       // a file must match one of these, if any are given
+    int numInclude;
+    const char** exclude;       // files and directories matching any of these are skipped
+    int numExclude;
+    int maxDepth;               // levels of subdirectories walked below a root; -1 for all
+} PathFilter;
+
+/**
+ * Last component of a path.
+ **/
+const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+int globMatches(const char* glob, const char* path, const char* name) {
+    if (strchr(glob, '/') != NULL) {
+        return fnmatch(glob, path, 0) == 0;
+    }
+    return fnmatch(glob, name, 0) == 0;
+}
+
+/**
+ * Whether any glob of a list matches a path whose last component is name.
+ **/
+int globListMatches(const char** globs, int numGlobs, const char* path, const char* name) {
+    int g;
+    for (g = 0; g < numGlobs; ++g) {
+        if (globMatches(globs[g], path, name)) {
+            return 1;
+        }
+    }
+    size_t ext = compressionExtension(name);
+    if (ext == 0 || numGlobs == 0) {
+        return 0;
+    }
+    // notes.txt.gz is also matched as notes.txt
+    char* plain = strndup(path, strlen(path) - ext);
+    if (plain == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    int matched = 0;
+    for (g = 0; g < numGlobs && !matched; ++g) {
+        matched = globMatches(globs[g], plain, baseName(plain));
+    }
+    free(plain);
+    return matched;
+}
+
+/**
+ * Whether a file or directory is excluded.
+ **/
+int filter_excluded(const PathFilter* F, const char* path, const char* name) {
+    return globListMatches(F->exclude, F->numExclude, path, name);
+}
+
+/**
+ * Whether a file is read: it matches the suffix and an include glob, and no
+ * exclude glob.
+ **/
+int filter_file(const PathFilter* F, const char* path, const char* name) {
+    if (F->suffix[0] != '\0' && !suffixMatches(path, F->suffix)) {
+        return 0;
+    }
+    if (F->numInclude > 0 && !globListMatches(F->include, F->numInclude, path, name)) {
+        return 0;
+    }
+    return !filter_excluded(F, path, name);
+}
+
+/**
+ * Whether a directory depth levels below its root is walked.
+ **/
+int filter_descend(const PathFilter* F, int depth) {
+    return F->maxDepth < 0 || depth <= F->maxDepth;
+}
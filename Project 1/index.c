@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct PostingList {
+    const char* term;
+    unsigned hash;
+    unsigned size;
+    unsigned capacity;
+    unsigned* files;    // file indices, ascending
+    double* freqs;
+    struct PostingList* next;
+} PostingList;
+
+typedef struct TermIndex {
+    PostingList** buckets;
+    unsigned numBuckets;   // power of two
+    WFDNode** files;
+    unsigned numFiles;
+    PostingList*** postingOf;  // postingOf[file][term]: list the term was added to
+    unsigned** rankOf;         // rankOf[file][term]: position of the file in that list
+} TermIndex;
+
+struct index_arg {
+    TermIndex* index;
+    PairResults* results;
+    unsigned* nextRow;
+    pthread_mutex_t* rowLock;
+};
+
+/**
+ * FNV-1a hash of a term.
+ **/
+unsigned hashTerm(const char* term) {
+    unsigned hash = 2166136261u;
+    while (*term) {
+        hash ^= (unsigned char) *term++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Index of pair (i, j), i < j, in the row-major pair array built by main().
+ **/
+size_t pairIndex(unsigned i, unsigned j, unsigned n) {
+    return (size_t) i * n - ((size_t) i * (i + 1)) / 2 + (j - i - 1);
+}
+
+/**
+ * Find the posting list of a term, creating it if needed.
+ **/
+PostingList* lookupPosting(TermIndex* index, const char* term, int create) {
+    unsigned hash = hashTerm(term);
+    PostingList** slot = &index->buckets[hash & (index->numBuckets - 1)];
+    PostingList* ptr = *slot;
+    while (ptr != NULL) {
+        if (ptr->hash == hash && strcmp(ptr->term, term) == 0) {
+            return ptr;
+        }
+        ptr = ptr->next;
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    ptr = malloc(sizeof(PostingList));
+    if (ptr == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    ptr->term = term;
+    ptr->hash = hash;
+    ptr->size = 0;
+    ptr->capacity = 0;
+    ptr->files = NULL;
+    ptr->freqs = NULL;
+    ptr->next = *slot;
+    *slot = ptr;
+    return ptr;
+}
+
+/**
+ * Append a file to a posting list.
+ **/
+unsigned appendPosting(PostingList* list, unsigned file, double freq) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 2;
+        unsigned* files = realloc(list->files, sizeof(unsigned) * list->capacity);
+        double* freqs = realloc(list->freqs, sizeof(double) * list->capacity);
+        if (!files || !freqs) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        list->files = files;
+        list->freqs = freqs;
+    }
+    list->files[list->size] = file;
+    list->freqs[list->size] = freq;
+    return list->size++;
+}
+
+/**
+ * Build the term -> files index over an array of frozen WFDs.
+ **/
+TermIndex* buildTermIndex(WFDNode** files, unsigned numFiles) {
+    TermIndex* index = malloc(sizeof(TermIndex));
+    if (index == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+
+    size_t totalTerms = 0;
+    unsigned i, t;
+    for (i = 0; i < numFiles; ++i) {
+        totalTerms += files[i]->numTerms;
+    }
+    index->numBuckets = 16;
+    while (index->numBuckets < totalTerms && index->numBuckets < (1u << 30)) {
+        index->numBuckets <<= 1;
+    }
+    index->buckets = calloc(index->numBuckets, sizeof(PostingList*));
+    index->postingOf = malloc(sizeof(PostingList**) * (numFiles > 0 ? numFiles : 1));
+    index->rankOf = malloc(sizeof(unsigned*) * (numFiles > 0 ? numFiles : 1));
+    if (!index->buckets || !index->postingOf || !index->rankOf) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    index->files = files;
+    index->numFiles = numFiles;
+
+    for (i = 0; i < numFiles; ++i) {
+        WFDNode* wfd = files[i];
+        unsigned n = wfd->numTerms > 0 ? wfd->numTerms : 1;
+        index->postingOf[i] = malloc(sizeof(PostingList*) * n);
+        index->rankOf[i] = malloc(sizeof(unsigned) * n);
+        if (!index->postingOf[i] || !index->rankOf[i]) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        for (t = 0; t < wfd->numTerms; ++t) {
+            PostingList* list = lookupPosting(index, wfd->termPool + wfd->termOffsets[t], 1);
+            index->postingOf[i][t] = list;
+            index->rankOf[i][t] = appendPosting(list, i, wfd->freqs[t]);
+        }
+    }
+    return index;
+}
+
+int compareTotals(const void* a, const void* b, void* arg) {
+    WFDNode** files = arg;
+    unsigned i = *(const unsigned*) a;
+    unsigned j = *(const unsigned*) b;
+    double x = files[i]->totalFreq;
+    double y = files[j]->totalFreq;
+    if (x != y) {
+        return (x > y) - (x < y);
+    }
+    return (i > j) - (i < j);
+}
+
+/**
+ * Order files by totalFreq, then position, ascending: among files that share
+ * no term with a query, the first ones in this order score best under JSD and
+ * Hellinger.
+ **/
+void sortByTotal(WFDNode** files, unsigned numFiles, unsigned* order) {
+    unsigned i;
+    for (i = 0; i < numFiles; ++i) {
+        order[i] = i;
+    }
+    qsort_r(order, numFiles, sizeof(unsigned), compareTotals, files);
+}
+
+/**
+ * Free a term index (the WFDs it points into are left alone).
+ **/
+void freeTermIndex(TermIndex* index) {
+    unsigned i;
+    for (i = 0; i < index->numBuckets; ++i) {
+        PostingList* ptr = index->buckets[i];
+        while (ptr != NULL) {
+            PostingList* next = ptr->next;
+            free(ptr->files);
+            free(ptr->freqs);
+            free(ptr);
+            ptr = next;
+        }
+    }
+    for (i = 0; i < index->numFiles; ++i) {
+        free(index->postingOf[i]);
+        free(index->rankOf[i]);
+    }
+    free(index->postingOf);
+    free(index->rankOf);
+    free(index->buckets);
+    free(index);
+}
+
+/**
+ * Defines name##AccumulateRow: accumulates the shared-term sums of a metric
+ * for every pair (i, j > i) of one row into row[j]. Each row is owned by
+ * exactly one thread, so no locking is needed.
+ **/
+#define DEFINE_ACCUMULATE(name, SHARED) \
+void name##AccumulateRow(TermIndex* index, double* row, unsigned i) { \
+    WFDNode* wfd = index->files[i]; \
+    unsigned t, k; \
+    for (t = 0; t < wfd->numTerms; ++t) { \
+        PostingList* list = index->postingOf[i][t]; \
+        double freq = wfd->freqs[t]; \
+        for (k = index->rankOf[i][t] + 1; k < list->size; ++k) { \
+            row[list->files[k]] += SHARED(freq, list->freqs[k]); \
+        } \
+    } \
+}
+
+DEFINE_ACCUMULATE(jsd, sharedTermJSD)
+DEFINE_ACCUMULATE(cosine, sharedTermCosine)
+DEFINE_ACCUMULATE(jaccard, sharedTermJaccard)
+DEFINE_ACCUMULATE(hellinger, sharedTermHellinger)
+
+/**
+ * Accumulate one row with the selected metric.
+ **/
+void accumulateRow(TermIndex* index, double* row, unsigned i) {
+    switch (pairMetric) {
+        case METRIC_COSINE: cosineAccumulateRow(index, row, i); break;
+        case METRIC_JACCARD: jaccardAccumulateRow(index, row, i); break;
+        case METRIC_HELLINGER: hellingerAccumulateRow(index, row, i); break;
+        default: jsdAccumulateRow(index, row, i); break;
+    }
+}
+
+/**
+ * Index worker: claims rows until none are left.
+ **/
+void* computeIndexJSD(void* argPtr) {
+    struct index_arg* args = argPtr;
+    TermIndex* index = args->index;
+    while (1) {
+        pthread_mutex_lock(args->rowLock);
+        unsigned i = (*args->nextRow)++;
+        pthread_mutex_unlock(args->rowLock);
+        if (i + 1 >= index->numFiles) {
+            return NULL;
+        }
+        accumulateRow(index, args->results->score + pairIndex(i, i + 1, index->numFiles) - (i + 1), i);
+    }
+}
+
+/**
+ * All-pairs JSD through the inverted index.
+ * Pairs sharing no term are never visited by the workers; their JSD comes
+ * straight from the per-file totals when the sums are finished.
+ **/
+void indexAllPairsJSD(PairResults* results, int athreads) {
+    WFDNode** files = results->files;
+    unsigned numFiles = results->numFiles;
+    TermIndex* index = buildTermIndex(files, numFiles);
+    size_t k;
+    for (k = 0; k < results->numPairs; ++k) {
+        results->score[k] = 0;
+    }
+
+    if (athreads > numFiles - 1) {
+        athreads = numFiles - 1;
+    }
+    pthread_t* tids = malloc(sizeof(pthread_t) * athreads);
+    struct index_arg* args = malloc(sizeof(struct index_arg) * athreads);
+    if (!tids || !args) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned nextRow = 0;
+    pthread_mutex_t rowLock;
+    pthread_mutex_init(&rowLock, NULL);
+
+    int p;
+    for (p = 0; p < athreads; ++p) {
+        args[p].index = index;
+        args[p].results = results;
+        args[p].nextRow = &nextRow;
+        args[p].rowLock = &rowLock;
+        pthread_create(&tids[p], NULL, computeIndexJSD, &args[p]);
+    }
+    for (p = 0; p < athreads; ++p) {
+        pthread_join(tids[p], NULL);
+    }
+    pthread_mutex_destroy(&rowLock);
+
+    for (k = 0; k < results->numPairs; ++k) {
+        if (results->combinedWC[k] == 0) {
+            results->score[k] = 0;
+        } else {
+            results->score[k] = metricFinish(files[results->fileA[k]], files[results->fileB[k]], results->score[k]);
+        }
+    }
+    if (pairClusters != NULL) {
+        cluster_range(pairClusters, results, 0, results->numPairs);
+    }
+
+    free(tids);
+    free(args);
+    freeTermIndex(index);
+}
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "libwfd.h"
+#include "scan.c"
+#include "wfd.c"
+#include "filter.c"
+#include "cluster.c"
+#include "autotune.c"
+#include "metric.c"
+#include "index.c"
+#include "store.c"
+#include "query.c"
+#include "daemon.c"
+#include "dedup.c"
+#include "registry.c"
+#include "pipeline.c"
+#include "checkpoint.c"
+#include "ooc.c"
+#include "corpus.c"
+
+/**
+ * The library's API over the modules above, which are compiled together as
+ * one unit into libwfd.a. Every WFD is tokenized against one shared alphabet,
+ * set up on first use.
+ **/
+#if WFD_MAX_NGRAM != MAX_NGRAM
+#error "WFD_MAX_NGRAM must match MAX_NGRAM"
+#endif
+
+static char* libAlphabet = NULL;
+static pthread_once_t libAlphabetOnce = PTHREAD_ONCE_INIT;
+
+static void initializeLibAlphabet(void) {
+    libAlphabet = initializeAlphabet();
+}
+
+/**
+ * The alphabet, or NULL if it could not be allocated.
+ **/
+static char* sharedAlphabet(void) {
+    pthread_once(&libAlphabetOnce, initializeLibAlphabet);
+    return libAlphabet;
+}
+
+int wfd_metric_by_name(const char* name) {
+    return parseMetric(name);
+}
+
+int wfd_set_metric(int metric) {
+    switch (metric) {
+        case WFD_METRIC_JSD: pairMetric = METRIC_JSD; return 0;
+        case WFD_METRIC_COSINE: pairMetric = METRIC_COSINE; return 0;
+        case WFD_METRIC_JACCARD: pairMetric = METRIC_JACCARD; return 0;
+        case WFD_METRIC_HELLINGER: pairMetric = METRIC_HELLINGER; return 0;
+    }
+    return -1;
+}
+
+int wfd_set_ngram(int n) {
+    if (n < 1 || n > WFD_MAX_NGRAM) {
+        return -1;
+    }
+    ngramSize = n;
+    return 0;
+}
+
+int wfd_set_hash_bits(int bits) {
+    if (bits < 0 || bits > WFD_MAX_HASH_BITS) {
+        return -1;
+    }
+    hashBits = bits;
+    return 0;
+}
+
+void wfd_set_split_threshold(size_t bytes) {
+    splitThreshold = bytes;
+}
+
+/**
+ * Tokenizer state and counts of a WFD being fed from memory.
+ **/
+struct WFDBuilder {
+    TokenState state;
+    TermCounts counts;
+    char* alphabet;
+    char* name;
+    int notEmpty;       // any bytes fed: as for an empty file, no bytes give no words
+};
+
+WFDBuilder* wfd_builder_create(const char* name) {
+    char* alphabet = sharedAlphabet();
+    WFDBuilder* builder = malloc(sizeof(WFDBuilder));
+    if (alphabet == NULL || builder == NULL) {
+        free(builder);
+        return NULL;
+    }
+    builder->alphabet = alphabet;
+    builder->name = strdup(name);
+    builder->notEmpty = 0;
+    if (builder->name == NULL || initializeTokenState(&builder->state, 0) == -1) {
+        free(builder->name);
+        free(builder);
+        return NULL;
+    }
+    initializeTermCounts(&builder->counts, builder->alphabet);
+    builder->state.buckets = builder->counts.buckets;
+    builder->state.shingles = shingleList(&builder->counts);
+    return builder;
+}
+
+int wfd_builder_feed(WFDBuilder* builder, const void* data, size_t size) {
+    if (size > 0) {
+        builder->notEmpty = 1;
+    }
+    return tokenizeBuffer(&builder->state, data, size, &builder->alphabet, &builder->counts.root);
+}
+
+WFD* wfd_builder_freeze(WFDBuilder* builder) {
+    if (builder->notEmpty) {
+        tokenizeFinish(&builder->state, &builder->alphabet, &builder->counts.root);
+    }
+    WFDNode* wfd = freezeTermCounts(&builder->counts, builder->name, builder->state.wordCount, builder->alphabet);
+    free(builder->state.stash);
+    free(builder);
+    return wfd;
+}
+
+void wfd_builder_free(WFDBuilder* builder) {
+    freeTermCounts(&builder->counts);
+    free(builder->state.stash);
+    free(builder->name);
+    free(builder);
+}
+
+WFD* wfd_from_buffer(const char* name, const void* data, size_t size) {
+    WFDBuilder* builder = wfd_builder_create(name);
+    if (builder == NULL) {
+        return NULL;
+    }
+    if (wfd_builder_feed(builder, data, size) == -1) {
+        wfd_builder_free(builder);
+        return NULL;
+    }
+    return wfd_builder_freeze(builder);
+}
+
+WFD* wfd_from_fd(const char* name, int fd) {
+    char* alphabet = sharedAlphabet();
+    char* filename = strdup(name);
+    if (alphabet == NULL || filename == NULL) {
+        free(filename);
+        return NULL;
+    }
+    WFDNode* wfd = createDescriptorWFD(fd, filename, alphabet);
+    if (wfd == NULL) {
+        free(filename);
+    }
+    return wfd;
+}
+
+WFD* wfd_from_file(const char* path) {
+    char* alphabet = sharedAlphabet();
+    char* filename = strdup(path);
+    if (alphabet == NULL || filename == NULL) {
+        free(filename);
+        return NULL;
+    }
+    WFDNode* wfd = createFileWFD(filename, alphabet);
+    if (wfd == NULL) {
+        free(filename);
+    }
+    return wfd;
+}
+
+const char* wfd_name(const WFD* wfd) {
+    return wfd->filename;
+}
+
+int wfd_word_count(const WFD* wfd) {
+    return wfd->wordCount;
+}
+
+unsigned wfd_num_terms(const WFD* wfd) {
+    return wfd->numTerms;
+}
+
+void wfd_free(WFD* wfd) {
+    freeWFD(wfd);
+}
+
+double wfd_score(const WFD* a, const WFD* b) {
+    return metricPair((WFDNode*) a, (WFDNode*) b);
+}
+
+size_t wfd_all_pairs(WFD** wfds, unsigned n, int threads, WFDPairSink sink, void* ctx) {
+    if (n < 2) {
+        return 0;
+    }
+    PairResults* results = createPairResults(wfds, n);
+    analyzePairs(results, threads > 0 ? threads : 1, 0, NULL, 0);
+    sortPairResults(results);
+    size_t taken = emitPairResults(results, sink, ctx);
+    freePairResults(results);
+    return taken;
+}
+
+void wfd_options_init(WFDOptions* opts) {
+    memset(opts, 0, sizeof(WFDOptions));
+    opts->dirThreads = 1;
+    opts->fileThreads = 1;
+    opts->analysisThreads = 1;
+    opts->blockBytes = OOC_DEFAULT_BLOCK;
+    opts->topK = 10;
+    opts->maxDepth = -1;
+}
+
+int wfd_run(const WFDOptions* opts, char** paths, int numPaths, WFDPairSink sink, void* ctx) {
+    char* alphabet = sharedAlphabet();
+    if (alphabet == NULL) {
+        return EXIT_FAILURE;
+    }
+    return runCorpus(opts, paths, numPaths, alphabet, sink, ctx);
+}
+
+int wfd_client(const char* socketPath, int argc, char** argv) {
+    return runClient(socketPath, argc, argv);
+}
@@ -0,0 +1,155 @@
+#ifndef LIBWFD_H
+#define LIBWFD_H
+
+#include <stddef.h>
+
+/**
+ * libwfd: word frequency distributions (WFDs) and the distances between them,
+ * the library compare is built on. Link libwfd.a with -lm -pthread -lz (and
+ * -lzstd for a ZSTD=1 build).
+ *
+ * WFDs are opaque and immutable once frozen, so any number of threads may
+ * score them at once.
+ *
+ * Global state: the metric, n-gram size, feature hashing and split threshold
+ * are process-wide settings shared by every user of the library in the
+ * process, and setting them is not synchronized. Set them from one thread
+ * before building WFDs, and keep them while those WFDs are compared. The
+ * alphabet that text is tokenized against is set up on first use and kept
+ * until the process exits.
+ *
+ * Errors: constructors return NULL, and settings and wfd_builder_feed -1.
+ * The reason an input cannot be read (open, read or decompression errors) is
+ * printed to stderr. The API calls' own allocations fail with NULL, but
+ * running out of memory inside the tokenizer, while freezing a WFD or while
+ * scoring pairs prints to stderr and ends the process with exit(1), as in
+ * compare.
+ **/
+#define LIBWFD_VERSION 1
+
+#define WFD_MAX_NGRAM 5
+#define WFD_MAX_HASH_BITS 20
+
+// The library is built with hidden visibility; these are its exported symbols
+#pragma GCC visibility push(default)
+
+typedef struct WFDNode WFD;
+typedef struct WFDBuilder WFDBuilder;
+
+enum {
+    WFD_METRIC_JSD,
+    WFD_METRIC_COSINE,
+    WFD_METRIC_JACCARD,
+    WFD_METRIC_HELLINGER
+};
+
+/**
+ * Settings. Each returns 0, or -1 for a value out of range.
+ **/
+int wfd_metric_by_name(const char* name);      // "jsd", "cosine", ...; -1 if unknown
+int wfd_set_metric(int metric);
+int wfd_set_ngram(int n);                       // 1 (words) to WFD_MAX_NGRAM
+int wfd_set_hash_bits(int bits);                // 0 (exact) to WFD_MAX_HASH_BITS
+void wfd_set_split_threshold(size_t bytes);     // files this large are tokenized in parallel
+
+/**
+ * Incremental construction: feed text in pieces of any size (a word may span
+ * pieces), then freeze it into a WFD. Freezing or freeing ends the builder;
+ * after a failed feed, only free it. The name is copied and reported with the
+ * WFD's pairs. Feeding nothing gives the WFD of an empty file.
+ **/
+WFDBuilder* wfd_builder_create(const char* name);
+int wfd_builder_feed(WFDBuilder* builder, const void* data, size_t size);
+WFD* wfd_builder_freeze(WFDBuilder* builder);
+void wfd_builder_free(WFDBuilder* builder);
+
+/**
+ * One-shot construction from plain text in memory, from a descriptor read to
+ * its end, or from a path. Descriptors and paths may be gzip (or zstd)
+ * compressed. Returns NULL if the input cannot be read.
+ **/
+WFD* wfd_from_buffer(const char* name, const void* data, size_t size);
+WFD* wfd_from_fd(const char* name, int fd);
+WFD* wfd_from_file(const char* path);
+
+const char* wfd_name(const WFD* wfd);
+int wfd_word_count(const WFD* wfd);
+unsigned wfd_num_terms(const WFD* wfd);
+void wfd_free(WFD* wfd);
+
+/**
+ * Distance between two WFDs under the current metric; 0 for identical ones.
+ **/
+double wfd_score(const WFD* a, const WFD* b);
+
+/**
+ * A scored pair. The indices are the files' positions in the compared set.
+ **/
+typedef struct WFDPair {
+    const char* fileA;
+    const char* fileB;
+    unsigned indexA;
+    unsigned indexB;
+    double score;
+} WFDPair;
+
+/**
+ * Receives pairs in output order (descending combined word count). Returning
+ * non-zero stops the listing.
+ **/
+typedef int (*WFDPairSink)(void* ctx, const WFDPair* pair);
+
+/**
+ * Scores every pair of n WFDs with the given number of threads and passes
+ * them to sink. Returns how many pairs the sink took.
+ **/
+size_t wfd_all_pairs(WFD** wfds, unsigned n, int threads, WFDPairSink sink, void* ctx);
+
+/**
+ * A full compare run over files and directories. Each field is the
+ * command-line option of compare named beside it; wfd_options_init sets
+ * compare's defaults.
+ **/
+typedef struct WFDOptions {
+    const char* suffix;         // -s: NULL for ".txt", "" for every file
+    int dirThreads;             // -d
+    int fileThreads;            // -f
+    int analysisThreads;        // -a
+    int autoThreads;            // --auto
+    int showStats;              // --stats
+    int useIndex;               // -i
+    int pipelined;              // -p
+    int hashContent;            // -H
+    const char* checkpoint;     // -c
+    int resume;                 // --resume
+    const char* storeOut;       // -w
+    const char* storeIn;        // -q
+    const char* storeAll;       // -o
+    size_t blockBytes;          // -M
+    unsigned topK;              // -k
+    double groupThreshold;      // -g; 0 lists pairs
+    const char* daemonSocket;   // -D
+    const char** include;       // --include: a file must match one of these globs
+    int numInclude;             // (when any are given, the default suffix is dropped)
+    const char** exclude;       // --exclude: files and directories to skip
+    int numExclude;
+    int maxDepth;               // --max-depth: -1 walks every level
+} WFDOptions;
+
+void wfd_options_init(WFDOptions* opts);
+
+/**
+ * Collects the WFDs of paths, then lists every pair to sink, or runs the
+ * group, store, query or daemon mode the options select (those print to
+ * stdout as compare does). Returns EXIT_SUCCESS or EXIT_FAILURE.
+ **/
+int wfd_run(const WFDOptions* opts, char** paths, int numPaths, WFDPairSink sink, void* ctx);
+
+/**
+ * Sends one request (e.g. "SIM", "5", path) to a daemon and prints the reply.
+ **/
+int wfd_client(const char* socketPath, int argc, char** argv);
+
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * Pair metrics over frozen WFDs. Every metric is split the same way as JSD:
+ * a per-term contribution summed over the terms both files share, and a
+ * finish step that turns that sum and per-file totals into the score. Each
+ * metric's pair walk is stamped out by DEFINE_METRIC (wfd.c) with its term
+ * function inlined, and the metric is chosen once per range of pairs or row,
+ * never per term.
+ * All metrics are reported as distances: 0 for identical distributions.
+ **/
+enum {
+    METRIC_JSD,
+    METRIC_COSINE,
+    METRIC_JACCARD,
+    METRIC_HELLINGER
+};
+
+int pairMetric = METRIC_JSD;
+
+/**
+ * Cosine: the shared terms give the dot product.
+ **/
+static inline double sharedTermCosine(double freqA, double freqB) {
+    return freqA * freqB;
+}
+
+double finishCosine(WFDNode* file1, WFDNode* file2, double shared) {
+    if (file1->sumSquares == 0 || file2->sumSquares == 0) {
+        return file1->sumSquares == file2->sumSquares ? 0 : 1;
+    }
+    double distance = 1 - shared / sqrt(file1->sumSquares * file2->sumSquares);
+    return distance < 0 ? 0 : distance;
+}
+
+/**
+ * Weighted Jaccard: sum of minima over sum of maxima. A term in one file only
+ * adds its frequency to the maxima, so the union is totA + totB - shared.
+ **/
+static inline double sharedTermJaccard(double freqA, double freqB) {
+    return freqA < freqB ? freqA : freqB;
+}
+
+double finishJaccard(WFDNode* file1, WFDNode* file2, double shared) {
+    double total = file1->totalFreq + file2->totalFreq - shared;
+    if (total <= 0) {
+        return 0;
+    }
+    return 1 - shared / total;
+}
+
+/**
+ * Hellinger: H^2 = (totA + totB) / 2 - sum of sqrt(pA * pB) over shared terms.
+ **/
+static inline double sharedTermHellinger(double freqA, double freqB) {
+    return sqrt(freqA * freqB);
+}
+
+double finishHellinger(WFDNode* file1, WFDNode* file2, double shared) {
+    double h = 0.5 * (file1->totalFreq + file2->totalFreq) - shared;
+    if (h <= 0) {
+        return 0;
+    }
+    return sqrt(h);
+}
+
+DEFINE_METRIC(cosine, sharedTermCosine, finishCosine)
+DEFINE_METRIC(jaccard, sharedTermJaccard, finishJaccard)
+DEFINE_METRIC(hellinger, sharedTermHellinger, finishHellinger)
+
+/**
+ * Metric selected by name (-m); returns -1 for an unknown name.
+ **/
+int parseMetric(const char* name) {
+    if (strcmp(name, "jsd") == 0) {
+        return METRIC_JSD;
+    } else if (strcmp(name, "cosine") == 0) {
+        return METRIC_COSINE;
+    } else if (strcmp(name, "jaccard") == 0) {
+        return METRIC_JACCARD;
+    } else if (strcmp(name, "hellinger") == 0) {
+        return METRIC_HELLINGER;
+    }
+    return -1;
+}
+
+/**
+ * Score of one pair under the selected metric.
+ **/
+double metricPair(WFDNode* file1, WFDNode* file2) {
+    if (hashBits > 0) {
+        switch (pairMetric) {
+            case METRIC_COSINE: return cosineDensePair(file1, file2);
+            case METRIC_JACCARD: return jaccardDensePair(file1, file2);
+            case METRIC_HELLINGER: return hellingerDensePair(file1, file2);
+            default: return jsdDensePair(file1, file2);
+        }
+    }
+    switch (pairMetric) {
+        case METRIC_COSINE: return cosinePair(file1, file2);
+        case METRIC_JACCARD: return jaccardPair(file1, file2);
+        case METRIC_HELLINGER: return hellingerPair(file1, file2);
+        default: return jsdPair(file1, file2);
+    }
+}
+
+/**
+ * Turns a shared-term sum of the selected metric into the pair's score.
+ **/
+double metricFinish(WFDNode* file1, WFDNode* file2, double shared) {
+    switch (pairMetric) {
+        case METRIC_COSINE: return finishCosine(file1, file2, shared);
+        case METRIC_JACCARD: return finishJaccard(file1, file2, shared);
+        case METRIC_HELLINGER: return finishHellinger(file1, file2, shared);
+        default: return finishJSD(file1, file2, shared);
+    }
+}
+
+/**
+ * Loop over pairs [start, end) of a result array with one metric's kernel.
+ **/
+#define METRIC_RANGE(PAIR) \
+    for (k = start; k < end; ++k) { \
+        results->score[k] = PAIR(results->files[results->fileA[k]], results->files[results->fileB[k]]); \
+    }
+
+/**
+ * Driver: computes pairs [start, end) of a result array.
+ **/
+void computePairRange(PairResults* results, size_t start, size_t end) {
+    size_t k;
+    if (hashBits > 0) {
+        switch (pairMetric) {
+            case METRIC_COSINE: METRIC_RANGE(cosineDensePair) break;
+            case METRIC_JACCARD: METRIC_RANGE(jaccardDensePair) break;
+            case METRIC_HELLINGER: METRIC_RANGE(hellingerDensePair) break;
+            default: METRIC_RANGE(jsdDensePair) break;
+        }
+        return;
+    }
+    switch (pairMetric) {
+        case METRIC_COSINE: METRIC_RANGE(cosinePair) break;
+        case METRIC_JACCARD: METRIC_RANGE(jaccardPair) break;
+        case METRIC_HELLINGER: METRIC_RANGE(hellingerPair) break;
+        default: METRIC_RANGE(jsdPair) break;
+    }
+}
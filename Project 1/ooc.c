@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/**
+ * Out-of-core analysis of a mapped WFD store. The store's files are split into
+ * blocks of consecutive records of at most blockBytes each, and the pairs are
+ * computed one block x block tile at a time. Within a row of tiles the row
+ * block stays resident while the column blocks stream past; rows alternate
+ * direction, so the last column block of a row is still resident at the start
+ * of the next. The kernel is told to read ahead the blocks of the next tile
+ * and to drop the blocks the next tile does not use.
+ *
+ * The pairs are not kept in memory either. Each thread collects the pairs it
+ * computes into a run, sorts a full run into output order and appends it to
+ * an unlinked temporary file (in $TMPDIR, or /tmp). The output is a k-way
+ * merge of the runs; when there are more runs than oocFanIn, groups of them
+ * are first merged into longer runs in a second temporary file.
+ **/
+#define OOC_DEFAULT_BLOCK (256u << 20)
+#define OOC_RUN_PAIRS (1u << 18)
+#define OOC_MERGE_FANIN 256
+#define OOC_MERGE_BUFFER 512
+
+size_t oocRunPairs = OOC_RUN_PAIRS;     // pairs per thread before a run is spilled
+unsigned oocFanIn = OOC_MERGE_FANIN;    // runs merged at once
+
+/**
+ * A computed pair as it is spilled.
+ **/
+typedef struct OOCPair {
+    unsigned combinedWC;
+    unsigned fileA;
+    unsigned fileB;
+    double score;
+} OOCPair;
+
+typedef struct OOCRun {
+    off_t offset;
+    size_t count;
+} OOCRun;
+
+/**
+ * Sorted runs of pairs in a temporary file.
+ **/
+typedef struct OOCSpill {
+    int fd;
+    off_t end;
+    OOCRun* runs;
+    unsigned numRuns;
+    unsigned capacity;
+    pthread_mutex_t lock;
+} OOCSpill;
+
+typedef struct OOCTile {
+    unsigned rowBlock;
+    unsigned colBlock;
+    unsigned nextRow;       // claim cursor over the row block's files (atomic)
+} OOCTile;
+
+typedef struct OOCPlan {
+    WFDStore* store;
+    OOCSpill* spill;        // NULL when the pairs feed pairClusters
+    unsigned numBlocks;
+    unsigned* blockStart;   // first file of each block; blockStart[numBlocks] = numFiles
+    OOCTile* tiles;
+    unsigned numTiles;
+    pthread_barrier_t barrier;
+} OOCPlan;
+
+/**
+ * Split the store into blocks of consecutive records of at most blockBytes
+ * (a record larger than that gets a block of its own).
+ **/
+void ooc_blocks(OOCPlan* plan, size_t blockBytes) {
+    WFDStore* store = plan->store;
+    plan->blockStart = malloc(sizeof(unsigned) * (store->numFiles + 1));
+    if (plan->blockStart == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned m = 0;
+    unsigned i = 0;
+    while (i < store->numFiles) {
+        plan->blockStart[m++] = i;
+        uint64_t start = storeRecordOffset(store, i);
+        ++i;
+        while (i < store->numFiles && storeRecordOffset(store, i + 1) - start <= blockBytes) {
+            ++i;
+        }
+    }
+    plan->blockStart[m] = store->numFiles;
+    plan->numBlocks = m;
+}
+
+/**
+ * Orders the tiles (I, J), I <= J, row by row with alternating direction.
+ **/
+void ooc_schedule(OOCPlan* plan) {
+    unsigned m = plan->numBlocks;
+    plan->numTiles = m * (m + 1) / 2;
+    plan->tiles = malloc(sizeof(OOCTile) * (plan->numTiles > 0 ? plan->numTiles : 1));
+    if (plan->tiles == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned t = 0;
+    unsigned I, k;
+    for (I = 0; I < m; ++I) {
+        for (k = 0; k < m - I; ++k) {
+            plan->tiles[t].rowBlock = I;
+            plan->tiles[t].colBlock = (I % 2 == 0) ? I + k : m - 1 - k;
+            plan->tiles[t].nextRow = plan->blockStart[I];
+            ++t;
+        }
+    }
+}
+
+/**
+ * Issues an madvise hint over the records of a block.
+ **/
+void ooc_advise(OOCPlan* plan, unsigned block, int advice) {
+    WFDStore* store = plan->store;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = storeRecordOffset(store, plan->blockStart[block]) & ~(page - 1);
+    size_t end = storeRecordOffset(store, plan->blockStart[block + 1]);
+    madvise((char*) store->map + start, end - start, advice);
+}
+
+/**
+ * Whether a tile reads a block.
+ **/
+int ooc_uses(OOCTile* tile, unsigned block) {
+    return tile->rowBlock == block || tile->colBlock == block;
+}
+
+/**
+ * Opens an unlinked temporary file for spilled runs. Returns -1 on error.
+ **/
+int ooc_tempfile(void) {
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/wfd-spill-XXXXXX", dir != NULL && dir[0] != '\0' ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+int ooc_spill_init(OOCSpill* spill) {
+    spill->fd = ooc_tempfile();
+    if (spill->fd == -1) {
+        return -1;
+    }
+    spill->end = 0;
+    spill->runs = NULL;
+    spill->numRuns = 0;
+    spill->capacity = 0;
+    pthread_mutex_init(&spill->lock, NULL);
+    return 0;
+}
+
+void ooc_spill_free(OOCSpill* spill) {
+    close(spill->fd);
+    free(spill->runs);
+    pthread_mutex_destroy(&spill->lock);
+}
+
+void ooc_write(int fd, off_t offset, const void* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t done = pwrite(fd, data, bytes, offset);
+        if (done <= 0) {
+            perror("Spill write failed\n");
+            exit(1);
+        }
+        data = (const char*) data + done;
+        offset += done;
+        bytes -= done;
+    }
+}
+
+void ooc_read(int fd, off_t offset, void* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t done = pread(fd, data, bytes, offset);
+        if (done <= 0) {
+            perror("Spill read failed\n");
+            exit(1);
+        }
+        data = (char*) data + done;
+        offset += done;
+        bytes -= done;
+    }
+}
+
+/**
+ * Output order, as comparePairOrder: descending combined word count; among
+ * equal counts the later pair (larger a, then larger b) comes first.
+ **/
+int compareSpilledPairs(const void* x, const void* y) {
+    const OOCPair* p = x;
+    const OOCPair* q = y;
+    if (p->combinedWC != q->combinedWC) {
+        return p->combinedWC < q->combinedWC ? 1 : -1;
+    }
+    if (p->fileA != q->fileA) {
+        return p->fileA < q->fileA ? 1 : -1;
+    }
+    return (p->fileB < q->fileB) - (p->fileB > q->fileB);
+}
+
+/**
+ * Sorts a run and appends it to the spill.
+ **/
+void ooc_flush(OOCSpill* spill, OOCPair* run, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    qsort(run, count, sizeof(OOCPair), compareSpilledPairs);
+    size_t bytes = sizeof(OOCPair) * count;
+    pthread_mutex_lock(&spill->lock);
+    if (spill->numRuns == spill->capacity) {
+        unsigned capacity = spill->capacity ? spill->capacity * 2 : 64;
+        OOCRun* runs = realloc(spill->runs, sizeof(OOCRun) * capacity);
+        if (runs == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        spill->runs = runs;
+        spill->capacity = capacity;
+    }
+    off_t offset = spill->end;
+    spill->runs[spill->numRuns].offset = offset;
+    spill->runs[spill->numRuns].count = count;
+    ++spill->numRuns;
+    spill->end += bytes;
+    pthread_mutex_unlock(&spill->lock);
+    ooc_write(spill->fd, offset, run, bytes);
+}
+
+/**
+ * Read position in a run during a merge.
+ **/
+typedef struct OOCCursor {
+    OOCPair* buf;
+    size_t have;    // pairs in buf
+    size_t pos;     // current pair in buf
+    off_t next;     // offset of the first pair not yet read
+    size_t left;    // pairs of the run not yet read
+} OOCCursor;
+
+/**
+ * Reads the next pairs of a run into its buffer. Returns 0 at the end of the run.
+ **/
+int ooc_fill(int fd, OOCCursor* cursor) {
+    if (cursor->left == 0) {
+        return 0;
+    }
+    size_t take = cursor->left < OOC_MERGE_BUFFER ? cursor->left : OOC_MERGE_BUFFER;
+    ooc_read(fd, cursor->next, cursor->buf, sizeof(OOCPair) * take);
+    cursor->next += sizeof(OOCPair) * take;
+    cursor->left -= take;
+    cursor->have = take;
+    cursor->pos = 0;
+    return 1;
+}
+
+int ooc_before(OOCCursor* x, OOCCursor* y) {
+    return compareSpilledPairs(&x->buf[x->pos], &y->buf[y->pos]) < 0;
+}
+
+void ooc_sift(OOCCursor** heap, unsigned size, unsigned i) {
+    for (;;) {
+        unsigned first = i;
+        unsigned child = 2 * i + 1;
+        if (child < size && ooc_before(heap[child], heap[first])) {
+            first = child;
+        }
+        if (child + 1 < size && ooc_before(heap[child + 1], heap[first])) {
+            first = child + 1;
+        }
+        if (first == i) {
+            return;
+        }
+        OOCCursor* swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+/**
+ * Merges runs of a file into one stream in output order, passing each pair
+ * to emit until it returns non-zero. Returns how many pairs emit took.
+ **/
+size_t ooc_merge(int fd, OOCRun* runs, unsigned numRuns, int (*emit)(void* ctx, const OOCPair* pair), void* ctx) {
+    if (numRuns == 0) {
+        return 0;
+    }
+    OOCCursor* cursors = malloc(sizeof(OOCCursor) * numRuns);
+    OOCCursor** heap = malloc(sizeof(OOCCursor*) * numRuns);
+    OOCPair* buffers = malloc(sizeof(OOCPair) * OOC_MERGE_BUFFER * numRuns);
+    if (cursors == NULL || heap == NULL || buffers == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned size = 0;
+    unsigned r;
+    for (r = 0; r < numRuns; ++r) {
+        cursors[r].buf = buffers + (size_t) OOC_MERGE_BUFFER * r;
+        cursors[r].next = runs[r].offset;
+        cursors[r].left = runs[r].count;
+        if (ooc_fill(fd, &cursors[r])) {
+            heap[size++] = &cursors[r];
+        }
+    }
+    for (r = size / 2; r-- > 0;) {
+        ooc_sift(heap, size, r);
+    }
+
+    size_t emitted = 0;
+    while (size > 0) {
+        OOCCursor* top = heap[0];
+        ++emitted;
+        if (emit(ctx, &top->buf[top->pos]) != 0) {
+            break;
+        }
+        if (++top->pos == top->have && !ooc_fill(fd, top)) {
+            heap[0] = heap[--size];
+        }
+        ooc_sift(heap, size, 0);
+    }
+    free(buffers);
+    free(heap);
+    free(cursors);
+    return emitted;
+}
+
+/**
+ * Buffered sequential writer of a merged run.
+ **/
+typedef struct OOCWriter {
+    int fd;
+    off_t offset;
+    OOCPair buf[OOC_MERGE_BUFFER];
+    size_t count;
+} OOCWriter;
+
+void ooc_drain(OOCWriter* writer) {
+    ooc_write(writer->fd, writer->offset, writer->buf, sizeof(OOCPair) * writer->count);
+    writer->offset += sizeof(OOCPair) * writer->count;
+    writer->count = 0;
+}
+
+int ooc_append(void* ctx, const OOCPair* pair) {
+    OOCWriter* writer = ctx;
+    writer->buf[writer->count++] = *pair;
+    if (writer->count == OOC_MERGE_BUFFER) {
+        ooc_drain(writer);
+    }
+    return 0;
+}
+
+/**
+ * Merges groups of oocFanIn runs into single runs until at most oocFanIn are
+ * left, moving the runs between the spill's file and a second one.
+ **/
+void ooc_reduce(OOCSpill* spill) {
+    if (spill->numRuns <= oocFanIn) {
+        return;
+    }
+    OOCWriter* writer = malloc(sizeof(OOCWriter));
+    if (writer == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    writer->fd = ooc_tempfile();
+    if (writer->fd == -1) {
+        exit(1);
+    }
+    while (spill->numRuns > oocFanIn) {
+        writer->offset = 0;
+        writer->count = 0;
+        unsigned numMerged = 0;
+        unsigned r;
+        for (r = 0; r < spill->numRuns; r += oocFanIn) {
+            unsigned group = spill->numRuns - r < oocFanIn ? spill->numRuns - r : oocFanIn;
+            off_t offset = writer->offset;
+            size_t count = ooc_merge(spill->fd, spill->runs + r, group, ooc_append, writer);
+            ooc_drain(writer);
+            // The runs of this group have been read, so slot numMerged <= r is free
+            spill->runs[numMerged].offset = offset;
+            spill->runs[numMerged].count = count;
+            ++numMerged;
+        }
+        spill->numRuns = numMerged;
+        int done = spill->fd;
+        spill->fd = writer->fd;
+        spill->end = writer->offset;
+        writer->fd = done;
+        if (ftruncate(done, 0) != 0) {
+            perror("Spill truncate failed\n");
+        }
+    }
+    close(writer->fd);
+    free(writer);
+}
+
+typedef struct OOCEmitter {
+    WFDNode** files;
+    WFDPairSink sink;
+    void* ctx;
+} OOCEmitter;
+
+int ooc_emit(void* ctx, const OOCPair* spilled) {
+    OOCEmitter* emitter = ctx;
+    WFDPair pair;
+    pair.fileA = emitter->files[spilled->fileA]->filename;
+    pair.fileB = emitter->files[spilled->fileB]->filename;
+    pair.indexA = spilled->fileA;
+    pair.indexB = spilled->fileB;
+    pair.score = spilled->score;
+    return emitter->sink(emitter->ctx, &pair);
+}
+
+/**
+ * Pass the spilled pairs to a sink in output order, until it returns non-zero.
+ * Returns how many pairs it took.
+ **/
+size_t emitSpill(OOCSpill* spill, WFDNode** files, WFDPairSink sink, void* ctx) {
+    ooc_reduce(spill);
+    OOCEmitter emitter;
+    emitter.files = files;
+    emitter.sink = sink;
+    emitter.ctx = ctx;
+    return ooc_merge(spill->fd, spill->runs, spill->numRuns, ooc_emit, &emitter);
+}
+
+/**
+ * Analysis worker: every thread walks the tiles in order, claiming rows of
+ * the current tile. Between tiles the threads meet at a barrier, and one of
+ * them drops the blocks that are done and prefetches the ones coming up.
+ * Computed pairs go to the thread's run, or to its batch of cluster edges.
+ **/
+void* computeTileJSD(void* argPtr) {
+    OOCPlan* plan = argPtr;
+    WFDNode** files = plan->store->files;
+    ClusterEdge batch[CLUSTER_BATCH];
+    unsigned numEdges = 0;
+    OOCPair* run = NULL;
+    size_t count = 0;
+    if (plan->spill != NULL) {
+        run = malloc(sizeof(OOCPair) * oocRunPairs);
+        if (run == NULL) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+    }
+    unsigned t;
+    for (t = 0; t < plan->numTiles; ++t) {
+        OOCTile* tile = &plan->tiles[t];
+        unsigned rowEnd = plan->blockStart[tile->rowBlock + 1];
+        unsigned colStart = plan->blockStart[tile->colBlock];
+        unsigned colEnd = plan->blockStart[tile->colBlock + 1];
+        unsigned a;
+        while ((a = __atomic_fetch_add(&tile->nextRow, 1, __ATOMIC_RELAXED)) < rowEnd) {
+            unsigned b = colStart > a + 1 ? colStart : a + 1;
+            for (; b < colEnd; ++b) {
+                double score = metricPair(files[a], files[b]);
+                if (run == NULL) {
+                    cluster_pair(pairClusters, batch, &numEdges, files[a], files[b], score);
+                    continue;
+                }
+                run[count].combinedWC = files[a]->wordCount + files[b]->wordCount;
+                run[count].fileA = a;
+                run[count].fileB = b;
+                run[count].score = score;
+                if (++count == oocRunPairs) {
+                    ooc_flush(plan->spill, run, count);
+                    count = 0;
+                }
+            }
+        }
+
+        if (pthread_barrier_wait(&plan->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            OOCTile* next = (t + 1 < plan->numTiles) ? &plan->tiles[t + 1] : NULL;
+            if (next == NULL || !ooc_uses(next, tile->rowBlock)) {
+                ooc_advise(plan, tile->rowBlock, MADV_DONTNEED);
+            }
+            if (tile->colBlock != tile->rowBlock && (next == NULL || !ooc_uses(next, tile->colBlock))) {
+                ooc_advise(plan, tile->colBlock, MADV_DONTNEED);
+            }
+            if (t + 2 < plan->numTiles) {
+                ooc_advise(plan, plan->tiles[t + 2].rowBlock, MADV_WILLNEED);
+                ooc_advise(plan, plan->tiles[t + 2].colBlock, MADV_WILLNEED);
+            }
+        }
+    }
+    if (run != NULL) {
+        ooc_flush(plan->spill, run, count);
+        free(run);
+    } else {
+        cluster_flush(pairClusters, batch, numEdges);
+    }
+    return NULL;
+}
+
+/**
+ * All-pairs JSD of a stored corpus, tile by tile, into sorted runs of a spill,
+ * or into pairClusters when spill is NULL.
+ **/
+void analyzeStore(WFDStore* store, OOCSpill* spill, size_t blockBytes, int athreads) {
+    OOCPlan plan;
+    plan.store = store;
+    plan.spill = spill;
+    ooc_blocks(&plan, blockBytes);
+    ooc_schedule(&plan);
+
+    unsigned t;
+    for (t = 0; t < 2 && t < plan.numTiles; ++t) {
+        ooc_advise(&plan, plan.tiles[t].rowBlock, MADV_WILLNEED);
+        ooc_advise(&plan, plan.tiles[t].colBlock, MADV_WILLNEED);
+    }
+
+    pthread_t* tids = malloc(sizeof(pthread_t) * athreads);
+    if (tids == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    pthread_barrier_init(&plan.barrier, NULL, athreads);
+    int p;
+    for (p = 0; p < athreads; ++p) {
+        pthread_create(&tids[p], NULL, computeTileJSD, &plan);
+    }
+    for (p = 0; p < athreads; ++p) {
+        pthread_join(tids[p], NULL);
+    }
+    pthread_barrier_destroy(&plan.barrier);
+    free(tids);
+    free(plan.tiles);
+    free(plan.blockStart);
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
+
+/**
+ * Pipelined analysis: pairs are compared while WFDs are still being built.
+ * When the WFD of registry index j is published, the pairs (i, j) for every
+ * i < j are queued in blocks of PIPELINE_BLOCK. Each pair is handled by the
+ * task of its later file, so every pair is computed exactly once. Results are
+ * kept by registry indices at j*(j-1)/2 + i, in segments that double in size.
+ **/
+#define PIPELINE_BLOCK 1024
+#define PIPELINE_BASE 4096
+#define PIPELINE_SEGMENTS 40
+
+typedef struct PairTask {
+    unsigned file;
+    unsigned start;
+    unsigned end;
+} PairTask;
+
+typedef struct Pipeline {
+    WFDRegistry* registry;
+    PairTask* tasks;
+    unsigned head;
+    unsigned size;
+    unsigned capacity;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    double* segments[PIPELINE_SEGMENTS];
+    pthread_mutex_t segmentLock;
+} Pipeline;
+
+/**
+ * Initializes an empty pipeline over a registry.
+ **/
+void pipeline_init(Pipeline* P, WFDRegistry* registry) {
+    P->registry = registry;
+    P->tasks = NULL;
+    P->head = 0;
+    P->size = 0;
+    P->capacity = 0;
+    P->closed = 0;
+    pthread_mutex_init(&P->lock, NULL);
+    pthread_cond_init(&P->ready, NULL);
+    pthread_mutex_init(&P->segmentLock, NULL);
+    int s;
+    for (s = 0; s < PIPELINE_SEGMENTS; ++s) {
+        P->segments[s] = NULL;
+    }
+}
+
+/**
+ * Slot of pair (i, j), i < j, in the result segments (allocated on first use).
+ * Unwritten slots hold NAN.
+ **/
+double* pipeline_slot(Pipeline* P, unsigned i, unsigned j) {
+    unsigned long long index = (unsigned long long) j * (j - 1) / 2 + i;
+    unsigned long long scaled = index / PIPELINE_BASE + 1;
+    unsigned s = 63 - __builtin_clzll(scaled);
+    unsigned long long offset = index - (unsigned long long) PIPELINE_BASE * ((1ull << s) - 1);
+    double* seg = __atomic_load_n(&P->segments[s], __ATOMIC_ACQUIRE);
+    if (seg == NULL) {
+        pthread_mutex_lock(&P->segmentLock);
+        seg = P->segments[s];
+        if (seg == NULL) {
+            size_t n = (size_t) PIPELINE_BASE << s;
+            seg = malloc(sizeof(double) * n);
+            if (seg == NULL) {
+                perror("Malloc failed\n");
+                exit(1);
+            }
+            size_t k;
+            for (k = 0; k < n; ++k) {
+                seg[k] = NAN;
+            }
+            __atomic_store_n(&P->segments[s], seg, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&P->segmentLock);
+    }
+    return &seg[offset];
+}
+
+/**
+ * Queues the pairs of a newly published WFD against every earlier index.
+ **/
+void pipeline_publish(Pipeline* P, unsigned file) {
+    pthread_mutex_lock(&P->lock);
+    unsigned start;
+    for (start = 0; start < file; start += PIPELINE_BLOCK) {
+        if (P->size == P->capacity) {
+            unsigned capacity = P->capacity ? P->capacity * 2 : 64;
+            PairTask* tasks = malloc(sizeof(PairTask) * capacity);
+            if (tasks == NULL) {
+                perror("Malloc failed\n");
+                exit(1);
+            }
+            unsigned k;
+            for (k = 0; k < P->size; ++k) {
+                tasks[k] = P->tasks[(P->head + k) % P->capacity];
+            }
+            free(P->tasks);
+            P->tasks = tasks;
+            P->head = 0;
+            P->capacity = capacity;
+        }
+        PairTask* task = &P->tasks[(P->head + P->size) % P->capacity];
+        task->file = file;
+        task->start = start;
+        task->end = (start + PIPELINE_BLOCK < file) ? start + PIPELINE_BLOCK : file;
+        P->size++;
+    }
+    pthread_cond_broadcast(&P->ready);
+    pthread_mutex_unlock(&P->lock);
+}
+
+/**
+ * No more WFDs will be published; workers exit once the queue drains.
+ **/
+void pipeline_close(Pipeline* P) {
+    pthread_mutex_lock(&P->lock);
+    P->closed = 1;
+    pthread_cond_broadcast(&P->ready);
+    pthread_mutex_unlock(&P->lock);
+}
+
+/**
+ * An earlier WFD; its index is reserved before it is published, so wait out
+ * the few instructions in between.
+ **/
+WFDNode* pipeline_file(Pipeline* P, unsigned index) {
+    WFDNode* wfd;
+    while ((wfd = registry_get(P->registry, index)) == NULL) {
+        sched_yield();
+    }
+    return wfd;
+}
+
+/**
+ * Analysis worker: computes queued blocks of pairs until the pipeline closes.
+ * Duplicates are skipped here and filled in from their canonical pairs.
+ **/
+void* computePipelineJSD(void* argPtr) {
+    Pipeline* P = argPtr;
+    while (1) {
+        pthread_mutex_lock(&P->lock);
+        while (P->size == 0 && !P->closed) {
+            pthread_cond_wait(&P->ready, &P->lock);
+        }
+        if (P->size == 0) {
+            pthread_mutex_unlock(&P->lock);
+            return NULL;
+        }
+        PairTask task = P->tasks[P->head];
+        P->head = (P->head + 1) % P->capacity;
+        P->size--;
+        pthread_mutex_unlock(&P->lock);
+
+        gate_enter(autoGate(POOL_ANALYSIS));
+        WFDNode* fileB = pipeline_file(P, task.file);
+        unsigned i;
+        for (i = task.start; i < task.end; ++i) {
+            WFDNode* fileA = pipeline_file(P, i);
+            if (fileA->dedup != NULL) {
+                continue;
+            }
+            *pipeline_slot(P, i, task.file) = metricPair(fileA, fileB);
+        }
+        gate_leave(autoGate(POOL_ANALYSIS));
+    }
+}
+
+/**
+ * Fills the row-major pair results from the pipelined ones once every
+ * WFD is done and duplicates are resolved.
+ **/
+void pipeline_collect(Pipeline* P, PairResults* results) {
+    size_t k;
+    for (k = 0; k < results->numPairs; ++k) {
+        WFDNode* ca = results->files[results->fileA[k]];
+        WFDNode* cb = results->files[results->fileB[k]];
+        ca = ca->canon ? ca->canon : ca;
+        cb = cb->canon ? cb->canon : cb;
+        if (ca == cb) {
+            results->score[k] = 0;
+            continue;
+        }
+        unsigned lo = ca->index < cb->index ? ca->index : cb->index;
+        unsigned hi = ca->index < cb->index ? cb->index : ca->index;
+        results->score[k] = *pipeline_slot(P, lo, hi);
+    }
+    if (pairClusters != NULL) {
+        cluster_range(pairClusters, results, 0, results->numPairs);
+    }
+}
+
+/**
+ * Blocks of pairs waiting for an analysis thread (--auto).
+ **/
+int pipeline_depth(void* arg) {
+    Pipeline* P = arg;
+    pthread_mutex_lock(&P->lock);
+    int depth = P->size;
+    pthread_mutex_unlock(&P->lock);
+    return depth;
+}
+
+/**
+ * Frees the task queue and result segments.
+ **/
+void pipeline_destroy(Pipeline* P) {
+    int s;
+    for (s = 0; s < PIPELINE_SEGMENTS; ++s) {
+        free(P->segments[s]);
+    }
+    free(P->tasks);
+    pthread_mutex_destroy(&P->lock);
+    pthread_cond_destroy(&P->ready);
+    pthread_mutex_destroy(&P->segmentLock);
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct QueryMatch {
+    unsigned file;
+    double score;
+} QueryMatch;
+
+typedef struct QueryJob {
+    TermIndex* index;          // over the corpus, or NULL to use the store's
+    WFDStore* store;
+    WFDNode** files;           // the corpus
+    unsigned numFiles;
+    WFDNode** queries;
+    unsigned numQueries;
+    unsigned topK;
+    const unsigned* byTotal;   // corpus files ordered by totalFreq, ascending
+    QueryMatch** results;      // results[q]: up to topK matches, best first
+    unsigned* numResults;
+    unsigned nextQuery;
+    pthread_mutex_t lock;
+} QueryJob;
+
+/**
+ * Score of a query against a corpus file under the selected metric, given
+ * their shared-term sum.
+ **/
+double queryScore(WFDNode* query, WFDNode* file, double shared) {
+    if (query->wordCount + file->wordCount == 0) {
+        return 0;
+    }
+    return metricFinish(query, file, shared);
+}
+
+/**
+ * Order matches by score, then by corpus position.
+ **/
+int compareMatches(const void* a, const void* b) {
+    const QueryMatch* x = a;
+    const QueryMatch* y = b;
+    if (x->score < y->score) { return -1; }
+    if (x->score > y->score) { return 1; }
+    return (x->file > y->file) - (x->file < y->file);
+}
+
+/**
+ * Posting list of a term in the job's index, or in the store's when the job
+ * has none.
+ **/
+unsigned queryPosting(QueryJob* job, const char* term, const unsigned** files, const double** freqs) {
+    if (job->index == NULL) {
+        return storePosting(job->store, term, files, freqs);
+    }
+    PostingList* list = lookupPosting(job->index, term, 0);
+    if (list == NULL) {
+        return 0;
+    }
+    *files = list->files;
+    *freqs = list->freqs;
+    return list->size;
+}
+
+/**
+ * Defines name##AccumulateQuery: accumulates the shared-term sums of a metric
+ * between a query and every corpus file in its posting lists, and lists those
+ * files in touched. Returns how many there are.
+ **/
+#define DEFINE_QUERY_ACCUMULATE(name, SHARED) \
+unsigned name##AccumulateQuery(QueryJob* job, WFDNode* query, double* acc, char* seen, unsigned* touched) { \
+    unsigned numTouched = 0; \
+    unsigned t, k; \
+    for (t = 0; t < query->numTerms; ++t) { \
+        const unsigned* files; \
+        const double* freqs; \
+        unsigned size = queryPosting(job, query->termPool + query->termOffsets[t], &files, &freqs); \
+        double freq = query->freqs[t]; \
+        for (k = 0; k < size; ++k) { \
+            unsigned f = files[k]; \
+            if (f >= job->numFiles) { \
+                continue; \
+            } \
+            if (!seen[f]) { \
+                seen[f] = 1; \
+                acc[f] = 0; \
+                touched[numTouched++] = f; \
+            } \
+            acc[f] += SHARED(freq, freqs[k]); \
+        } \
+    } \
+    return numTouched; \
+}
+
+DEFINE_QUERY_ACCUMULATE(jsd, sharedTermJSD)
+DEFINE_QUERY_ACCUMULATE(cosine, sharedTermCosine)
+DEFINE_QUERY_ACCUMULATE(jaccard, sharedTermJaccard)
+DEFINE_QUERY_ACCUMULATE(hellinger, sharedTermHellinger)
+
+/**
+ * Run one query against the corpus index, or against the index kept in the
+ * store when the job has none.
+ * acc and seen are per-thread scratch arrays of corpus size (seen all zero on entry).
+ **/
+void runQuery(QueryJob* job, unsigned q, double* acc, char* seen, unsigned* touched, QueryMatch* cand) {
+    WFDNode* query = job->queries[q];
+    unsigned numTouched;
+    unsigned k;
+    switch (pairMetric) {
+        case METRIC_COSINE: numTouched = cosineAccumulateQuery(job, query, acc, seen, touched); break;
+        case METRIC_JACCARD: numTouched = jaccardAccumulateQuery(job, query, acc, seen, touched); break;
+        case METRIC_HELLINGER: numTouched = hellingerAccumulateQuery(job, query, acc, seen, touched); break;
+        default: numTouched = jsdAccumulateQuery(job, query, acc, seen, touched); break;
+    }
+
+    unsigned numCand = 0;
+    for (k = 0; k < numTouched; ++k) {
+        unsigned f = touched[k];
+        cand[numCand].file = f;
+        cand[numCand].score = queryScore(query, job->files[f], acc[f]);
+        ++numCand;
+    }
+    // Untouched files score from their totals alone. JSD and Hellinger grow
+    // with the file's total, so the best of them have the smallest totals;
+    // cosine and Jaccard give them all the same distance, so the best are the
+    // first in the corpus. A query with no words touches nothing, and its
+    // untouched files are all scored.
+    int byTotal = pairMetric == METRIC_JSD || pairMetric == METRIC_HELLINGER;
+    unsigned limit = query->numTerms > 0 ? job->topK : job->numFiles;
+    unsigned extra = 0;
+    for (k = 0; k < job->numFiles && extra < limit; ++k) {
+        unsigned f = byTotal ? job->byTotal[k] : k;
+        if (f < job->numFiles && !seen[f]) {
+            seen[f] = 1;
+            touched[numTouched++] = f;
+            cand[numCand].file = f;
+            cand[numCand].score = queryScore(query, job->files[f], 0);
+            ++numCand;
+            ++extra;
+        }
+    }
+    for (k = 0; k < numTouched; ++k) {
+        seen[touched[k]] = 0;
+    }
+
+    qsort(cand, numCand, sizeof(QueryMatch), compareMatches);
+    if (numCand > job->topK) {
+        numCand = job->topK;
+    }
+    job->results[q] = malloc(sizeof(QueryMatch) * (numCand > 0 ? numCand : 1));
+    if (job->results[q] == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    memcpy(job->results[q], cand, sizeof(QueryMatch) * numCand);
+    job->numResults[q] = numCand;
+}
+
+/**
+ * Query worker: claims query files until none are left.
+ **/
+void* computeQueries(void* argPtr) {
+    QueryJob* job = argPtr;
+    unsigned n = job->numFiles;
+    double* acc = malloc(sizeof(double) * (n > 0 ? n : 1));
+    char* seen = calloc(n > 0 ? n : 1, 1);
+    unsigned* touched = malloc(sizeof(unsigned) * (n > 0 ? n : 1));
+    QueryMatch* cand = malloc(sizeof(QueryMatch) * (n + 1));
+    if (!acc || !seen || !touched || !cand) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        unsigned q = job->nextQuery++;
+        pthread_mutex_unlock(&job->lock);
+        if (q >= job->numQueries) {
+            break;
+        }
+        runQuery(job, q, acc, seen, touched, cand);
+    }
+    free(acc);
+    free(seen);
+    free(touched);
+    free(cand);
+    return NULL;
+}
+
+/**
+ * Compare every query WFD against a stored corpus and print the topK
+ * closest corpus files for each query, using the term index kept in the store.
+ **/
+void queryCorpus(WFDStore* store, WFDNode** queries, unsigned numQueries, unsigned topK, int athreads) {
+    QueryJob job;
+    unsigned n = store->numFiles;
+    job.index = NULL;
+    job.store = store;
+    job.files = store->files;
+    job.numFiles = n;
+    job.queries = queries;
+    job.numQueries = numQueries;
+    job.topK = topK;
+    job.nextQuery = 0;
+    job.byTotal = store->byTotal;
+    job.results = malloc(sizeof(QueryMatch*) * numQueries);
+    job.numResults = malloc(sizeof(unsigned) * numQueries);
+    if (!job.results || !job.numResults) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned i, k;
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (athreads > numQueries) {
+        athreads = numQueries;
+    }
+    pthread_t* tids = malloc(sizeof(pthread_t) * athreads);
+    if (!tids) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    int p;
+    for (p = 0; p < athreads; ++p) {
+        pthread_create(&tids[p], NULL, computeQueries, &job);
+    }
+    for (p = 0; p < athreads; ++p) {
+        pthread_join(tids[p], NULL);
+    }
+
+    for (i = 0; i < numQueries; ++i) {
+        for (k = 0; k < job.numResults[i]; ++k) {
+            QueryMatch* m = &job.results[i][k];
+            printf("%f %s %s\n", m->score, queries[i]->filename, store->files[m->file]->filename);
+        }
+        free(job.results[i]);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    free(tids);
+    free(job.results);
+    free(job.numResults);
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * WFD registry: a growable array of WFD pointers split into segments that
+ * double in size, so appending never moves an element and an index stays
+ * valid for the life of the run. Writers reserve a slot with an atomic
+ * cursor and publish the pointer with a release store; nothing is locked.
+ *
+ * Segment s holds REGISTRY_BASE << s slots and starts at index
+ * REGISTRY_BASE * (2^s - 1).
+ **/
+#define REGISTRY_BASE 64
+#define REGISTRY_SEGMENTS 26
+
+typedef struct WFDRegistry {
+    WFDNode** segments[REGISTRY_SEGMENTS];
+    unsigned cursor;        // next free slot (atomic)
+} WFDRegistry;
+
+/**
+ * Initializes an empty registry.
+ **/
+void registry_init(WFDRegistry* reg) {
+    memset(reg->segments, 0, sizeof(reg->segments));
+    reg->cursor = 0;
+}
+
+/**
+ * Segment and offset of an index.
+ **/
+void registry_locate(unsigned index, unsigned* segment, unsigned* offset) {
+    unsigned scaled = index / REGISTRY_BASE + 1;
+    unsigned s = 31 - __builtin_clz(scaled);
+    *segment = s;
+    *offset = index - REGISTRY_BASE * ((1u << s) - 1);
+}
+
+/**
+ * Returns the slots of a segment, allocating it if this is the first use.
+ * Racing allocators agree through a compare-and-swap; the loser frees its copy.
+ **/
+WFDNode** registry_segment(WFDRegistry* reg, unsigned s) {
+    WFDNode** seg = __atomic_load_n(&reg->segments[s], __ATOMIC_ACQUIRE);
+    if (seg != NULL) {
+        return seg;
+    }
+    WFDNode** fresh = calloc((size_t) REGISTRY_BASE << s, sizeof(WFDNode*));
+    if (fresh == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    if (__atomic_compare_exchange_n(&reg->segments[s], &seg, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return fresh;
+    }
+    free(fresh);
+    return seg;
+}
+
+/**
+ * Appends a WFD, records its index in it and returns the index.
+ **/
+unsigned registry_append(WFDRegistry* reg, WFDNode* wfd) {
+    unsigned index = __atomic_fetch_add(&reg->cursor, 1, __ATOMIC_RELAXED);
+    unsigned s, offset;
+    registry_locate(index, &s, &offset);
+    if (s >= REGISTRY_SEGMENTS) {
+        fprintf(stderr, "Too many files\n");
+        exit(1);
+    }
+    WFDNode** seg = registry_segment(reg, s);
+    wfd->index = index;
+    __atomic_store_n(&seg[offset], wfd, __ATOMIC_RELEASE);
+    return index;
+}
+
+/**
+ * Number of slots reserved so far. A slot below this may still be NULL
+ * while its writer is between reserving and publishing it.
+ **/
+unsigned registry_size(WFDRegistry* reg) {
+    return __atomic_load_n(&reg->cursor, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * The WFD at an index, or NULL if it has not been published yet.
+ **/
+WFDNode* registry_get(WFDRegistry* reg, unsigned index) {
+    unsigned s, offset;
+    registry_locate(index, &s, &offset);
+    WFDNode** seg = __atomic_load_n(&reg->segments[s], __ATOMIC_ACQUIRE);
+    if (seg == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&seg[offset], __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copies the registry into a flat array for the analysis engines.
+ **/
+WFDNode** registry_toArray(WFDRegistry* reg, unsigned numFiles) {
+    WFDNode** files = malloc(sizeof(WFDNode*) * (numFiles > 0 ? numFiles : 1));
+    if (files == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    unsigned i;
+    for (i = 0; i < numFiles; ++i) {
+        files[i] = registry_get(reg, i);
+    }
+    return files;
+}
+
+/**
+ * Frees the registry and, with freeNodes set, the WFDs in it.
+ **/
+void registry_free(WFDRegistry* reg, int freeNodes) {
+    unsigned n = registry_size(reg);
+    unsigned i;
+    if (freeNodes) {
+        for (i = 0; i < n; ++i) {
+            WFDNode* wfd = registry_get(reg, i);
+            if (wfd != NULL) {
+                freeWFD(wfd);
+            }
+        }
+    }
+    for (i = 0; i < REGISTRY_SEGMENTS; ++i) {
+        free(reg->segments[i]);
+        reg->segments[i] = NULL;
+    }
+    reg->cursor = 0;
+}
@@ -0,0 +1,101 @@
+#include <stddef.h>
+
+/**
+ * Word scanning for the tokenizer. Most input is runs of ASCII letters and
+ * digits, which need no more than lowercasing. A run scanner copies the run of
+ * [A-Za-z0-9] at the start of src, lowercased, to dst and returns its length;
+ * the tokenizer handles the byte that ended it (whitespace, punctuation or a
+ * non-ASCII byte) on its own. The AVX2 scanner classifies 32 bytes per step
+ * and the SSE4.2 one 16, with PCMPESTRI's range mode; the widest one the CPU
+ * supports is picked once by chooseRunScanner().
+ * dst must have room for len bytes. Bytes of dst past the run may be
+ * overwritten.
+ **/
+typedef size_t (*RunScanner)(const unsigned char* src, size_t len, char* dst);
+
+/**
+ * Portable scanner, and the tail of the vector ones.
+ **/
+size_t scanRunScalar(const unsigned char* src, size_t len, char* dst) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        unsigned char c = src[i];
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            dst[i] = c;
+        } else if (c >= 'A' && c <= 'Z') {
+            dst[i] = c + ('a' - 'A');
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define HAVE_VECTOR_SCAN 1
+
+__attribute__((target("sse4.2")))
+size_t scanRunSSE42(const unsigned char* src, size_t len, char* dst) {
+    const __m128i ranges = _mm_setr_epi8('a', 'z', '0', '9', 'A', 'Z', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i upperLo = _mm_set1_epi8('A' - 1);
+    const __m128i upperHi = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    while (i + 16 <= len) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (src + i));
+        // Index of the first byte outside the ranges, 16 if there is none
+        int end = _mm_cmpestri(ranges, 6, bytes, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, upperLo), _mm_cmpgt_epi8(upperHi, bytes));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_add_epi8(bytes, _mm_and_si128(upper, caseBit)));
+        if (end < 16) {
+            return i + end;
+        }
+        i += 16;
+    }
+    return i + scanRunScalar(src + i, len - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+size_t scanRunAVX2(const unsigned char* src, size_t len, char* dst) {
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i lowerLo = _mm256_set1_epi8('a' - 1);
+    const __m256i lowerHi = _mm256_set1_epi8('z' + 1);
+    const __m256i digitLo = _mm256_set1_epi8('0' - 1);
+    const __m256i digitHi = _mm256_set1_epi8('9' + 1);
+    size_t i = 0;
+    while (i + 32 <= len) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (src + i));
+        // Setting the case bit maps A-Z onto a-z and nothing else onto a-z;
+        // bytes past 0x7f are negative and fall outside every range
+        __m256i folded = _mm256_or_si256(bytes, caseBit);
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(folded, lowerLo), _mm256_cmpgt_epi8(lowerHi, folded));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, digitLo), _mm256_cmpgt_epi8(digitHi, bytes));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_blendv_epi8(bytes, folded, letter));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(letter, digit));
+        if (mask != 0xffffffffu) {
+            return i + __builtin_ctz(~mask);
+        }
+        i += 32;
+    }
+    return i + scanRunSSE42(src + i, len - i, dst + i);
+}
+#endif
+
+/**
+ * Widest scanner the CPU supports.
+ **/
+RunScanner chooseRunScanner() {
+#ifdef HAVE_VECTOR_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scanRunAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return scanRunSSE42;
+    }
+#endif
+    return scanRunScalar;
+}
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * On-disk WFD store. All fields are native-endian and every record starts on
+ * an 8-byte boundary, so a mapped store can be used in place:
+ *
+ *   header:  magic[8] "WFDSTOR3", uint64 numFiles, uint64 indexOffset,
+ *            uint64 recordOffset[numFiles]
+ *   record:  StoreRecord, double freqs[numTerms], uint32 counts[numTerms],
+ *            uint32 termOffsets[numTerms], char name[nameLen + 1], char pool[poolSize]
+ *   index:   StoreIndex, uint32 byTotal[numFiles] (padded to 8 bytes),
+ *            uint64 bucketStart[numBuckets + 1], StoreTerm terms[numTerms],
+ *            double freqs[numPostings], uint32 files[numPostings] (padded),
+ *            char pool[poolSize]
+ *
+ * The index at the end is the term index of the corpus, written once by -w so
+ * that -q does not rebuild it: the terms of bucket b (hashTerm & (numBuckets - 1))
+ * are terms[bucketStart[b]] up to terms[bucketStart[b + 1]], and each term's
+ * posting list is a run of freqs and files. byTotal orders the files by
+ * totalFreq for the queries' untouched candidates.
+ **/
+#define STORE_MAGIC "WFDSTOR3"
+#define STORE_HEADER 24
+
+typedef struct StoreRecord {
+    uint32_t wordCount;
+    uint32_t numTerms;
+    uint32_t nameLen;
+    uint32_t poolSize;
+    double totalFreq;
+    double sumSquares;      // for cosine, so opening a store reads no frequencies
+} StoreRecord;
+
+typedef struct StoreIndex {
+    uint64_t numBuckets;    // power of two
+    uint64_t numTerms;
+    uint64_t numPostings;
+    uint64_t poolSize;
+} StoreIndex;
+
+typedef struct StoreTerm {
+    uint32_t hash;
+    uint32_t size;          // files in the posting list
+    uint64_t term;          // offset in the index pool
+    uint64_t start;         // first posting
+} StoreTerm;
+
+typedef struct WFDStore {
+    void* map;
+    size_t size;
+    unsigned numFiles;
+    WFDNode** files;
+    uint64_t indexOffset;
+    StoreIndex* index;
+    const unsigned* byTotal;
+    const uint64_t* bucketStart;
+    const StoreTerm* terms;
+    const double* postingFreqs;
+    const unsigned* postingFiles;
+    const char* pool;
+} WFDStore;
+
+/**
+ * Size of a WFD's record, padded to 8 bytes.
+ **/
+size_t recordSize(WFDNode* wfd, uint32_t poolSize) {
+    size_t size = sizeof(StoreRecord) + wfd->numTerms * (sizeof(double) + 2 * sizeof(uint32_t))
+        + strlen(wfd->filename) + 1 + poolSize;
+    return (size + 7) & ~(size_t) 7;
+}
+
+/**
+ * Bytes used by a WFD's term pool.
+ **/
+uint32_t poolSizeOf(WFDNode* wfd) {
+    if (wfd->numTerms == 0) {
+        return 0;
+    }
+    unsigned last = wfd->numTerms - 1;
+    return wfd->termOffsets[last] + strlen(wfd->termPool + wfd->termOffsets[last]) + 1;
+}
+
+/**
+ * Bucket of a posting list in a stored index.
+ **/
+int compareStoreBuckets(const void* a, const void* b, void* arg) {
+    uint64_t mask = *(uint64_t*) arg;
+    uint64_t x = (*(PostingList* const*) a)->hash & mask;
+    uint64_t y = (*(PostingList* const*) b)->hash & mask;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Write the term index of the WFDs after their records.
+ **/
+void writeStoreIndex(FILE* out, WFDNode** files, unsigned numFiles) {
+    static const char pad[8] = {0};
+    TermIndex* index = buildTermIndex(files, numFiles);
+    StoreIndex header;
+    header.numTerms = 0;
+    header.numPostings = 0;
+    header.poolSize = 0;
+    unsigned b;
+    for (b = 0; b < index->numBuckets; ++b) {
+        PostingList* list;
+        for (list = index->buckets[b]; list != NULL; list = list->next) {
+            ++header.numTerms;
+            header.numPostings += list->size;
+            header.poolSize += strlen(list->term) + 1;
+        }
+    }
+    header.numBuckets = 16;
+    while (header.numBuckets < header.numTerms) {
+        header.numBuckets <<= 1;
+    }
+    PostingList** lists = malloc(sizeof(PostingList*) * (header.numTerms > 0 ? header.numTerms : 1));
+    uint64_t* bucketStart = calloc(header.numBuckets + 1, sizeof(uint64_t));
+    unsigned* byTotal = malloc(sizeof(unsigned) * (numFiles > 0 ? numFiles : 1));
+    if (lists == NULL || bucketStart == NULL || byTotal == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    uint64_t t = 0;
+    for (b = 0; b < index->numBuckets; ++b) {
+        PostingList* list;
+        for (list = index->buckets[b]; list != NULL; list = list->next) {
+            lists[t++] = list;
+        }
+    }
+    uint64_t mask = header.numBuckets - 1;
+    qsort_r(lists, header.numTerms, sizeof(PostingList*), compareStoreBuckets, &mask);
+    for (t = 0; t < header.numTerms; ++t) {
+        ++bucketStart[(lists[t]->hash & mask) + 1];
+    }
+    for (t = 0; t < header.numBuckets; ++t) {
+        bucketStart[t + 1] += bucketStart[t];
+    }
+    sortByTotal(files, numFiles, byTotal);
+
+    fwrite(&header, sizeof(StoreIndex), 1, out);
+    fwrite(byTotal, sizeof(uint32_t), numFiles, out);
+    fwrite(pad, 1, (numFiles % 2) * sizeof(uint32_t), out);
+    fwrite(bucketStart, sizeof(uint64_t), header.numBuckets + 1, out);
+    StoreTerm term;
+    term.term = 0;
+    term.start = 0;
+    for (t = 0; t < header.numTerms; ++t) {
+        term.hash = lists[t]->hash;
+        term.size = lists[t]->size;
+        fwrite(&term, sizeof(StoreTerm), 1, out);
+        term.term += strlen(lists[t]->term) + 1;
+        term.start += lists[t]->size;
+    }
+    for (t = 0; t < header.numTerms; ++t) {
+        fwrite(lists[t]->freqs, sizeof(double), lists[t]->size, out);
+    }
+    for (t = 0; t < header.numTerms; ++t) {
+        fwrite(lists[t]->files, sizeof(uint32_t), lists[t]->size, out);
+    }
+    fwrite(pad, 1, (header.numPostings % 2) * sizeof(uint32_t), out);
+    for (t = 0; t < header.numTerms; ++t) {
+        fwrite(lists[t]->term, 1, strlen(lists[t]->term) + 1, out);
+    }
+    free(byTotal);
+    free(bucketStart);
+    free(lists);
+    freeTermIndex(index);
+}
+
+/**
+ * Write an array of frozen WFDs to a store file.
+ * The store is written next to its final path and renamed into place, so a
+ * reader never sees a partial store.
+ **/
+int writeStore(const char* path, WFDNode** files, unsigned numFiles) {
+    char* tmp = malloc(strlen(path) + 5);
+    if (tmp == NULL) {
+        perror("Malloc failed\n");
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    FILE* out = fopen(tmp, "wb");
+    if (out == NULL) {
+        perror(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    uint64_t count = numFiles;
+    uint64_t offset = STORE_HEADER + sizeof(uint64_t) * (uint64_t) numFiles;
+    uint64_t indexOffset = offset;
+    unsigned i;
+    for (i = 0; i < numFiles; ++i) {
+        indexOffset += recordSize(files[i], poolSizeOf(files[i]));
+    }
+    fwrite(STORE_MAGIC, 1, 8, out);
+    fwrite(&count, sizeof(uint64_t), 1, out);
+    fwrite(&indexOffset, sizeof(uint64_t), 1, out);
+    for (i = 0; i < numFiles; ++i) {
+        fwrite(&offset, sizeof(uint64_t), 1, out);
+        offset += recordSize(files[i], poolSizeOf(files[i]));
+    }
+
+    static const char pad[8] = {0};
+    for (i = 0; i < numFiles; ++i) {
+        WFDNode* wfd = files[i];
+        StoreRecord rec;
+        rec.wordCount = wfd->wordCount;
+        rec.numTerms = wfd->numTerms;
+        rec.nameLen = strlen(wfd->filename);
+        rec.poolSize = poolSizeOf(wfd);
+        rec.totalFreq = wfd->totalFreq;
+        rec.sumSquares = wfd->sumSquares;
+        fwrite(&rec, sizeof(StoreRecord), 1, out);
+        fwrite(wfd->freqs, sizeof(double), wfd->numTerms, out);
+        fwrite(wfd->counts, sizeof(uint32_t), wfd->numTerms, out);
+        fwrite(wfd->termOffsets, sizeof(uint32_t), wfd->numTerms, out);
+        fwrite(wfd->filename, 1, rec.nameLen + 1, out);
+        fwrite(wfd->termPool, 1, rec.poolSize, out);
+        size_t used = sizeof(StoreRecord) + wfd->numTerms * (sizeof(double) + 2 * sizeof(uint32_t))
+            + rec.nameLen + 1 + rec.poolSize;
+        fwrite(pad, 1, recordSize(wfd, rec.poolSize) - used, out);
+    }
+    writeStoreIndex(out, files, numFiles);
+
+    if (fflush(out) != 0 || ferror(out) || fsync(fileno(out)) != 0) {
+        perror(tmp);
+        fclose(out);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    fclose(out);
+    if (rename(tmp, path) != 0) {
+        perror(path);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+/**
+ * Point a WFD node at its record inside a mapped store.
+ **/
+WFDNode* mapRecord(char* base) {
+    StoreRecord* rec = (StoreRecord*) base;
+    WFDNode* node = malloc(sizeof(WFDNode));
+    if (node == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    char* ptr = base + sizeof(StoreRecord);
+    node->trieRoot = NULL;
+    node->wordCount = rec->wordCount;
+    node->numTerms = rec->numTerms;
+    node->totalFreq = rec->totalFreq;
+    node->freqs = (double*) ptr;
+    ptr += sizeof(double) * rec->numTerms;
+    node->counts = (unsigned*) ptr;
+    ptr += sizeof(uint32_t) * rec->numTerms;
+    node->termOffsets = (unsigned*) ptr;
+    ptr += sizeof(uint32_t) * rec->numTerms;
+    node->filename = ptr;
+    ptr += rec->nameLen + 1;
+    node->termPool = ptr;
+    node->sumSquares = rec->sumSquares;
+    node->mapped = 1;
+    node->dedup = NULL;
+    node->canon = NULL;
+    node->id = 0;
+    node->index = 0;
+    node->next = NULL;
+    return node;
+}
+
+/**
+ * Check that a record at offset fits before end and that its strings are
+ * terminated. Only the ends of the term pool are checked, so that opening a
+ * store does not read every record.
+ **/
+int checkRecord(const char* map, uint64_t offset, uint64_t end) {
+    if (offset % 8 != 0 || offset > end || end - offset < sizeof(StoreRecord)) {
+        return 0;
+    }
+    const StoreRecord* rec = (const StoreRecord*) (map + offset);
+    uint64_t size = sizeof(StoreRecord) + (sizeof(double) + 2 * sizeof(uint32_t)) * (uint64_t) rec->numTerms
+        + (uint64_t) rec->nameLen + 1 + rec->poolSize;
+    if (size > end - offset || (rec->numTerms == 0) != (rec->poolSize == 0)) {
+        return 0;
+    }
+    const char* name = map + offset + size - rec->poolSize - rec->nameLen - 1;
+    if (name[rec->nameLen] != '\0') {
+        return 0;
+    }
+    if (rec->numTerms > 0) {
+        const uint32_t* termOffsets = (const uint32_t*) (name - sizeof(uint32_t) * rec->numTerms);
+        if (name[rec->nameLen + rec->poolSize] != '\0'
+                || termOffsets[rec->numTerms - 1] >= rec->poolSize) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check the record table and the index section of a mapped store, and point
+ * the store at its index.
+ **/
+int checkStore(WFDStore* store) {
+    const char* map = store->map;
+    uint64_t size = store->size;
+    uint64_t numFiles;
+    if (size < STORE_HEADER || memcmp(map, STORE_MAGIC, 8) != 0) {
+        return 0;
+    }
+    memcpy(&numFiles, map + 8, sizeof(uint64_t));
+    memcpy(&store->indexOffset, map + 16, sizeof(uint64_t));
+    if (numFiles > UINT_MAX || numFiles > (size - STORE_HEADER) / sizeof(uint64_t)) {
+        return 0;
+    }
+    uint64_t offset = STORE_HEADER + sizeof(uint64_t) * numFiles;
+    if (store->indexOffset % 8 != 0 || store->indexOffset < offset
+            || store->indexOffset > size || size - store->indexOffset < sizeof(StoreIndex)) {
+        return 0;
+    }
+    const uint64_t* offsets = (const uint64_t*) (map + STORE_HEADER);
+    uint64_t i;
+    for (i = 0; i < numFiles; ++i) {
+        uint64_t next = i + 1 < numFiles ? offsets[i + 1] : store->indexOffset;
+        if (offsets[i] < offset || !checkRecord(map, offsets[i], next)) {
+            return 0;
+        }
+        offset = offsets[i];
+    }
+
+    const StoreIndex* index = (const StoreIndex*) (map + store->indexOffset);
+    uint64_t left = size - store->indexOffset - sizeof(StoreIndex);
+    uint64_t filesSize = sizeof(uint32_t) * (numFiles + numFiles % 2);
+    if (index->numBuckets == 0 || (index->numBuckets & (index->numBuckets - 1)) != 0
+            || index->numBuckets > left / sizeof(uint64_t)
+            || index->numTerms > left / sizeof(StoreTerm)
+            || index->numPostings > left / (sizeof(double) + sizeof(uint32_t))
+            || index->poolSize > left) {
+        return 0;
+    }
+    uint64_t need = filesSize + sizeof(uint64_t) * (index->numBuckets + 1)
+        + sizeof(StoreTerm) * index->numTerms
+        + sizeof(double) * index->numPostings
+        + sizeof(uint32_t) * (index->numPostings + index->numPostings % 2)
+        + index->poolSize;
+    if (need > left || (index->poolSize > 0 && map[size - left + need - 1] != '\0')) {
+        return 0;
+    }
+    const char* ptr = (const char*) (index + 1);
+    store->index = (StoreIndex*) index;
+    store->byTotal = (const unsigned*) ptr;
+    ptr += filesSize;
+    store->bucketStart = (const uint64_t*) ptr;
+    ptr += sizeof(uint64_t) * (index->numBuckets + 1);
+    store->terms = (const StoreTerm*) ptr;
+    ptr += sizeof(StoreTerm) * index->numTerms;
+    store->postingFreqs = (const double*) ptr;
+    ptr += sizeof(double) * index->numPostings;
+    store->postingFiles = (const unsigned*) ptr;
+    ptr += sizeof(uint32_t) * (index->numPostings + index->numPostings % 2);
+    store->pool = ptr;
+    store->numFiles = numFiles;
+    return store->bucketStart[index->numBuckets] == index->numTerms;
+}
+
+/**
+ * Map a store file and wrap each record in a WFD node. A store that is
+ * truncated or whose offsets do not fit the file is rejected.
+ **/
+WFDStore* openStore(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < STORE_HEADER) {
+        fprintf(stderr, "%s: not a WFD store\n", path);
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    WFDStore* store = malloc(sizeof(WFDStore));
+    if (store == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    store->map = map;
+    store->size = st.st_size;
+    if (!checkStore(store)) {
+        fprintf(stderr, "%s: not a WFD store or corrupt\n", path);
+        munmap(map, st.st_size);
+        free(store);
+        return NULL;
+    }
+    store->files = malloc(sizeof(WFDNode*) * (store->numFiles > 0 ? store->numFiles : 1));
+    if (store->files == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    uint64_t* offsets = (uint64_t*) ((char*) map + STORE_HEADER);
+    unsigned i;
+    for (i = 0; i < store->numFiles; ++i) {
+        store->files[i] = mapRecord((char*) map + offsets[i]);
+        store->files[i]->id = i;
+    }
+    return store;
+}
+
+/**
+ * Offset of a record in a mapped store; the offset of the index for
+ * i == numFiles.
+ **/
+uint64_t storeRecordOffset(WFDStore* store, unsigned i) {
+    if (i >= store->numFiles) {
+        return store->indexOffset;
+    }
+    uint64_t offset;
+    memcpy(&offset, (char*) store->map + STORE_HEADER + sizeof(uint64_t) * i, sizeof(uint64_t));
+    return offset;
+}
+
+/**
+ * Look up the posting list of a term in a store's index. Entries that point
+ * outside the index are treated as missing.
+ **/
+unsigned storePosting(WFDStore* store, const char* term, const unsigned** files, const double** freqs) {
+    uint32_t hash = hashTerm(term);
+    uint64_t b = hash & (store->index->numBuckets - 1);
+    uint64_t t;
+    for (t = store->bucketStart[b]; t < store->bucketStart[b + 1] && t < store->index->numTerms; ++t) {
+        const StoreTerm* entry = &store->terms[t];
+        if (entry->hash != hash || entry->term >= store->index->poolSize
+                || entry->start > store->index->numPostings
+                || entry->size > store->index->numPostings - entry->start
+                || strcmp(store->pool + entry->term, term) != 0) {
+            continue;
+        }
+        *files = store->postingFiles + entry->start;
+        *freqs = store->postingFreqs + entry->start;
+        return entry->size;
+    }
+    return 0;
+}
+
+/**
+ * Unmap a store and free its WFD nodes.
+ **/
+void closeStore(WFDStore* store) {
+    unsigned i;
+    for (i = 0; i < store->numFiles; ++i) {
+        freeWFD(store->files[i]);
+    }
+    free(store->files);
+    munmap(store->map, store->size);
+    free(store);
+}
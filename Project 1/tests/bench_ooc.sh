@@ -0,0 +1,94 @@
+#!/bin/sh
+# Out-of-core benchmark: -o over a store about four times the size of a
+# memory cgroup's limit, so the store's pages must be dropped and read back
+# as the tiles stream past. The limit covers the page cache of the mapped
+# store, which an address-space limit (prlimit --as) does not. Builds a
+# release compare in a temporary directory.
+# Usage: tests/bench_ooc.sh [files] [distinct-words-per-file] [limit-MiB]
+set -e
+FILES=${1:-140}
+WORDS=${2:-24000}
+LIMIT=${3:-48}
+DIR=$(mktemp -d /tmp/wfdbench.XXXXXX)
+CGROUP=
+cleanup() {
+    [ -n "$CGROUP" ] && rmdir "$CGROUP" 2> /dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+cd "$(dirname "$0")/.."
+
+gcc -O2 -std=c99 -Wvla -Wall -o "$DIR/compare" compare.c libwfd.c -lm -pthread -lz
+mkdir "$DIR/corpus"
+awk -v n="$FILES" -v words="$WORDS" -v dir="$DIR/corpus" 'BEGIN {
+    srand(7)
+    for (f = 0; f < n; ++f) {
+        out = sprintf("%s/f%05d.txt", dir, f)
+        for (w = 0; w < 2 * words; ++w) {
+            printf "w%d ", int(rand() * rand() * 8 * words) > out
+        }
+        close(out)
+    }
+}'
+"$DIR/compare" -w"$DIR/corpus.store" "$DIR/corpus"
+STORE=$(($(wc -c < "$DIR/corpus.store") >> 20))
+# Blocks of a quarter of the limit, so a tile and the next one's read-ahead fit
+BLOCK=$((LIMIT / 4))
+echo "$FILES files, $((FILES * (FILES - 1) / 2)) pairs, ${STORE} MiB store, limit ${LIMIT} MiB, ${BLOCK} MiB blocks"
+
+# Runs a command under the memory limit: a systemd scope where there is one,
+# else a cgroup of its own (v2, then v1), else only an address-space limit
+PEAK=
+limited() {
+    if systemd-run --scope --quiet -p MemoryMax=${LIMIT}M true > /dev/null 2>&1; then
+        systemd-run --scope --quiet -p MemoryMax=${LIMIT}M -p MemorySwapMax=0 "$@"
+    elif [ -w /sys/fs/cgroup/cgroup.subtree_control ] && mkdir "/sys/fs/cgroup/wfdbench.$$" 2> /dev/null; then
+        CGROUP=/sys/fs/cgroup/wfdbench.$$
+        echo $((LIMIT << 20)) > "$CGROUP/memory.max"
+        echo 0 > "$CGROUP/memory.swap.max" 2> /dev/null || true
+        status=0
+        sh -c 'echo $$ > "$1/cgroup.procs" && shift && exec "$@"' sh "$CGROUP" "$@" || status=$?
+        PEAK=$(cat "$CGROUP/memory.peak" 2> /dev/null || true)
+        rmdir "$CGROUP"
+        CGROUP=
+        return $status
+    elif [ -w /sys/fs/cgroup/memory ] && mkdir "/sys/fs/cgroup/memory/wfdbench.$$" 2> /dev/null; then
+        CGROUP=/sys/fs/cgroup/memory/wfdbench.$$
+        echo $((LIMIT << 20)) > "$CGROUP/memory.limit_in_bytes"
+        echo $((LIMIT << 20)) > "$CGROUP/memory.memsw.limit_in_bytes" 2> /dev/null || true
+        status=0
+        sh -c 'echo $$ > "$1/tasks" && shift && exec "$@"' sh "$CGROUP" "$@" || status=$?
+        PEAK=$(cat "$CGROUP/memory.max_usage_in_bytes")
+        rmdir "$CGROUP"
+        CGROUP=
+        return $status
+    else
+        echo "(no memory cgroup available: address-space limit only, the store's page cache is not limited)" >&2
+        prlimit --as=$((LIMIT << 20)) "$@"
+    fi
+}
+
+# The same run without a limit, for reference
+start=$(date +%s.%N)
+"$DIR/compare" -a1 -M$BLOCK -o"$DIR/corpus.store" > /dev/null
+end=$(date +%s.%N)
+echo "-o without a limit: $(awk "BEGIN { printf \"%.2f\", $end - $start }") s"
+
+# Start with none of the store cached, so every page is charged to the run
+sync "$DIR/corpus.store"
+dd if="$DIR/corpus.store" iflag=nocache count=0 2> /dev/null
+
+# One analysis thread keeps the allocator's per-thread arenas out of the limit
+start=$(date +%s.%N)
+if limited "$DIR/compare" -a1 -M$BLOCK -o"$DIR/corpus.store" > "$DIR/ooc.out"; then
+    end=$(date +%s.%N)
+    echo "-o under the limit: $(wc -l < "$DIR/ooc.out") pairs in $(awk "BEGIN { printf \"%.2f\", $end - $start }") s${PEAK:+, peak $((PEAK >> 20)) MiB}"
+else
+    echo "-o under the limit: failed"
+    exit 1
+fi
+if limited "$DIR/compare" -a1 "$DIR/corpus" > /dev/null 2>&1; then
+    echo "in memory: fits under the limit"
+else
+    echo "in memory: fails under the limit"
+fi
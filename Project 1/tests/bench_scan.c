@@ -0,0 +1,75 @@
+#include "../libwfd.c"
+
+/**
+ * Throughput of each run scanner in GB/s of input, over text of words of 1
+ * to 12 letters and digits and over one long run. Built with the release
+ * LIBFLAGS by 'make bench'.
+ **/
+#define BENCH_BYTES ((size_t) 64 << 20)
+#define BENCH_ROUNDS 8
+
+double scanSeconds(RunScanner scan, const unsigned char* src, size_t size, char* dst) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int round;
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        size_t pos = 0;
+        while (pos < size) {
+            pos += scan(src + pos, size - pos, dst + pos) + 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main() {
+    unsigned char* words = malloc(BENCH_BYTES);
+    unsigned char* run = malloc(BENCH_BYTES);
+    char* dst = malloc(BENCH_BYTES);
+    if (words == NULL || run == NULL || dst == NULL) {
+        perror("Malloc failed\n");
+        return 1;
+    }
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    srand(4);
+    size_t i = 0;
+    while (i < BENCH_BYTES) {
+        int w = 1 + rand() % 12;
+        while (w-- > 0 && i < BENCH_BYTES) {
+            words[i++] = letters[rand() % (sizeof(letters) - 1)];
+        }
+        if (i < BENCH_BYTES) {
+            words[i++] = ' ';
+        }
+    }
+    for (i = 0; i < BENCH_BYTES; ++i) {
+        run[i] = letters[i % (sizeof(letters) - 1)];
+    }
+
+    struct {
+        const char* name;
+        RunScanner scan;
+        int supported;
+    } scanners[] = {
+        { "scalar", scanRunScalar, 1 },
+#ifdef HAVE_VECTOR_SCAN
+        { "sse4.2", scanRunSSE42, __builtin_cpu_supports("sse4.2") },
+        { "avx2", scanRunAVX2, __builtin_cpu_supports("avx2") },
+#endif
+    };
+    printf("%-8s %12s %12s\n", "scanner", "words GB/s", "run GB/s");
+    size_t s;
+    for (s = 0; s < sizeof(scanners) / sizeof(scanners[0]); ++s) {
+        if (!scanners[s].supported) {
+            continue;
+        }
+        double bytes = (double) BENCH_BYTES * BENCH_ROUNDS;
+        double wordTime = scanSeconds(scanners[s].scan, words, BENCH_BYTES, dst);
+        double runTime = scanSeconds(scanners[s].scan, run, BENCH_BYTES, dst);
+        printf("%-8s %12.2f %12.2f\n", scanners[s].name, bytes / wordTime / 1e9, bytes / runTime / 1e9);
+    }
+    free(dst);
+    free(run);
+    free(words);
+    return 0;
+}
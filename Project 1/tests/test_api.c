@@ -0,0 +1,92 @@
+#include "../libwfd.c"
+
+/**
+ * WFDs built through the API from memory must match the ones built from the
+ * same bytes in a file, including empty input: no bytes give no words and
+ * no terms, whichever way they arrive.
+ **/
+int failures = 0;
+
+void expectSame(const char* what, WFD* got, WFD* expected) {
+    if (got == NULL || expected == NULL) {
+        fprintf(stderr, "%s: no WFD\n", what);
+        ++failures;
+        return;
+    }
+    if (wfd_word_count(got) != wfd_word_count(expected) || wfd_num_terms(got) != wfd_num_terms(expected)
+            || wfd_score(got, expected) != 0) {
+        fprintf(stderr, "%s: %d words and %u terms, expected %d and %u (score %f)\n", what,
+            wfd_word_count(got), wfd_num_terms(got), wfd_word_count(expected), wfd_num_terms(expected),
+            wfd_score(got, expected));
+        ++failures;
+    }
+}
+
+/**
+ * WFD of text written to a file, to compare the in-memory ones against.
+ **/
+WFD* fileOf(const char* dir, const char* text) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s/input.txt", dir);
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fputs(text, out);
+    fclose(out);
+    return wfd_from_file(path);
+}
+
+int main() {
+    char dir[] = "/tmp/wfdtestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("setup");
+        return 1;
+    }
+    static const char* texts[] = { "", " \n\t ", "word", "two words\n", "a, b. c!  d" };
+    int t;
+    for (t = 0; t < (int) (sizeof(texts) / sizeof(texts[0])); ++t) {
+        const char* text = texts[t];
+        size_t size = strlen(text);
+        WFD* expected = fileOf(dir, text);
+        char what[64];
+
+        snprintf(what, sizeof(what), "text %d from a buffer", t);
+        WFD* wfd = wfd_from_buffer("buffer", text, size);
+        expectSame(what, wfd, expected);
+        wfd_free(wfd);
+
+        // One byte at a time, with empty pieces in between
+        snprintf(what, sizeof(what), "text %d fed bytewise", t);
+        WFDBuilder* builder = wfd_builder_create("builder");
+        size_t i;
+        for (i = 0; i < size; ++i) {
+            wfd_builder_feed(builder, text + i, 1);
+            wfd_builder_feed(builder, text + i, 0);
+        }
+        wfd = wfd_builder_freeze(builder);
+        expectSame(what, wfd, expected);
+        wfd_free(wfd);
+        wfd_free(expected);
+    }
+
+    // No feed at all is an empty file too
+    WFD* empty = wfd_builder_freeze(wfd_builder_create("unfed"));
+    if (empty == NULL || wfd_word_count(empty) != 0 || wfd_num_terms(empty) != 0) {
+        fprintf(stderr, "an unfed builder gives %d words and %u terms\n",
+            empty ? wfd_word_count(empty) : -1, empty ? wfd_num_terms(empty) : 0);
+        ++failures;
+    }
+    wfd_free(empty);
+
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    if (failures > 0) {
+        fprintf(stderr, "test_api: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_api: ok\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "../libwfd.c"
+
+/**
+ * With -H, a byte-identical copy of a file that cannot be read (here a
+ * truncated .gz) is dropped as unreadable too, rather than listed as an
+ * empty WFD, and the table does not read the name of the failed file.
+ * Readable copies still score 0 against each other.
+ **/
+typedef struct Listed {
+    char names[16][128];
+    double scores[16];
+    int count;
+} Listed;
+
+int listPair(void* ctx, const WFDPair* pair) {
+    Listed* l = ctx;
+    if (l->count < 16) {
+        snprintf(l->names[l->count], sizeof(l->names[0]), "%s %s",
+            strrchr(pair->fileA, '/') + 1, strrchr(pair->fileB, '/') + 1);
+        l->scores[l->count] = pair->score;
+    }
+    ++l->count;
+    return 0;
+}
+
+void writeText(const char* dir, const char* name, const char* text) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fputs(text, out);
+    fclose(out);
+}
+
+/**
+ * Writes text gzipped, cut off halfway through the compressed stream.
+ **/
+void writeTruncatedGzip(const char* dir, const char* name, const char* text) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    gzFile gz = gzopen(path, "wb");
+    if (gz == NULL) {
+        perror(path);
+        exit(1);
+    }
+    int i;
+    for (i = 0; i < 200; ++i) {
+        gzputs(gz, text);
+    }
+    gzclose(gz);
+    struct stat st;
+    if (stat(path, &st) != 0 || truncate(path, st.st_size / 2) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+int main() {
+    char dir[] = "/tmp/wfdtestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("setup");
+        return 1;
+    }
+    writeText(dir, "a.txt", "the quick brown fox jumps over the lazy dog\n");
+    writeText(dir, "b.txt", "a quick brown dog naps\n");
+    writeText(dir, "c.txt", "a quick brown dog naps\n");
+    writeTruncatedGzip(dir, "bad.txt.gz", "lorem ipsum dolor sit amet consectetur\n");
+    char cmd[160];
+    snprintf(cmd, sizeof(cmd), "cp %s/bad.txt.gz %s/copy.txt.gz", dir, dir);
+    if (system(cmd) != 0) {
+        return 1;
+    }
+
+    int failures = 0;
+
+    // The table keeps its own copy of a claimed name: the file thread frees
+    // the name when the file cannot be read, and the copy is claimed later
+    DedupTable table;
+    dedup_init(&table, 1);
+    struct stat st;
+    char badPath[96], copyPath[96];
+    snprintf(badPath, sizeof(badPath), "%s/bad.txt.gz", dir);
+    snprintf(copyPath, sizeof(copyPath), "%s/copy.txt.gz", dir);
+    char* name = strdup(badPath);
+    DedupEntry* entry = NULL;
+    stat(badPath, &st);
+    if (dedup_claim(&table, name, st.st_dev, st.st_ino, &entry) != NULL || entry == NULL) {
+        fprintf(stderr, "the first copy was not claimed for tokenizing\n");
+        return 1;
+    }
+    strcpy(name, "/nonexistent");
+    free(name);
+    DedupEntry* copyEntry = NULL;
+    stat(copyPath, &st);
+    DedupEntry* copyOf = dedup_claim(&table, copyPath, st.st_dev, st.st_ino, &copyEntry);
+    if (copyOf != entry) {
+        fprintf(stderr, "the copy of a failed file was not matched to it\n");
+        ++failures;
+    }
+
+    // The copy of a file that could not be read is dropped, and the rest are numbered
+    WFDNode* files[2];
+    files[0] = createDuplicateWFD(strdup(copyPath), copyOf != NULL ? copyOf : entry);
+    char* alphabet = initializeAlphabet();
+    snprintf(cmd, sizeof(cmd), "%s/a.txt", dir);
+    files[1] = createFileWFD(strdup(cmd), alphabet);
+    WFDNode* copyNode = files[0];
+    WFDNode* readable = files[1];
+    unsigned numFiles = 2;
+    unsigned numUnique = resolveDuplicates(files, &numFiles);
+    if (numFiles != 1 || numUnique != 1 || strstr(files[0]->filename, "a.txt") == NULL || files[0]->id != 0) {
+        fprintf(stderr, "%u files and %u distinct after resolving, expected a.txt alone\n", numFiles, numUnique);
+        ++failures;
+    }
+    freeWFD(copyNode);
+    freeWFD(readable);
+    dedup_destroy(&table);
+    free(alphabet);
+
+    // A whole run with -H lists neither copy
+    int pipelined;
+    for (pipelined = 0; pipelined <= 1; ++pipelined) {
+        WFDOptions opts;
+        wfd_options_init(&opts);
+        opts.hashContent = 1;
+        opts.fileThreads = 1;
+        opts.dirThreads = 1;
+        opts.analysisThreads = 2;
+        opts.pipelined = pipelined;
+        char* paths[] = { dir };
+        Listed listed = { .count = 0 };
+        int status = wfd_run(&opts, paths, 1, listPair, &listed);
+        if (status != EXIT_SUCCESS || listed.count != 3) {
+            fprintf(stderr, "%s: status %d and %d pairs, expected 3 among a, b and c\n",
+                pipelined ? "-p" : "default", status, listed.count);
+            ++failures;
+        }
+        int k;
+        for (k = 0; k < listed.count && k < 16; ++k) {
+            if (strstr(listed.names[k], ".gz") != NULL) {
+                fprintf(stderr, "%s: unreadable copy listed in %s\n", pipelined ? "-p" : "default", listed.names[k]);
+                ++failures;
+            }
+            if (strcmp(listed.names[k], "b.txt c.txt") == 0 || strcmp(listed.names[k], "c.txt b.txt") == 0) {
+                if (listed.scores[k] != 0) {
+                    fprintf(stderr, "copies b and c score %f\n", listed.scores[k]);
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    if (failures > 0) {
+        fprintf(stderr, "test_dedup: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_dedup: ok\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "../libwfd.c"
+
+/**
+ * Out-of-core analysis must list the same pairs, in the same order, as the
+ * in-memory results. Tiny runs, fan-in and blocks force many tiles, spilled
+ * runs and merge passes.
+ **/
+#define NUM_FILES 60
+
+typedef struct Collected {
+    WFDPair* pairs;
+    size_t count;
+    size_t limit;
+} Collected;
+
+int collect(void* ctx, const WFDPair* pair) {
+    Collected* c = ctx;
+    c->pairs[c->count++] = *pair;
+    return c->count == c->limit;
+}
+
+int main() {
+    char* alphabet = initializeAlphabet();
+    char dir[] = "/tmp/wfdtestXXXXXX";
+    if (alphabet == NULL || mkdtemp(dir) == NULL) {
+        perror("setup");
+        return 1;
+    }
+    static const char* words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta" };
+    WFDNode* wfds[NUM_FILES];
+    char path[64];
+    srand(2);
+    int f;
+    for (f = 0; f < NUM_FILES; ++f) {
+        snprintf(path, sizeof(path), "%s/f%02d.txt", dir, f);
+        FILE* out = fopen(path, "w");
+        if (out == NULL) {
+            perror(path);
+            return 1;
+        }
+        // Few distinct lengths, so many pairs tie on combined word count
+        int w, length = 5 + (f % 7) * 3;
+        for (w = 0; w < length; ++w) {
+            fprintf(out, "%s ", words[rand() % (2 + f % 6)]);
+        }
+        fclose(out);
+        wfds[f] = createFileWFD(strdup(path), alphabet);
+    }
+    char storePath[64];
+    snprintf(storePath, sizeof(storePath), "%s/corpus.store", dir);
+    if (writeStore(storePath, wfds, NUM_FILES) != 0) {
+        return 1;
+    }
+    WFDStore* store = openStore(storePath);
+    unsigned n = store->numFiles;
+
+    PairResults* results = createPairResults(store->files, n);
+    size_t k;
+    for (k = 0; k < results->numPairs; ++k) {
+        results->score[k] = metricPair(store->files[results->fileA[k]], store->files[results->fileB[k]]);
+    }
+    sortPairResults(results);
+    Collected expected = { malloc(sizeof(WFDPair) * results->numPairs), 0, 0 };
+    emitPairResults(results, collect, &expected);
+
+    int failures = 0;
+    oocRunPairs = 7;
+    oocFanIn = 3;
+    int threads;
+    for (threads = 1; threads <= 4; threads += 3) {
+        OOCSpill spill;
+        if (ooc_spill_init(&spill) != 0) {
+            return 1;
+        }
+        analyzeStore(store, &spill, 512, threads);
+        Collected got = { malloc(sizeof(WFDPair) * results->numPairs), 0, 0 };
+        size_t emitted = emitSpill(&spill, store->files, collect, &got);
+        ooc_spill_free(&spill);
+        if (emitted != results->numPairs || got.count != expected.count) {
+            fprintf(stderr, "%d threads: %zu pairs, expected %zu\n", threads, got.count, expected.count);
+            ++failures;
+        }
+        for (k = 0; k < got.count && k < expected.count; ++k) {
+            if (got.pairs[k].indexA != expected.pairs[k].indexA || got.pairs[k].indexB != expected.pairs[k].indexB
+                    || got.pairs[k].score != expected.pairs[k].score) {
+                fprintf(stderr, "%d threads: pair %zu is (%u, %u), expected (%u, %u)\n", threads, k,
+                    got.pairs[k].indexA, got.pairs[k].indexB, expected.pairs[k].indexA, expected.pairs[k].indexB);
+                ++failures;
+                break;
+            }
+        }
+        free(got.pairs);
+    }
+
+    // A sink that stops early ends the merge
+    OOCSpill spill;
+    ooc_spill_init(&spill);
+    analyzeStore(store, &spill, 512, 2);
+    Collected top = { malloc(sizeof(WFDPair) * 10), 0, 10 };
+    if (emitSpill(&spill, store->files, collect, &top) != 10) {
+        fprintf(stderr, "a sink stopping at 10 pairs took %zu\n", top.count);
+        ++failures;
+    }
+    ooc_spill_free(&spill);
+    free(top.pairs);
+
+    // Clustering takes every pair under the threshold, without a spill
+    double threshold = 0.05;
+    size_t near = 0;
+    for (k = 0; k < results->numPairs; ++k) {
+        near += results->score[k] < threshold;
+    }
+    pairClusters = cluster_create(n, threshold);
+    analyzeStore(store, NULL, 512, 3);
+    if (pairClusters->numEdges != near) {
+        fprintf(stderr, "%zu cluster edges, expected %zu\n", pairClusters->numEdges, near);
+        ++failures;
+    }
+    cluster_destroy(pairClusters);
+    pairClusters = NULL;
+
+    free(expected.pairs);
+    freePairResults(results);
+    closeStore(store);
+    for (f = 0; f < NUM_FILES; ++f) {
+        freeWFD(wfds[f]);
+    }
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    free(alphabet);
+    if (failures > 0) {
+        fprintf(stderr, "test_ooc: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_ooc: ok\n");
+    return 0;
+}
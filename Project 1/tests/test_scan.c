@@ -0,0 +1,90 @@
+#include "../libwfd.c"
+
+/**
+ * Every run scanner must return the same run, lowercased the same way, as
+ * scanRunScalar, for every length from 0 to 64 and every kind of byte ending
+ * the run. Buffers are allocated at their exact length, so the sanitizers
+ * catch a scanner reading or writing past it.
+ **/
+#define MAX_LEN 64
+#define TRIALS 2000
+
+typedef struct Scanner {
+    const char* name;
+    RunScanner scan;
+    int supported;
+} Scanner;
+
+/**
+ * A byte that is usually part of a run; otherwise whitespace, punctuation,
+ * a range boundary or a non-ASCII byte.
+ **/
+unsigned char randomByte(int runBias) {
+    static const char run[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static const unsigned char stop[] = { ' ', '\n', '\t', '\0', '\'', '-', '.', '/', ':', '@', '[', '`', '{',
+        0x7f, 0x80, 0xc1, 0xda, 0xe1, 0xfa, 0xff, 'A' | 0x80, 'z' | 0x80 };
+    if (rand() % 100 < runBias) {
+        return run[rand() % (sizeof(run) - 1)];
+    }
+    return stop[rand() % sizeof(stop)];
+}
+
+int main() {
+    Scanner scanners[] = {
+#ifdef HAVE_VECTOR_SCAN
+        { "sse4.2", scanRunSSE42, 0 },
+        { "avx2", scanRunAVX2, 0 },
+#endif
+        { "scalar", scanRunScalar, 1 },
+    };
+    int numScanners = sizeof(scanners) / sizeof(scanners[0]);
+#ifdef HAVE_VECTOR_SCAN
+    __builtin_cpu_init();
+    scanners[0].supported = __builtin_cpu_supports("sse4.2");
+    scanners[1].supported = __builtin_cpu_supports("avx2");
+#endif
+    srand(3);
+    int failures = 0;
+    size_t len;
+    for (len = 0; len <= MAX_LEN; ++len) {
+        int trial;
+        for (trial = 0; trial < TRIALS; ++trial) {
+            unsigned char* src = malloc(len > 0 ? len : 1);
+            char* expected = malloc(len > 0 ? len : 1);
+            char* dst = malloc(len > 0 ? len : 1);
+            // From no stop bytes at all to mostly stop bytes
+            int runBias = trial % 4 == 0 ? 100 : 100 - trial % 40;
+            size_t i;
+            for (i = 0; i < len; ++i) {
+                src[i] = randomByte(runBias);
+            }
+            size_t want = scanRunScalar(src, len, expected);
+            int s;
+            for (s = 0; s < numScanners; ++s) {
+                if (!scanners[s].supported) {
+                    continue;
+                }
+                size_t got = scanners[s].scan(src, len, dst);
+                if (got != want || memcmp(dst, expected, want) != 0) {
+                    fprintf(stderr, "%s, length %zu: run of %zu, expected %zu\n", scanners[s].name, len, got, want);
+                    ++failures;
+                }
+            }
+            free(dst);
+            free(expected);
+            free(src);
+        }
+    }
+    int s;
+    for (s = 0; s < numScanners; ++s) {
+        if (!scanners[s].supported) {
+            printf("test_scan: %s not supported by this CPU, skipped\n", scanners[s].name);
+        }
+    }
+    if (failures > 0) {
+        fprintf(stderr, "test_scan: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_scan: ok\n");
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include "../libwfd.c"
+
+/**
+ * Queries answered from the index kept in a store must match the ones
+ * answered from a term index built over the same files, and the closest
+ * files by direct comparison under every metric. A truncated or
+ * corrupt store must be rejected by openStore rather than read out of bounds.
+ **/
+#define NUM_FILES 40
+#define TOP_K 5
+
+/**
+ * Run every query against a corpus, from the given index or the store's.
+ **/
+QueryJob runJob(WFDStore* store, TermIndex* index, WFDNode** queries, unsigned numQueries) {
+    QueryJob job;
+    job.index = index;
+    job.store = store;
+    job.files = store->files;
+    job.numFiles = store->numFiles;
+    job.queries = queries;
+    job.numQueries = numQueries;
+    job.topK = TOP_K;
+    job.byTotal = store->byTotal;
+    job.results = malloc(sizeof(QueryMatch*) * numQueries);
+    job.numResults = malloc(sizeof(unsigned) * numQueries);
+    job.nextQuery = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    computeQueries(&job);
+    pthread_mutex_destroy(&job.lock);
+    return job;
+}
+
+void freeJob(QueryJob* job) {
+    unsigned q;
+    for (q = 0; q < job->numQueries; ++q) {
+        free(job->results[q]);
+    }
+    free(job->results);
+    free(job->numResults);
+}
+
+/**
+ * Write size bytes of data to path and try to open it as a store.
+ * Returns 1 if the store was accepted.
+ **/
+int tryStore(const char* path, const char* data, size_t size, WFDNode** queries, unsigned numQueries) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fwrite(data, 1, size, out);
+    fclose(out);
+    WFDStore* store = openStore(path);
+    if (store == NULL) {
+        return 0;
+    }
+    // Whatever got through must still be safe to query
+    QueryJob job = runJob(store, NULL, queries, numQueries);
+    freeJob(&job);
+    closeStore(store);
+    return 1;
+}
+
+int main() {
+    char* alphabet = initializeAlphabet();
+    char dir[] = "/tmp/wfdtestXXXXXX";
+    if (alphabet == NULL || mkdtemp(dir) == NULL) {
+        perror("setup");
+        return 1;
+    }
+    static const char* words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta",
+        "iota", "kappa", "lambda", "mu" };
+    WFDNode* wfds[NUM_FILES];
+    char path[64];
+    srand(3);
+    int f;
+    for (f = 0; f < NUM_FILES; ++f) {
+        snprintf(path, sizeof(path), "%s/f%02d.txt", dir, f);
+        FILE* out = fopen(path, "w");
+        if (out == NULL) {
+            perror(path);
+            return 1;
+        }
+        // One empty file, and files drawing from vocabularies of different sizes
+        int w, length = f == NUM_FILES / 2 ? 0 : 3 + (f % 5) * 4;
+        for (w = 0; w < length; ++w) {
+            fprintf(out, "%s ", words[(f + rand() % (1 + f % 8)) % 12]);
+        }
+        fclose(out);
+        wfds[f] = createFileWFD(strdup(path), alphabet);
+    }
+    char storePath[64];
+    snprintf(storePath, sizeof(storePath), "%s/corpus.store", dir);
+    if (writeStore(storePath, wfds, NUM_FILES) != 0) {
+        return 1;
+    }
+    WFDStore* store = openStore(storePath);
+    if (store == NULL || store->numFiles != NUM_FILES) {
+        fprintf(stderr, "test_store: cannot reopen the store\n");
+        return 1;
+    }
+
+    int failures = 0;
+    for (f = 0; f < NUM_FILES; ++f) {
+        if (store->files[f]->sumSquares != wfds[f]->sumSquares
+                || store->files[f]->totalFreq != wfds[f]->totalFreq) {
+            fprintf(stderr, "file %d: totals differ once stored\n", f);
+            ++failures;
+        }
+    }
+    TermIndex* index = buildTermIndex(store->files, store->numFiles);
+    QueryJob fromIndex = runJob(store, index, wfds, NUM_FILES);
+    QueryJob fromStore = runJob(store, NULL, wfds, NUM_FILES);
+    unsigned q, k;
+    for (q = 0; q < NUM_FILES; ++q) {
+        if (fromStore.numResults[q] != fromIndex.numResults[q]) {
+            fprintf(stderr, "query %u: %u matches from the store, %u from the index\n", q,
+                fromStore.numResults[q], fromIndex.numResults[q]);
+            ++failures;
+            continue;
+        }
+        for (k = 0; k < fromStore.numResults[q]; ++k) {
+            QueryMatch* a = &fromStore.results[q][k];
+            QueryMatch* b = &fromIndex.results[q][k];
+            if (a->file != b->file || a->score != b->score) {
+                fprintf(stderr, "query %u, match %u: file %u (%f) from the store, %u (%f) from the index\n",
+                    q, k, a->file, a->score, b->file, b->score);
+                ++failures;
+                break;
+            }
+        }
+    }
+    freeJob(&fromIndex);
+    freeJob(&fromStore);
+    freeTermIndex(index);
+
+    // Under every metric, the matches are the closest files by a direct
+    // comparison, also for a query sharing no word with the corpus
+    WFDNode* queries[NUM_FILES + 1];
+    memcpy(queries, wfds, sizeof(wfds));
+    snprintf(path, sizeof(path), "%s/unrelated.txt", dir);
+    FILE* out = fopen(path, "w");
+    fprintf(out, "omega omega psi\n");
+    fclose(out);
+    queries[NUM_FILES] = createFileWFD(strdup(path), alphabet);
+    QueryMatch all[NUM_FILES];
+    int metric;
+    for (metric = METRIC_JSD; metric <= METRIC_HELLINGER; ++metric) {
+        pairMetric = metric;
+        QueryJob job = runJob(store, NULL, queries, NUM_FILES + 1);
+        for (q = 0; q <= NUM_FILES; ++q) {
+            for (k = 0; k < NUM_FILES; ++k) {
+                all[k].file = k;
+                all[k].score = metricPair(queries[q], store->files[k]);
+            }
+            qsort(all, NUM_FILES, sizeof(QueryMatch), compareMatches);
+            for (k = 0; k < job.numResults[q]; ++k) {
+                QueryMatch* m = &job.results[q][k];
+                // Rounding may swap near ties. Exact ties go by corpus position,
+                // except that JSD and Hellinger take untouched files by total
+                int byTotal = metric == METRIC_JSD || metric == METRIC_HELLINGER;
+                if (fabs(m->score - all[k].score) > 1e-9
+                        || fabs(m->score - metricPair(queries[q], store->files[m->file])) > 1e-9
+                        || (m->file != all[k].file && m->score == all[k].score && (!byTotal
+                            || store->files[m->file]->totalFreq == store->files[all[k].file]->totalFreq))) {
+                    fprintf(stderr, "metric %d, query %u, match %u: file %u (%f), expected %u (%f)\n",
+                        metric, q, k, m->file, m->score, all[k].file, all[k].score);
+                    ++failures;
+                    break;
+                }
+            }
+        }
+        freeJob(&job);
+    }
+    pairMetric = METRIC_JSD;
+    freeWFD(queries[NUM_FILES]);
+
+    // Every truncation of the store is rejected
+    size_t size = store->size;
+    char* data = malloc(size);
+    memcpy(data, store->map, size);
+    closeStore(store);
+    int savedErr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+    char badPath[64];
+    snprintf(badPath, sizeof(badPath), "%s/bad.store", dir);
+    size_t length;
+    unsigned truncated = 0;
+    for (length = 0; length < size; ++length) {
+        truncated += tryStore(badPath, data, length, wfds, NUM_FILES);
+    }
+
+    // So is every record table that points outside the file, out of order or off alignment
+    uint64_t* offsets = (uint64_t*) (data + STORE_HEADER);
+    uint64_t* header = (uint64_t*) (data + 8);
+    static const uint64_t bad[] = { 0, 1, 8, 20, UINT64_MAX, UINT64_MAX - 7, (uint64_t) 1 << 62 };
+    unsigned accepted = 0, i, j;
+    for (j = 0; j < sizeof(bad) / sizeof(bad[0]); ++j) {
+        for (i = 0; i < 2; ++i) {
+            uint64_t saved = header[i];
+            header[i] = bad[j] + (i == 0 ? 0 : size);
+            accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+            header[i] = saved;
+        }
+        for (i = 0; i < NUM_FILES; i += 7) {
+            uint64_t saved = offsets[i];
+            offsets[i] = bad[j];
+            accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+            offsets[i] = saved;
+        }
+    }
+    // or whose records claim more terms or a longer name than fit
+    for (i = 1; i < NUM_FILES; i += 7) {
+        StoreRecord* rec = (StoreRecord*) (data + offsets[i]);
+        StoreRecord saved = *rec;
+        rec->numTerms = UINT32_MAX;
+        accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+        *rec = saved;
+        rec->nameLen += 4096;
+        accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+        *rec = saved;
+    }
+    // or whose index claims more than the file holds
+    StoreIndex* storeIndex = (StoreIndex*) (data + header[1]);
+    uint64_t* fields = (uint64_t*) storeIndex;
+    for (i = 0; i < 4; ++i) {
+        uint64_t saved = fields[i];
+        fields[i] = saved * 2 + 1024;
+        accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+        fields[i] = UINT64_MAX;
+        accepted += tryStore(badPath, data, size, wfds, NUM_FILES);
+        fields[i] = saved;
+    }
+
+    // An index whose entries point astray still opens, and its queries stay in bounds
+    uint64_t numBuckets = storeIndex->numBuckets;
+    unsigned* byTotal = (unsigned*) (storeIndex + 1);
+    StoreTerm* terms = (StoreTerm*) ((char*) byTotal + sizeof(uint32_t) * (NUM_FILES + NUM_FILES % 2)
+        + sizeof(uint64_t) * (numBuckets + 1));
+    unsigned* postingFiles = (unsigned*) ((char*) (terms + storeIndex->numTerms)
+        + sizeof(double) * storeIndex->numPostings);
+    for (i = 0; i < storeIndex->numTerms; ++i) {
+        terms[i].start += i % 3 == 0 ? storeIndex->numPostings : 0;
+        terms[i].size += i % 3 == 1 ? 1000 : 0;
+        terms[i].term += i % 3 == 2 ? storeIndex->poolSize : 0;
+    }
+    for (i = 0; i < NUM_FILES; i += 3) {
+        byTotal[i] = UINT32_MAX - i;
+    }
+    for (i = 0; i < storeIndex->numPostings; i += 5) {
+        postingFiles[i] = NUM_FILES + i;
+    }
+    unsigned astray = tryStore(badPath, data, size, wfds, NUM_FILES);
+    dup2(savedErr, 2);
+    close(savedErr);
+    close(devNull);
+
+    if (truncated > 0) {
+        fprintf(stderr, "%u truncated stores were accepted\n", truncated);
+        ++failures;
+    }
+    if (accepted > 0) {
+        fprintf(stderr, "%u corrupt stores were accepted\n", accepted);
+        ++failures;
+    }
+    if (!astray) {
+        fprintf(stderr, "a store with stray index entries was rejected\n");
+        ++failures;
+    }
+
+    free(data);
+    for (f = 0; f < NUM_FILES; ++f) {
+        freeWFD(wfds[f]);
+    }
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    free(alphabet);
+    if (failures > 0) {
+        fprintf(stderr, "test_store: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_store: ok\n");
+    return 0;
+}
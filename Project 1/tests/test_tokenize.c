@@ -0,0 +1,99 @@
+#include "../libwfd.c"
+
+/**
+ * Parallel tokenization must count exactly what tokenize() does, whatever
+ * the number of chunks, including for files that do not end in whitespace.
+ **/
+int failures = 0;
+
+void writeFile(const char* path, const char* text) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fputs(text, f);
+    fclose(f);
+}
+
+WFDNode* tokenizeWith(const char* path, char* alphabet, int threads) {
+    splitThreshold = threads > 0 ? 1 : (size_t) -1;
+    splitThreads = threads;
+    WFDNode* wfd = createFileWFD(strdup(path), alphabet);
+    if (wfd == NULL) {
+        fprintf(stderr, "%s could not be tokenized\n", path);
+        exit(1);
+    }
+    return wfd;
+}
+
+void checkFile(const char* path, char* alphabet) {
+    int n;
+    for (n = 1; n <= 3; n += 2) {
+        ngramSize = n;
+        WFDNode* sequential = tokenizeWith(path, alphabet, 0);
+        int threads;
+        for (threads = 2; threads <= 9; ++threads) {
+            WFDNode* parallel = tokenizeWith(path, alphabet, threads);
+            double score = metricPair(sequential, parallel);
+            if (parallel->wordCount != sequential->wordCount || score != 0) {
+                fprintf(stderr, "%s -n %d, %d chunks: %d words (expected %d), score %f\n",
+                    path, n, threads, parallel->wordCount, sequential->wordCount, score);
+                ++failures;
+            }
+            freeWFD(parallel);
+        }
+        freeWFD(sequential);
+    }
+    ngramSize = 1;
+}
+
+int main() {
+    char* alphabet = initializeAlphabet();
+    char dir[] = "/tmp/wfdtestXXXXXX";
+    if (alphabet == NULL || mkdtemp(dir) == NULL) {
+        perror("setup");
+        return 1;
+    }
+    char path[64];
+
+    // No trailing newline, so the chunk reaching the end holds a pending word
+    snprintf(path, sizeof(path), "%s/short.txt", dir);
+    writeFile(path, "the quick brown fox jumps over the lazy dog and then sleeps");
+    checkFile(path, alphabet);
+
+    // One long last word pulls an early chunk's end out to the end of the file
+    snprintf(path, sizeof(path), "%s/tail.txt", dir);
+    writeFile(path, "a b c d Supercalifragilisticexpialidocious-and-then-some-more-letters");
+    checkFile(path, alphabet);
+
+    // Random words, with and without a trailing newline
+    srand(1);
+    char text[8192];
+    int trailing;
+    for (trailing = 0; trailing < 2; ++trailing) {
+        size_t len = 0;
+        while (len < sizeof(text) - 32) {
+            int w = 1 + rand() % 9;
+            while (w-- > 0) {
+                text[len++] = "abcdeXYZ09'!"[rand() % 12];
+            }
+            text[len++] = " \n\t"[rand() % 3];
+        }
+        text[trailing ? len : len - 1] = '\0';
+        snprintf(path, sizeof(path), "%s/random%d.txt", dir, trailing);
+        writeFile(path, text);
+        checkFile(path, alphabet);
+    }
+
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    free(alphabet);
+    if (failures > 0) {
+        fprintf(stderr, "test_tokenize: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_tokenize: ok\n");
+    return 0;
+}
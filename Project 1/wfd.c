@@ -6,6 +6,16 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "libwfd.h"
 
 #ifndef POSSIBLE_CHARS
 #define POSSIBLE_CHARS 37
@@ -18,30 +28,44 @@ typedef struct TrieNode {
     int endOfWord; // signals end of word (0 not end of word, 1 end of word)
 } TrieNode;
 
-typedef struct CombinedTrieNode {
-    struct CombinedTrieNode* child[POSSIBLE_CHARS];
-    unsigned countA;
-    unsigned countB;
-    double frequencyA;
-    double frequencyB;
-    double avgFreq;
-    int endOfWord; // signals end of word (0 not end of word, 1 end of word)
-} CombinedTrieNode;
-
 typedef struct WFDNode {
     struct TrieNode *trieRoot;
     char* filename;
     int wordCount;
+    // Frozen distribution: terms in lexicographic order, NUL-terminated in termPool
+    char* termPool;
+    unsigned* termOffsets;
+    unsigned* counts;
+    double* freqs;
+    unsigned numTerms;
+    double totalFreq;   // sum of freqs, the KLD of the file against an empty partner
+    double sumSquares;  // sum of squared freqs, for the cosine metric
+    int mapped;         // arrays and filename live in a mapped WFD store (1) or are owned (0)
+    struct DedupEntry* dedup;   // duplicate path: identity of the copy it shares
+    struct WFDNode* canon;      // duplicate path: WFD whose arrays it borrows
+    unsigned id;                // position among the distinct WFDs of a run
+    unsigned index;             // position in the WFD registry
     struct WFDNode *next;
 } WFDNode;
 
-typedef struct JSDNode {
-    WFDNode* fileA;
-    WFDNode* fileB;
-    double JSD;
-    int combinedWC;
-    struct JSDNode* next;
-} JSDNode;
+/**
+ * Results of an all-pairs run as parallel arrays in one allocation.
+ * Pair k is the k-th pair (a, b), a < b, of files in row-major order; fileA and
+ * fileB hold its 32-bit indices into files, score its JSD (or -m metric), and
+ * order is filled by sortPairResults with the output order.
+ **/
+typedef struct PairResults {
+    WFDNode** files;
+    unsigned numFiles;
+    size_t numPairs;
+    unsigned* fileA;
+    unsigned* fileB;
+    unsigned* combinedWC;
+    unsigned* order;
+    double* score;
+} PairResults;
+
+void initializeValidChars();
 
 /**
  * Initialize the trie alphabet for mapping (saves memory)
@@ -54,6 +78,7 @@ char* initializeAlphabet() {
     
     int i;
     alphabet[0] = '-';
+    initializeValidChars();
 
     for (i = 1; i < 11; ++i) {
         alphabet[i] = (char) (i + 47);
@@ -187,255 +212,998 @@ void freeTrie(TrieNode* ptr) {
 }
 
 /**
- * Initialize the Combined Trie Node
- **/
-CombinedTrieNode* initializeCombinedTrie(char* alphabet) {
-    CombinedTrieNode* node = malloc (sizeof(CombinedTrieNode));
+ * Initialize WFDNode
+ **/ 
+WFDNode* initializeWFD(TrieNode** root, char* filename, int wordCount) {
+    WFDNode* node = malloc (sizeof(WFDNode));
     if (node == NULL) {
         fprintf(stderr, "Memory could not be allocated\n");
         return NULL;
     }
-    node->endOfWord = 0;
-    node->countA = 0;
-    node->countB = 0;
-    node->frequencyA = 0;
-    node->frequencyB = 0;
-    node->avgFreq = 0;
+    node->trieRoot = *root;
+    node->filename = filename;
+    node->wordCount = wordCount;
+    node->termPool = NULL;
+    node->termOffsets = NULL;
+    node->counts = NULL;
+    node->freqs = NULL;
+    node->numTerms = 0;
+    node->totalFreq = 0;
+    node->sumSquares = 0;
+    node->mapped = 0;
+    node->dedup = NULL;
+    node->canon = NULL;
+    node->id = 0;
+    node->index = 0;
+    node->next = NULL;
+    return node;
+}
+
+/**
+ * Insert a WFD Node into list
+ **/
+WFDNode* insertWFD(WFDNode* head, WFDNode* new_node) {
+    if (new_node != NULL) {
+        new_node->next = head;
+    }
+    head = new_node;
+    return head;
+}
+
+/**
+ * Used to check if char in word is a valid character.
+ **/
+int checkRegex(char* letter) {
+    regex_t regex;
+    int val;
+
+    val = regcomp(&regex, "[[:alnum:]|\\-]", 0);
+    if (val) {
+        fprintf(stderr, "Regex could not be compiled.\n");
+        exit(1);
+    }
+
+    val = regexec(&regex, letter, 0, NULL, 0);
+    regfree(&regex);
+
+    if (val == 0) { return 1; }
+
+    return 0;
+}
+
+/**
+ * Valid word characters, filled from checkRegex() once by initializeAlphabet().
+ **/
+static char validChars[256];
+
+/**
+ * Scanner for runs of word bytes, chosen for the CPU by initializeValidChars().
+ **/
+static RunScanner scanRun = scanRunScalar;
+
+/**
+ * Build the valid character table so the tokenizer does not compile a regex per byte.
+ **/
+void initializeValidChars() {
+    int c;
+    validChars[0] = 0;
+    for (c = 1; c < 256; ++c) {
+        char tempStr[2];
+        tempStr[0] = (char) c;
+        tempStr[1] = '\0';
+        validChars[c] = (char) checkRegex(tempStr);
+    }
+    scanRun = chooseRunScanner();
+}
+
+/**
+ * N-gram mode (-n): with ngramSize > 1 the terms of a distribution are the
+ * shingles of ngramSize consecutive words. Each shingle is identified by a
+ * rolling hash of its words' hashes; the words themselves are never joined.
+ **/
+#define MAX_NGRAM 5
+#define SHINGLE_KEY_LEN 13      // 64-bit shingle hash in base 32
+#define SHINGLE_BASE 0x9e3779b97f4a7c15ull
+
+int ngramSize = 1;
+
+/**
+ * Shingle counts of one input: an open-addressing table keyed by shingle hash,
+ * kept at most half full. A slot with count 0 is empty.
+ **/
+typedef struct Shingle {
+    uint64_t hash;
+    unsigned count;
+} Shingle;
+
+typedef struct ShingleTable {
+    Shingle* slots;
+    size_t size;
+    size_t capacity;
+} ShingleTable;
+
+/**
+ * Tokenizer state carried between buffers of one input.
+ **/
+typedef struct TokenState {
+    char* stash;
+    int word_len;
+    int capacity;
+    int prevWS;
+    int wordCount;
+    unsigned* buckets;  // feature-hashing mode: word counts per bucket instead of the trie
+    ShingleTable* shingles;  // n-gram mode without buckets: shingle counts instead of the trie
+    uint64_t window[MAX_NGRAM]; // n-gram mode: hashes of the last ngramSize words
+    int filled;         // words seen so far; past 2 * ngramSize it steps back by ngramSize
+    uint64_t gram;      // rolling hash of the words in window
+    uint64_t top;       // SHINGLE_BASE^ngramSize, to drop the oldest word
+    int absorb;         // 1 while reading context before a chunk: words fill the window only
+} TokenState;
 
+/**
+ * Initialize tokenizer state. prevWS is 1 for a chunk that starts right after whitespace.
+ **/
+int initializeTokenState(TokenState* state, int prevWS) {
+    state->capacity = 64;
+    state->stash = malloc(sizeof(char) * state->capacity);
+    if (state->stash == NULL) {
+        return -1;
+    }
+    state->word_len = 0;
+    state->prevWS = prevWS;
+    state->wordCount = 0;
+    state->buckets = NULL;
+    state->shingles = NULL;
+    state->filled = 0;
+    state->gram = 0;
+    state->top = 1;
     int i;
+    for (i = 0; i < ngramSize; ++i) {
+        state->top *= SHINGLE_BASE;
+    }
+    state->absorb = 0;
+    return 0;
+}
 
-    for (i = 0; i < POSSIBLE_CHARS; ++i) {
-        node->child[i] = NULL;
+/**
+ * Feature-hashing mode (-b): with hashBits > 0 every word is counted in one of
+ * 2^hashBits buckets by its hash instead of being stored in the trie, so a
+ * WFD takes the same memory whatever its vocabulary.
+ **/
+int hashBits = 0;
+
+/**
+ * FNV-1a hash of a word of len bytes (len <= 0 is the empty word).
+ **/
+unsigned hashWord(const char* word, int len) {
+    unsigned h = 2166136261u;
+    int i;
+    for (i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char) word[i]) * 16777619u;
     }
-    return node;
+    return h;
 }
 
 /**
- * Insert trie values into combined trie
+ * 64-bit FNV-1a hash of a word, for shingles.
  **/
-void insertCombinedTrie(CombinedTrieNode** c_root, TrieNode** trieRoot, char** alphabet, char* word, const int word_len, int charCounter, const int file_type) {
-    if (*c_root == NULL) {
-        *c_root = initializeCombinedTrie(*alphabet);
+uint64_t hashWord64(const char* word, int len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    int i;
+    for (i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char) word[i]) * 0x100000001b3ull;
     }
+    return h;
+}
 
-    if (charCounter < word_len) {
-        // Look up in alphabet
-        int index = lookupIndex(*word, *alphabet);
-        insertCombinedTrie(&((*c_root)->child[index]), trieRoot, alphabet, word + 1, word_len, charCounter+1, file_type);
+/**
+ * Add count occurrences of a shingle to a table, doubling it when half full.
+ **/
+void addShingle(ShingleTable* table, uint64_t hash, unsigned count) {
+    if (2 * (table->size + 1) > table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 1024;
+        Shingle* slots = calloc(capacity, sizeof(Shingle));
+        if (slots == NULL) {
+            fprintf(stderr, "Memory could not be allocated\n");
+            exit(1);
+        }
+        size_t k;
+        for (k = 0; k < table->capacity; ++k) {
+            if (table->slots[k].count > 0) {
+                size_t s = table->slots[k].hash & (capacity - 1);
+                while (slots[s].count > 0) {
+                    s = (s + 1) & (capacity - 1);
+                }
+                slots[s] = table->slots[k];
+            }
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+    size_t s = hash & (table->capacity - 1);
+    while (table->slots[s].count > 0 && table->slots[s].hash != hash) {
+        s = (s + 1) & (table->capacity - 1);
+    }
+    if (table->slots[s].count == 0) {
+        table->slots[s].hash = hash;
+        ++table->size;
+    }
+    table->slots[s].count += count;
+}
+
+/**
+ * Count a shingle hash.
+ **/
+void emitShingle(TokenState* state, uint64_t gram) {
+    if (state->buckets != NULL) {
+        ++state->buckets[gram & ((1u << hashBits) - 1)];
     } else {
-        if ( (*c_root)->endOfWord) {
-            if (file_type == 0) {
-                (*c_root)->countA = (*trieRoot)->count;
-                (*c_root)->frequencyA = (*trieRoot)->frequency;
-            } else if (file_type == 1) {
-                (*c_root)->countB = (*trieRoot)->count;
-                (*c_root)->frequencyB = (*trieRoot)->frequency;
+        addShingle(state->shingles, gram, 1);
+    }
+    ++state->wordCount;
+}
+
+/**
+ * Count the word held in the stash, len bytes long. In n-gram mode the word
+ * is rolled into the window: gram = sum of h(word_i) * B^(n-1-i), so adding a
+ * word and dropping the oldest is gram * B + h(new) - h(oldest) * B^n.
+ **/
+void emitWord(TokenState* state, char** alphabet, TrieNode** root, int len) {
+    if (ngramSize > 1) {
+        uint64_t h = hashWord64(state->stash, len);
+        int slot = state->filled % ngramSize;
+        uint64_t oldest = state->filled >= ngramSize ? state->window[slot] : 0;
+        state->gram = state->gram * SHINGLE_BASE + h - oldest * state->top;
+        state->window[slot] = h;
+        ++state->filled;
+        if (state->filled >= 2 * ngramSize) {
+            state->filled -= ngramSize;     // keeps the slot order, avoids overflow
+        }
+        if (state->filled >= ngramSize && !state->absorb) {
+            emitShingle(state, state->gram);
+        }
+        return;
+    }
+    if (state->buckets != NULL) {
+        ++state->buckets[hashWord(state->stash, len) & ((1u << hashBits) - 1)];
+    } else {
+        insert(root, alphabet, &state->stash[0], len, 0);
+    }
+    ++state->wordCount;
+}
+
+/**
+  * Push word to data structure when whitespace is hit
+  * Regex out non-alphanumeric/hyphens
+  * Runs of ASCII letters and digits are copied into the stash by scanRun, so
+  * only the bytes between them are looked at one at a time.
+  **/
+int tokenizeBuffer(TokenState* state, const char* buf, size_t bytes, char** alphabet, TrieNode** root) {
+    size_t buf_position = 0;
+    while (buf_position < bytes) {
+        if (state->word_len == state->capacity) {
+            char *p = realloc(state->stash, sizeof(char) * state->capacity * 2);
+            if (!p) return -1;
+            state->stash = p;
+            state->capacity *= 2;
+        }
+        size_t room = state->capacity - state->word_len;
+        size_t limit = bytes - buf_position < room ? bytes - buf_position : room;
+        size_t run = scanRun((const unsigned char*) buf + buf_position, limit, state->stash + state->word_len);
+        if (run > 0) {
+            state->word_len += run;
+            state->prevWS = 0;
+            buf_position += run;
+            if (run == limit) {
+                continue;
+            }
+        }
+
+        unsigned char c = (unsigned char) buf[buf_position++];
+        if (isspace(c)) {   // Check for whitespace
+            if (state->prevWS == 0) {
+                emitWord(state, alphabet, root, state->word_len);
             }
+            state->word_len = 0;
+            state->prevWS = 1;
         } else {
-            (*c_root)->endOfWord = 1;
-            if (file_type == 0) {
-                (*c_root)->countA = (*trieRoot)->count;
-                (*c_root)->frequencyA = (*trieRoot)->frequency;
-            } else if (file_type == 1) {
-                (*c_root)->countB = (*trieRoot)->count;
-                (*c_root)->frequencyB = (*trieRoot)->frequency;
-            }            
+            if (validChars[c]) {
+                state->stash[state->word_len++] = tolower(c);
+            }
+            state->prevWS = 0;
         }
     }
+    return 0;
 }
 
 /**
- * Merge two tries together
+ * Flush the last word of an input that did not end in whitespace.
+ * As before, the word is inserted without its final character.
  **/
-void trieToCombinedTrie(CombinedTrieNode* c_root, TrieNode* root, char* alphabet, char str[], int level, const int file_type) {
-    if ((root->endOfWord) == 1) {
-        str[level] = '\0';
-        if (file_type == 0) {
-            insertCombinedTrie(&c_root, &root, &alphabet, str, strlen(str), 0, 0);
-        } else if (file_type == 1) {
-            insertCombinedTrie(&c_root, &root, &alphabet, str, strlen(str), 0, 1);      
+void tokenizeFinish(TokenState* state, char** alphabet, TrieNode** root) {
+    if (state->prevWS == 0) {
+        emitWord(state, alphabet, root, state->word_len-1);
+    }
+}
+
+/**
+ * Compressed inputs are decompressed while they are read, chosen by their
+ * magic bytes rather than their names. The decompressed bytes go straight
+ * to the tokenizer through one input and one output buffer per file.
+ **/
+#define STREAM_BUFFER 65536
+
+enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+};
+
+/**
+ * Compression of a file, from its first bytes.
+ **/
+int detectCompression(int input_fd) {
+    unsigned char magic[4];
+    ssize_t bytes = pread(input_fd, magic, sizeof(magic), 0);
+    if (bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return COMPRESSION_GZIP;
+    }
+    if (bytes == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+/**
+ * Length of a compression extension (.gz, .zst) at the end of a name, or 0.
+ **/
+size_t compressionExtension(const char* name) {
+    size_t n = strlen(name);
+    if (n >= 3 && strcmp(name + n - 3, ".gz") == 0) {
+        return 3;
+    }
+    if (n >= 4 && strcmp(name + n - 4, ".zst") == 0) {
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * Checks a path against the -s suffix rule used by traverse(). A compressed
+ * file matches on the name under its compression extension too, so
+ * notes.txt.gz is read under the default suffix .txt.
+ **/
+int suffixMatches(const char* name, const char* suffix) {
+    size_t n = strlen(name);
+    size_t s = strlen(suffix);
+    if (n >= s && strcmp(name + n - s, suffix) == 0) {
+        return 1;
+    }
+    size_t c = compressionExtension(name);
+    return c > 0 && n - c >= s && strncmp(name + n - c - s, suffix, s) == 0;
+}
+
+/**
+ * Stream a plain file into the tokenizer. Returns 1 if it had any bytes,
+ * 0 if it was empty, or -1.
+ **/
+int readPlain(int input_fd, TokenState* state, char** alphabet, TrieNode** root) {
+    int bytes;
+    char buf[4096];
+    int notEmpty = 0;
+
+    while ((bytes = read(input_fd, buf, sizeof(buf))) > 0) {
+        notEmpty = 1;
+        if (tokenizeBuffer(state, buf, bytes, alphabet, root) == -1) {
+            return -1;
         }
     }
+    if (bytes < 0) {
+        perror("Read error");
+        return -1;
+    }
+    return notEmpty;
+}
 
-    int i;
-    for (i = 0; i < POSSIBLE_CHARS; ++i) {
-        if (root->child[i]) {
-            // Look up in alphabet
-            char c = lookupChar(i, alphabet);
-            str[level] = c;
-            if (file_type == 0) {
-                trieToCombinedTrie(c_root, root->child[i], alphabet, str, level+1, 0);
-            } else if (file_type == 1) {
-                trieToCombinedTrie(c_root, root->child[i], alphabet, str, level+1, 1);
+/**
+ * Stream a gzip file (any number of members) into the tokenizer.
+ * Returns as readPlain().
+ **/
+int readGzip(int input_fd, TokenState* state, char** alphabet, TrieNode** root) {
+    unsigned char in[STREAM_BUFFER];
+    unsigned char out[STREAM_BUFFER];
+    int notEmpty = 0;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 32) != Z_OK) {
+        return -1;
+    }
+
+    int status = Z_OK;
+    ssize_t bytes;
+    while ((bytes = read(input_fd, in, sizeof(in))) > 0) {
+        z.next_in = in;
+        z.avail_in = bytes;
+        while (z.avail_in > 0) {
+            if (status == Z_STREAM_END) {
+                inflateReset(&z);   // next member
+            }
+            z.next_out = out;
+            z.avail_out = sizeof(out);
+            status = inflate(&z, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+                fprintf(stderr, "Decompression error: %s\n", z.msg ? z.msg : "corrupt input");
+                inflateEnd(&z);
+                return -1;
+            }
+            size_t produced = sizeof(out) - z.avail_out;
+            if (produced > 0) {
+                notEmpty = 1;
+                if (tokenizeBuffer(state, (char*) out, produced, alphabet, root) == -1) {
+                    inflateEnd(&z);
+                    return -1;
+                }
             }
         }
     }
+    inflateEnd(&z);
+    if (bytes < 0) {
+        perror("Read error");
+        return -1;
+    }
+    if (status != Z_STREAM_END) {
+        fprintf(stderr, "Decompression error: truncated input\n");
+        return -1;
+    }
+    return notEmpty;
 }
 
+#ifdef HAVE_ZSTD
 /**
- * Traverses combined trie structure
+ * Stream a zstd file into the tokenizer. Returns as readPlain().
  **/
-void traverseCombinedTrie(CombinedTrieNode* root, char* alphabet, char str[], int level, int combinedWC) {
-    if ((root->endOfWord) == 1) {
-        str[level] = '\0';
-        root->avgFreq = (double) (0.5 * (root->frequencyA + root->frequencyB));
+int readZstd(int input_fd, TokenState* state, char** alphabet, TrieNode** root) {
+    unsigned char in[STREAM_BUFFER];
+    unsigned char out[STREAM_BUFFER];
+    int notEmpty = 0;
+    ZSTD_DStream* z = ZSTD_createDStream();
+    if (z == NULL) {
+        return -1;
+    }
+    ZSTD_initDStream(z);
+
+    size_t status = 0;
+    ssize_t bytes;
+    while ((bytes = read(input_fd, in, sizeof(in))) > 0) {
+        ZSTD_inBuffer input = { in, bytes, 0 };
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output = { out, sizeof(out), 0 };
+            status = ZSTD_decompressStream(z, &output, &input);
+            if (ZSTD_isError(status)) {
+                fprintf(stderr, "Decompression error: %s\n", ZSTD_getErrorName(status));
+                ZSTD_freeDStream(z);
+                return -1;
+            }
+            if (output.pos > 0) {
+                notEmpty = 1;
+                if (tokenizeBuffer(state, (char*) out, output.pos, alphabet, root) == -1) {
+                    ZSTD_freeDStream(z);
+                    return -1;
+                }
+            }
+        }
+    }
+    ZSTD_freeDStream(z);
+    if (bytes < 0) {
+        perror("Read error");
+        return -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "Decompression error: truncated input\n");
+        return -1;
+    }
+    return notEmpty;
+}
+#endif
+
+/**
+ * Tokenize a file descriptor into a trie, or into buckets or shingles if one of
+ * those is not NULL; returns the word (or shingle) count or -1.
+ * Compressed files are decompressed on the fly.
+ **/
+int tokenize(int input_fd, char** alphabet, TrieNode** root, unsigned* buckets, ShingleTable* shingles) {
+    TokenState state;
+
+    if (initializeTokenState(&state, 0) == -1) {
+        return -1;
+    }
+    state.buckets = buckets;
+    state.shingles = shingles;
+
+    int notEmpty;
+    switch (detectCompression(input_fd)) {
+        case COMPRESSION_GZIP:
+            notEmpty = readGzip(input_fd, &state, alphabet, root);
+            break;
+        case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+            notEmpty = readZstd(input_fd, &state, alphabet, root);
+#else
+            fprintf(stderr, "zstd input needs a build with ZSTD=1\n");
+            notEmpty = -1;
+#endif
+            break;
+        default:
+            notEmpty = readPlain(input_fd, &state, alphabet, root);
+            break;
+    }
+
+    if (notEmpty == 1) {
+        tokenizeFinish(&state, alphabet, root);
+    }
+
+    free(state.stash);
+    if (notEmpty == -1) {
+        return -1;
+    }
+
+    return state.wordCount;
+}
+
+/**
+ * Add the words of src into dst and free src.
+ **/
+void mergeTrie(TrieNode* dst, TrieNode* src) {
+    if (src->endOfWord) {
+        if (dst->endOfWord) {
+            dst->count += src->count;
+        } else {
+            dst->endOfWord = 1;
+            dst->count = src->count;
+        }
     }
 
     int i;
     for (i = 0; i < POSSIBLE_CHARS; ++i) {
-        if (root->child[i]) {
-            // Look up in alphabet
-            char c = lookupChar(i, alphabet);
-            str[level] = c;
-            traverseCombinedTrie(root->child[i], alphabet, str, level+1, combinedWC);
+        if (src->child[i] == NULL) {
+            continue;
+        }
+        if (dst->child[i] == NULL) {
+            dst->child[i] = src->child[i];
+        } else {
+            mergeTrie(dst->child[i], src->child[i]);
         }
     }
+    free(src);
 }
 
 /**
- * Frees combinedtrie structure.
+ * Files of at least splitThreshold bytes are tokenized by splitThreads threads
+ * (0: one per online CPU).
  **/
-void freeCombinedTrie(CombinedTrieNode* ptr) {
-    int i;
-    if (!ptr) {
-        return;
+size_t splitThreshold = (size_t) 64 << 20;
+int splitThreads = 0;
+
+typedef struct TokenChunk {
+    const char* lead;       // n-gram mode: the words before the chunk, to fill the window
+    size_t leadLen;
+    int leadWS;
+    const char* data;
+    size_t len;
+    int last;
+    char* alphabet;
+    TrieNode* root;
+    TokenState state;
+    int status;
+} TokenChunk;
+
+/**
+ * Chunk worker: tokenizes one whitespace-aligned slice into its own trie
+ * (or its own buckets or shingles).
+ **/
+void* tokenizeChunk(void* argPtr) {
+    TokenChunk* chunk = argPtr;
+    if (hashBits > 0) {
+        chunk->state.buckets = calloc((size_t) 1 << hashBits, sizeof(unsigned));
+    } else if (ngramSize > 1) {
+        chunk->state.shingles = calloc(1, sizeof(ShingleTable));
+    } else {
+        chunk->root = initializeTrie(chunk->alphabet);
     }
-    for (i = 0; i < POSSIBLE_CHARS; ++i) {
-        freeCombinedTrie(ptr->child[i]);
+    if (chunk->root == NULL && chunk->state.buckets == NULL && chunk->state.shingles == NULL) {
+        chunk->status = -1;
+        return NULL;
     }
-    free(ptr);
+    if (chunk->leadLen > 0) {
+        int prevWS = chunk->state.prevWS;
+        chunk->state.prevWS = chunk->leadWS;
+        chunk->state.absorb = 1;
+        chunk->status = tokenizeBuffer(&chunk->state, chunk->lead, chunk->leadLen, &chunk->alphabet, &chunk->root);
+        chunk->state.absorb = 0;
+        chunk->state.prevWS = prevWS;
+        chunk->state.word_len = 0;
+        if (chunk->status == -1) {
+            return NULL;
+        }
+    }
+    chunk->status = tokenizeBuffer(&chunk->state, chunk->data, chunk->len, &chunk->alphabet, &chunk->root);
+    if (chunk->status == 0 && chunk->last) {
+        tokenizeFinish(&chunk->state, &chunk->alphabet, &chunk->root);
+    }
+    return NULL;
 }
 
 /**
- * Initialize WFDNode
- **/ 
-WFDNode* initializeWFD(TrieNode** root, char* filename, int wordCount) {
-    WFDNode* node = malloc (sizeof(WFDNode));
-    if (node == NULL) {
+ * Tokenize a large regular file in parallel.
+ * Each chunk but the first starts just after a whitespace byte, which is
+ * exactly the state the sequential tokenizer is in at that point, so the
+ * merged counts match tokenize(). In n-gram mode a chunk first reads the
+ * ngramSize - 1 words before it without counting them, so its window holds
+ * what the sequential tokenizer's would. A chunk that is pushed to the end of
+ * the file is the last one, and flushes the file's final word. Returns the
+ * word count, -1 on error, or -2 if the file could not be mapped.
+ **/
+int tokenizeParallel(int input_fd, size_t size, char* alphabet, TrieNode** root, unsigned* buckets, ShingleTable* shingles) {
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    if (data == MAP_FAILED) {
+        return -2;
+    }
+    madvise((void*) data, size, MADV_SEQUENTIAL);
+
+    int numChunks = splitThreads > 0 ? splitThreads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (numChunks < 1) {
+        numChunks = 1;
+    }
+    TokenChunk* chunks = malloc(sizeof(TokenChunk) * numChunks);
+    pthread_t* tids = malloc(sizeof(pthread_t) * numChunks);
+    if (!chunks || !tids) {
         fprintf(stderr, "Memory could not be allocated\n");
-        return NULL;
+        exit(1);
     }
-    node->trieRoot = *root;
-    node->filename = filename;
-    node->wordCount = wordCount;
-    node->next = NULL;
-    return node;
+
+    size_t start = 0;
+    int k;
+    for (k = 0; k < numChunks; ++k) {
+        size_t end = (k == numChunks - 1) ? size : (size / numChunks) * (k + 1);
+        if (end < start) {
+            end = start;
+        }
+        while (end < size && end > 0 && !isspace((unsigned char) data[end - 1])) {
+            ++end;
+        }
+        size_t lead = start;
+        int w;
+        for (w = 1; w < ngramSize && lead > 0; ++w) {
+            while (lead > 0 && isspace((unsigned char) data[lead - 1])) {
+                --lead;
+            }
+            while (lead > 0 && !isspace((unsigned char) data[lead - 1])) {
+                --lead;
+            }
+        }
+        chunks[k].lead = data + lead;
+        chunks[k].leadLen = start - lead;
+        chunks[k].leadWS = lead > 0;
+        chunks[k].data = data + start;
+        chunks[k].len = end - start;
+        chunks[k].last = (end == size);
+        chunks[k].alphabet = alphabet;
+        chunks[k].root = NULL;
+        chunks[k].status = initializeTokenState(&chunks[k].state, k == 0 ? 0 : 1);
+        if (chunks[k].status == -1) {
+            fprintf(stderr, "Memory could not be allocated\n");
+            exit(1);
+        }
+        pthread_create(&tids[k], NULL, tokenizeChunk, &chunks[k]);
+        start = end;
+        if (end == size) {
+            // A chunk pushed to the end of the file holds its last word
+            numChunks = k + 1;
+        }
+    }
+
+    int wordCount = 0;
+    for (k = 0; k < numChunks; ++k) {
+        pthread_join(tids[k], NULL);
+        if (chunks[k].status == -1
+                || (chunks[k].root == NULL && chunks[k].state.buckets == NULL && chunks[k].state.shingles == NULL)) {
+            wordCount = -1;
+        } else if (wordCount != -1) {
+            wordCount += chunks[k].state.wordCount;
+        }
+        if (chunks[k].root != NULL) {
+            mergeTrie(*root, chunks[k].root);
+        }
+        if (chunks[k].state.buckets != NULL) {
+            size_t b;
+            for (b = 0; b < (size_t) 1 << hashBits; ++b) {
+                buckets[b] += chunks[k].state.buckets[b];
+            }
+            free(chunks[k].state.buckets);
+        }
+        ShingleTable* table = chunks[k].state.shingles;
+        if (table != NULL) {
+            size_t s;
+            for (s = 0; s < table->capacity; ++s) {
+                if (table->slots[s].count > 0) {
+                    addShingle(shingles, table->slots[s].hash, table->slots[s].count);
+                }
+            }
+            free(table->slots);
+            free(table);
+        }
+        free(chunks[k].state.stash);
+    }
+
+    munmap((void*) data, size);
+    free(chunks);
+    free(tids);
+    return wordCount;
 }
 
 /**
- * Insert a WFD Node into list
+ * Count the words and the pool bytes (incl. terminators) held by a trie.
  **/
-WFDNode* insertWFD(WFDNode* head, WFDNode* new_node) {
-    if (new_node != NULL) {
-        new_node->next = head;
+void measureTrie(TrieNode* root, int level, unsigned* numTerms, size_t* poolSize, int* maxLevel) {
+    if (root->endOfWord == 1) {
+        ++(*numTerms);
+        *poolSize += level + 1;
+    }
+    if (level > *maxLevel) {
+        *maxLevel = level;
+    }
+
+    int i;
+    for (i = 0; i < POSSIBLE_CHARS; ++i) {
+        if (root->child[i]) {
+            measureTrie(root->child[i], level+1, numTerms, poolSize, maxLevel);
+        }
     }
-    head = new_node;
-    return head;
 }
 
 /**
- * Used to check if char in word is a valid character.
+ * Copy the words of a trie into the flat WFD arrays (in lexicographic order).
  **/
-int checkRegex(char* letter) {
-    regex_t regex;
-    int val;
+void fillTerms(TrieNode* root, char* alphabet, char str[], int level, WFDNode* wfd, unsigned* term, size_t* poolPos) {
+    if (root->endOfWord == 1) {
+        wfd->termOffsets[*term] = *poolPos;
+        memcpy(wfd->termPool + *poolPos, str, level);
+        wfd->termPool[*poolPos + level] = '\0';
+        *poolPos += level + 1;
+
+        wfd->counts[*term] = root->count;
+        if (wfd->wordCount == 0) {
+            wfd->freqs[*term] = (double) 0;
+        } else {
+            wfd->freqs[*term] = (double) (root->count) / (double) wfd->wordCount;
+        }
+        wfd->totalFreq += wfd->freqs[*term];
+        wfd->sumSquares += wfd->freqs[*term] * wfd->freqs[*term];
+        ++(*term);
+    }
 
-    val = regcomp(&regex, "[[:alnum:]|\\-]", 0);
-    if (val) {
-        fprintf(stderr, "Regex could not be compiled.\n");
-        exit(1);
+    int i;
+    for (i = 0; i < POSSIBLE_CHARS; ++i) {
+        if (root->child[i]) {
+            str[level] = lookupChar(i, alphabet);
+            fillTerms(root->child[i], alphabet, str, level+1, wfd, term, poolPos);
+        }
     }
+}
 
-    val = regexec(&regex, letter, 0, NULL, 0);
-    regfree(&regex);
+/**
+ * Freeze a WFD: flatten its trie into sorted term arrays and release the trie.
+ **/
+int freezeWFD(WFDNode* wfd, char* alphabet) {
+    unsigned numTerms = 0;
+    size_t poolSize = 0;
+    int maxLevel = 0;
+    measureTrie(wfd->trieRoot, 0, &numTerms, &poolSize, &maxLevel);
+
+    wfd->termPool = malloc(poolSize > 0 ? poolSize : 1);
+    wfd->termOffsets = malloc(sizeof(unsigned) * (numTerms > 0 ? numTerms : 1));
+    wfd->counts = malloc(sizeof(unsigned) * (numTerms > 0 ? numTerms : 1));
+    wfd->freqs = malloc(sizeof(double) * (numTerms > 0 ? numTerms : 1));
+    char* str = malloc(maxLevel + 1);
+    if (!wfd->termPool || !wfd->termOffsets || !wfd->counts || !wfd->freqs || !str) {
+        fprintf(stderr, "Memory could not be allocated\n");
+        free(str);
+        return -1;
+    }
 
-    if (val == 0) { return 1; }
+    unsigned term = 0;
+    size_t poolPos = 0;
+    wfd->totalFreq = 0;
+    wfd->sumSquares = 0;
+    fillTerms(wfd->trieRoot, alphabet, str, 0, wfd, &term, &poolPos);
+    wfd->numTerms = numTerms;
+    free(str);
 
+    freeTrie(wfd->trieRoot);
+    wfd->trieRoot = NULL;
     return 0;
 }
 
 /**
-  * Push word to data structure when whitespace is hit
-  * Regex out non-alphanumeric/hyphens
-  **/
-int tokenize(int input_fd, char** alphabet, TrieNode** root) {
+ * Freeze a feature-hashed WFD: its counts are the dense buckets and it has no
+ * term strings (termPool is NULL, numTerms is the number of buckets).
+ **/
+int freezeHashedWFD(WFDNode* wfd, unsigned* buckets) {
+    unsigned numBuckets = 1u << hashBits;
+    wfd->counts = buckets;
+    wfd->freqs = malloc(sizeof(double) * numBuckets);
+    if (!wfd->freqs) {
+        fprintf(stderr, "Memory could not be allocated\n");
+        return -1;
+    }
+    wfd->numTerms = numBuckets;
+    wfd->totalFreq = 0;
+    wfd->sumSquares = 0;
+    unsigned b;
+    for (b = 0; b < numBuckets; ++b) {
+        wfd->freqs[b] = wfd->wordCount == 0 ? 0 : (double) buckets[b] / (double) wfd->wordCount;
+        wfd->totalFreq += wfd->freqs[b];
+        wfd->sumSquares += wfd->freqs[b] * wfd->freqs[b];
+    }
+    return 0;
+}
 
-    int bytes, word_len = 0;
-    char buf[100];
-    char *stash;
-    int prevWS = 0;
-    int wordCount = 0;
-    int notEmpty = 0;
+/**
+ * Orders shingles by hash.
+ **/
+int compareShingles(const void* x, const void* y) {
+    uint64_t a = ((const Shingle*) x)->hash;
+    uint64_t b = ((const Shingle*) y)->hash;
+    return (a > b) - (a < b);
+}
 
-    stash = malloc(sizeof(char));
-    if (stash == NULL) {
+/**
+ * Freeze an n-gram WFD: sort the distinct shingles by hash. Each one becomes
+ * a term spelled as SHINGLE_KEY_LEN base-32 digits, most significant first,
+ * so the terms sort like the hashes and work wherever words do.
+ **/
+int freezeShingleWFD(WFDNode* wfd, ShingleTable* shingles) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuv";
+    unsigned numTerms = 0;
+    size_t k;
+    for (k = 0; k < shingles->capacity; ++k) {
+        if (shingles->slots[k].count > 0) {
+            shingles->slots[numTerms++] = shingles->slots[k];
+        }
+    }
+    if (numTerms > 0) {
+        qsort(shingles->slots, numTerms, sizeof(Shingle), compareShingles);
+    }
+
+    wfd->termPool = malloc((size_t) (SHINGLE_KEY_LEN + 1) * (numTerms > 0 ? numTerms : 1));
+    wfd->termOffsets = malloc(sizeof(unsigned) * (numTerms > 0 ? numTerms : 1));
+    wfd->counts = malloc(sizeof(unsigned) * (numTerms > 0 ? numTerms : 1));
+    wfd->freqs = malloc(sizeof(double) * (numTerms > 0 ? numTerms : 1));
+    if (!wfd->termPool || !wfd->termOffsets || !wfd->counts || !wfd->freqs) {
+        fprintf(stderr, "Memory could not be allocated\n");
         return -1;
     }
 
-    while ((bytes = read(input_fd, buf, 100)) > 0) {
-        notEmpty = 1;
-        int i;
-        int buf_position = 0;
-
-        for (i = word_len; buf_position < bytes; ++i) {
-            ++word_len;
-            char *p = realloc(stash, sizeof(char) * word_len);
-            if (!p) return 1;
-            stash = p;
-
-            if (isspace(buf[buf_position])) {   // Check for whitespace
-                if (prevWS == 0) {
-                    insert(root, alphabet, &stash[0], word_len-1, 0);
-                    ++wordCount;
-                }
-                memset(stash, 0, sizeof(char) * word_len); 
-                word_len = 0;
-                i = word_len-1;
-                prevWS = 1;
-            } else {
-                // Check regex char
-                int validChar;
-
-                char tempStr[2];
-                tempStr[0] = buf[buf_position];
-                tempStr[1] = '\0';
-                validChar = checkRegex(tempStr);
-
-                if (validChar == 1) {
-                    stash[i] = tolower(buf[buf_position]);
-                } else {
-                    --word_len;
-                    --i;
-                }
-                prevWS = 0;
-            }
-            ++buf_position;
+    unsigned term;
+    wfd->totalFreq = 0;
+    wfd->sumSquares = 0;
+    for (term = 0; term < numTerms; ++term) {
+        uint64_t hash = shingles->slots[term].hash;
+        unsigned count = shingles->slots[term].count;
+        char* key = wfd->termPool + (size_t) (SHINGLE_KEY_LEN + 1) * term;
+        int d;
+        for (d = 0; d < SHINGLE_KEY_LEN; ++d) {
+            key[d] = digits[(hash >> (5 * (SHINGLE_KEY_LEN - 1 - d))) & 31];
         }
+        key[SHINGLE_KEY_LEN] = '\0';
+        wfd->termOffsets[term] = (SHINGLE_KEY_LEN + 1) * term;
+        wfd->counts[term] = count;
+        wfd->freqs[term] = (double) count / (double) wfd->wordCount;
+        wfd->totalFreq += wfd->freqs[term];
+        wfd->sumSquares += wfd->freqs[term] * wfd->freqs[term];
     }
+    wfd->numTerms = numTerms;
 
-    if (notEmpty == 1) {
-        if (prevWS == 0) { 
-            insert(root, alphabet, &stash[0], word_len-1, 0);
-            ++wordCount;
+    free(shingles->slots);
+    shingles->slots = NULL;
+    return 0;
+}
+
+/**
+ * Counts of one input while it is tokenized: a trie, or buckets (-b), or
+ * shingles (-n) when neither of the others is used.
+ **/
+typedef struct TermCounts {
+    TrieNode* root;
+    unsigned* buckets;
+    ShingleTable shingles;
+} TermCounts;
+
+void initializeTermCounts(TermCounts* tc, char* alphabet) {
+    tc->root = NULL;
+    tc->buckets = NULL;
+    tc->shingles.slots = NULL;
+    tc->shingles.size = 0;
+    tc->shingles.capacity = 0;
+    if (hashBits > 0) {
+        tc->buckets = calloc((size_t) 1 << hashBits, sizeof(unsigned));
+        if (tc->buckets == NULL) {
+            fprintf(stderr, "Memory could not be allocated\n");
+            exit(1);
         }
+    } else if (ngramSize == 1) {
+        tc->root = initializeTrie(alphabet);
     }
+}
+
+/**
+ * Shingle table to count into, or NULL unless shingles are counted.
+ **/
+ShingleTable* shingleList(TermCounts* tc) {
+    return (hashBits == 0 && ngramSize > 1) ? &tc->shingles : NULL;
+}
 
-    free(stash);
+void freeTermCounts(TermCounts* tc) {
+    freeTrie(tc->root);
+    free(tc->buckets);
+    free(tc->shingles.slots);
+}
 
-    if (bytes < 0) {
-        perror("Read error");
-        return -1;
+/**
+ * Create a WFD Struct from the counts of an input and freeze it. The WFD
+ * takes filename and the counts.
+ **/
+WFDNode* freezeTermCounts(TermCounts* tc, char* filename, int wordCount, char* alphabet) {
+    WFDNode *wfd = initializeWFD(&tc->root, filename, wordCount);
+    if (wfd == NULL) {
+        exit(1);
+    }
+    int frozen;
+    if (tc->buckets) {
+        frozen = freezeHashedWFD(wfd, tc->buckets);
+    } else if (shingleList(tc)) {
+        frozen = freezeShingleWFD(wfd, &tc->shingles);
+    } else {
+        frozen = freezeWFD(wfd, alphabet);
+    }
+    if (frozen == -1) {
+        exit(1);
+    }
+    tc->root = NULL;
+    tc->buckets = NULL;
+    return wfd;
+}
+
+/**
+ * WFD of an open file descriptor, read to its end; NULL if it cannot be read.
+ **/
+WFDNode* createDescriptorWFD(int input_fd, char* filename, char* alphabet) {
+    TermCounts tc;
+    initializeTermCounts(&tc, alphabet);
+
+    int wordCount = -2;
+    struct stat st;
+    if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+            && (size_t) st.st_size >= splitThreshold && splitThreads != 1
+            && detectCompression(input_fd) == COMPRESSION_NONE) {
+        wordCount = tokenizeParallel(input_fd, st.st_size, alphabet, &tc.root, tc.buckets, shingleList(&tc));
+    }
+    if (wordCount == -2) {
+        wordCount = tokenize(input_fd, &alphabet, &tc.root, tc.buckets, shingleList(&tc));
     }
 
-    return wordCount;
+    if (wordCount == -1) {
+        freeTermCounts(&tc);
+        return NULL;
+    }
+    return freezeTermCounts(&tc, filename, wordCount, alphabet);
 }
 
 /**
  * WFD Driver
  **/
 WFDNode* createFileWFD(char* filename, char* alphabet) {
-    TrieNode* root = initializeTrie(alphabet);
-
     // Read file name
     int input_fd;
 
@@ -444,22 +1212,8 @@ WFDNode* createFileWFD(char* filename, char* alphabet) {
         perror(filename);
         return NULL; 
     }
-
-    int wordCount = tokenize(input_fd, &alphabet, &root);
-
+    WFDNode *wfd = createDescriptorWFD(input_fd, filename, alphabet);
     close(input_fd);
-
-    if (wordCount == -1) {
-        return NULL;
-    }
-
-    char str[100];
-    int level = 0;
-
-    setFrequency(root, alphabet, str, level, wordCount);
-
-    // Create WFD Struct from Trie
-    WFDNode *wfd = initializeWFD(&root, filename, wordCount);
     return wfd;
 }
 
@@ -483,7 +1237,20 @@ void traverseWFDList(WFDNode* head) {
  * Free individual WFD node.
  **/
 void freeWFD(WFDNode* ptr) {
+    if (ptr->mapped) {
+        free(ptr);
+        return;
+    }
+    if (ptr->canon != NULL || ptr->dedup != NULL) {
+        free(ptr->filename);
+        free(ptr);
+        return;
+    }
     freeTrie(ptr->trieRoot);
+    free(ptr->termPool);
+    free(ptr->termOffsets);
+    free(ptr->counts);
+    free(ptr->freqs);
     free(ptr->filename);
     free(ptr);
 }
@@ -502,166 +1269,194 @@ void freeWFDList(WFDNode* head) {
 }
 
 /**
- * Initialize JSD array struct.
- * Array will be iterated through to create ordered LL once JSDs have been calculated.
+ * Allocate the results of every pair of an array of WFDs and fill in the
+ * pair indices and combined word counts.
  **/
-void initializeJSDArray(JSDNode** jsdPairList, int index, WFDNode* file1, WFDNode* file2) {
-    jsdPairList[index]->fileA = file1;
-    jsdPairList[index]->fileB = file2;
-    jsdPairList[index]->combinedWC = file1->wordCount + file2->wordCount;
-    jsdPairList[index]->JSD = 0;
-    jsdPairList[index]->next = NULL;
+PairResults* createPairResults(WFDNode** files, unsigned numFiles) {
+    size_t numPairs = (size_t) numFiles * (numFiles - 1) / 2;
+    if (numPairs > UINT_MAX) {
+        fprintf(stderr, "Too many files\n");
+        exit(1);
+    }
+    PairResults* results = malloc(sizeof(PairResults));
+    void* block = malloc((sizeof(double) + 4 * sizeof(unsigned)) * (numPairs > 0 ? numPairs : 1));
+    if (results == NULL || block == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    results->files = files;
+    results->numFiles = numFiles;
+    results->numPairs = numPairs;
+    results->score = block;
+    results->fileA = (unsigned*) (results->score + numPairs);
+    results->fileB = results->fileA + numPairs;
+    results->combinedWC = results->fileB + numPairs;
+    results->order = results->combinedWC + numPairs;
+
+    size_t k = 0;
+    unsigned a, b;
+    for (a = 0; a < numFiles; ++a) {
+        for (b = a + 1; b < numFiles; ++b) {
+            results->fileA[k] = a;
+            results->fileB[k] = b;
+            results->combinedWC[k] = files[a]->wordCount + files[b]->wordCount;
+            results->score[k] = 0;
+            ++k;
+        }
+    }
+    return results;
 }
 
 /**
- * Set a JSD node
+ * Output order: descending combined word count; among equal counts the later
+ * pair comes first.
  **/
-JSDNode* setJSD(JSDNode* node, WFDNode* fileA, WFDNode* fileB, double jsd, int combinedWC) {
-    node->fileA = fileA;
-    node->fileB = fileB;
-    node->JSD = jsd;
-    node->combinedWC = combinedWC;
-    node->next = NULL;
-    return node;
+int comparePairOrder(const void* x, const void* y, void* arg) {
+    PairResults* results = arg;
+    unsigned i = *(const unsigned*) x;
+    unsigned j = *(const unsigned*) y;
+    if (results->combinedWC[i] != results->combinedWC[j]) {
+        return results->combinedWC[i] < results->combinedWC[j] ? 1 : -1;
+    }
+    return (i < j) - (i > j);
 }
 
 /**
- * Perform an ordered insertion for a JSDNode (descending order of WC).
+ * Sort the pairs into output order.
  **/
-JSDNode* insertInOrder(JSDNode* head, JSDNode* new_node) {
-    if (head == NULL) { return new_node; }
+void sortPairResults(PairResults* results) {
+    size_t k;
+    for (k = 0; k < results->numPairs; ++k) {
+        results->order[k] = k;
+    }
+    qsort_r(results->order, results->numPairs, sizeof(unsigned), comparePairOrder, results);
+}
 
-    JSDNode* prev = NULL;
-    JSDNode* ptr = head;
-    while (ptr != NULL) {
-        if (prev == NULL) {
-            if (ptr->combinedWC <= new_node->combinedWC) {
-                new_node->next = ptr;
-                return new_node;
-            }
-        } else {
-            if (ptr->combinedWC <= new_node->combinedWC) {
-                new_node->next = ptr;
-                prev->next = new_node;
-                return head;
-            }
+/**
+ * Pass the pairs to a sink in output order, until it returns non-zero.
+ * Returns how many pairs it took.
+ **/
+size_t emitPairResults(PairResults* results, WFDPairSink sink, void* ctx) {
+    size_t k;
+    for (k = 0; k < results->numPairs; ++k) {
+        unsigned p = results->order[k];
+        WFDPair pair;
+        pair.fileA = results->files[results->fileA[p]]->filename;
+        pair.fileB = results->files[results->fileB[p]]->filename;
+        pair.indexA = results->fileA[p];
+        pair.indexB = results->fileB[p];
+        pair.score = results->score[p];
+        if (sink(ctx, &pair) != 0) {
+            return k + 1;
         }
-        prev = ptr;
-        ptr = ptr->next;
     }
-    prev->next = new_node;
-    return head;
+    return k;
 }
 
 /**
- * Traverse the JSD list
+ * Frees the results (the WFDs belong to the registry).
  **/
-void traverseJSDList(JSDNode* head) {
-    JSDNode* ptr;
-    if (head == NULL) {
-        printf("List is empty\n");
-        return;
-    }
-    ptr = head;
-    while (ptr != NULL) {
-        printf("%f %s %s\n", ptr->JSD, ptr->fileA->filename, ptr->fileB->filename);
-        ptr = ptr->next;
-    }
+void freePairResults(PairResults* results) {
+    free(results->score);
+    free(results);
 }
 
 /**
- * KLD Calculation
+ * Find the first term of a file at or after position lo that is not less than word.
+ * Gallops forward from lo, so a sorted sequence of lookups costs O(log gap) each.
  **/
-double* KLD(CombinedTrieNode* root, char str[], int level, const int file_type, double* kld) {
-    if ((root->endOfWord) == 1) {
-        if (file_type == 0) {
-            if (root->frequencyA != 0) {
-                *kld += (root->frequencyA * log2((root->frequencyA)/(root->avgFreq)));
-            }
-        } else if (file_type == 1) {
-            if (root->frequencyB != 0) {
-                *kld += (root->frequencyB * log2((root->frequencyB)/(root->avgFreq)));
-            }
-        }
+unsigned seekTerm(WFDNode* wfd, unsigned lo, const char* word) {
+    unsigned n = wfd->numTerms;
+    unsigned step = 1;
+    unsigned hi = lo;
+    while (hi < n && strcmp(wfd->termPool + wfd->termOffsets[hi], word) < 0) {
+        lo = hi + 1;
+        hi += step;
+        step <<= 1;
     }
-
-    int i;
-    for (i = 0; i < POSSIBLE_CHARS; ++i) {
-        if (root->child[i]) {
-            str[level] = i + '-';
-            KLD(root->child[i], str, level+1, file_type, kld);
+    if (hi > n) {
+        hi = n;
+    }
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (strcmp(wfd->termPool + wfd->termOffsets[mid], word) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    return kld;
+    return lo;
 }
 
 /**
- * JSD Driver
+ * Contribution of a term shared by both files to KLD(A) + KLD(B), relative to
+ * the closed form p * log2(2) = p that each side would add if it were unshared.
  **/
-void createPairJSD(JSDNode* node, char* alphabet, WFDNode* file1, WFDNode* file2) {
-    int level = 0;
-    char str[100];
-    double JSD = 0;
-    double* kldA;
-    double* kldB;
-    //JSDNode* new_node = NULL;
-    CombinedTrieNode* ct = initializeCombinedTrie(alphabet);
-    int combinedWC = node->combinedWC;
-        
-    // Combine WFD tries
-    trieToCombinedTrie(ct, file1->trieRoot, alphabet, str, level, 0);
-    trieToCombinedTrie(ct, file2->trieRoot, alphabet, str, level, 1);
-
-    // Set average frequencies
-    traverseCombinedTrie(ct, alphabet, str, level, combinedWC);
-        
-    // Compute KLDs for JSD Computation
-    kldA = malloc(sizeof(double));
-    if (kldA == NULL) {
-        exit(1);
-    }
-
-    kldB = malloc(sizeof(double));
-    if (kldB == NULL) {
-        exit(1);
-    }
-    *kldA = 0;
-    *kldB = 0;
-    if (combinedWC != 0) {
-        // Calculate frequencies if non-empty files
-        kldA = KLD(ct, str, level, 0, kldA);
-        kldB = KLD(ct, str, level, 1, kldB);
+double sharedTermJSD(double freqA, double freqB) {
+    double sum = freqA + freqB;
+    return freqA * log2((2 * freqA) / sum) + freqB * log2((2 * freqB) / sum) - sum;
+}
 
-        // Compute JSD
-        JSD = sqrt((0.5 * (*kldA)) + (0.5 * (*kldB)));
+/**
+ * Turn the shared-term sum of a pair into its JSD.
+ **/
+double finishJSD(WFDNode* file1, WFDNode* file2, double shared) {
+    double kld = file1->totalFreq + file2->totalFreq + shared;
+    if (kld <= 0) {
+        return 0;
     }
-    node = setJSD(node, file1, file2, JSD, combinedWC);
-        
-    freeCombinedTrie(ct);
-    free(kldA);
-    free(kldB);
+    return sqrt(0.5 * kld);
 }
 
 /**
- * Frees contents of JSD list
+ * Defines name##Pair, the score of two frozen WFDs under a metric split into
+ * a per-term SHARED contribution and a FINISH step. Terms found in only one
+ * file are covered by per-file totals, so only the shared terms are visited:
+ * the walk goes through the smaller vocabulary and seeks into the larger one.
+ * name##DensePair is the same score over two feature-hashed WFDs, whose
+ * buckets line up, so it is a straight loop over both arrays.
  **/
-void freeJSDList(JSDNode* head) {
-    JSDNode* ptr;
-
-   while (head != NULL) {
-       ptr = head;
-       head = head->next;
-       free(ptr);
-    }
+#define DEFINE_METRIC(name, SHARED, FINISH) \
+double name##Pair(WFDNode* file1, WFDNode* file2) { \
+    if (file1->wordCount + file2->wordCount == 0) { \
+        return 0; \
+    } \
+    WFDNode* small = file1; \
+    WFDNode* large = file2; \
+    if (small->numTerms > large->numTerms) { \
+        small = file2; \
+        large = file1; \
+    } \
+    double shared = 0; \
+    unsigned pos = 0; \
+    unsigned i; \
+    for (i = 0; i < small->numTerms && pos < large->numTerms; ++i) { \
+        const char* word = small->termPool + small->termOffsets[i]; \
+        pos = seekTerm(large, pos, word); \
+        if (pos < large->numTerms && strcmp(large->termPool + large->termOffsets[pos], word) == 0) { \
+            shared += SHARED(small->freqs[i], large->freqs[pos]); \
+            ++pos; \
+        } \
+    } \
+    return FINISH(file1, file2, shared); \
+} \
+double name##DensePair(WFDNode* file1, WFDNode* file2) { \
+    if (file1->wordCount + file2->wordCount == 0) { \
+        return 0; \
+    } \
+    const double* freqA = file1->freqs; \
+    const double* freqB = file2->freqs; \
+    double shared = 0; \
+    unsigned i; \
+    for (i = 0; i < file1->numTerms; ++i) { \
+        if (freqA[i] > 0 && freqB[i] > 0) { \
+            shared += SHARED(freqA[i], freqB[i]); \
+        } \
+    } \
+    return FINISH(file1, file2, shared); \
 }
 
 /**
- * Frees contents of array containing JSD structs
+ * JSD of two frozen WFDs: jsdPair.
  **/
-void freeJSDListArray(JSDNode** list, int size) {
-    int i;
-    for (i = 0; i < size; ++i) {
-        free(list[i]);
-    }
-    free(list);
-}
\ No newline at end of file
+DEFINE_METRIC(jsd, sharedTermJSD, finishJSD)
@@ -6,56 +6,574 @@
 #include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-# define HT_SIZE 20
+# define HT_SIZE 16          // initial number of slots, a power of two and at least HT_GROUP
+# define HT_GROUP 16         // slots whose control bytes are probed together
+# define HT_MAX_LOAD_NUM 7   // a table is resized once more than 7/8 of its slots are used
+# define HT_MAX_LOAD_DEN 8
+# define HT_REHASH_STEP 1    // groups moved to the new table per operation
+# define HT_STRIPE_BITS 6    // the table is split into 64 independently locked stripes
+# define HT_RECLAIM_BATCH 64 // retirements in a stripe between attempts to free them
+# define HT_RECLAIM_BYTES (1 << 16) // or retired bytes, tried on every set/del until freed
 
+# define CTRL_EMPTY ((signed char) -128)
+# define CTRL_DELETED ((signed char) -2)
+
+/**
+ * GET takes no lock, so a node or table that SET or DEL unlinks may still be
+ * read by a GET that found it just before. Unlinked objects are retired with
+ * the global epoch of the moment, and freed once the epoch has advanced twice:
+ * the epoch only advances when every GET in progress started in the current
+ * one, so by then none of them can still hold a pointer to the object.
+ **/
+typedef struct Retired {
+    struct Retired *next;
+    uint64_t epoch;
+    size_t bytes;
+    void (*destroy)(struct Retired *);
+} Retired;
+
+/**
+ * Key-value pair. A published node never changes: SET swaps in a new node, so
+ * a GET always sees a whole pair.
+ **/
 typedef struct Node {
+    Retired retired;
     char *key;
-    int key_len;
     char *val;
+    int key_len;
     int val_len;
-    struct Node *next;
 } Node;
 
-typedef struct Hashtable {
-    Node **arr;
+/**
+ * A table slot keeps the hash and length of its key inline, so a probe
+ * rejects most mismatches without following node.
+ **/
+typedef struct Slot {
+    uint64_t hash;
+    int key_len;
+    Node *node;
+} Slot;
+
+/**
+ * Open-addressing table in the Swiss-table layout. Each slot has a control
+ * byte: CTRL_EMPTY, CTRL_DELETED or the low 7 bits of its key's hash. A probe
+ * walks groups of HT_GROUP slots and matches all of a group's control bytes in
+ * one SSE2 compare, so slots are only read for likely hits. Writers publish a
+ * slot by storing its control byte last.
+ **/
+typedef struct Table {
+    Retired retired;
+    signed char *ctrl;
+    Slot *slots;
+    size_t size;    // slots, a power of two
+    size_t used;    // slots full or deleted
+} Table;
+
+/**
+ * Per-thread announcement of the epoch a GET started in.
+ **/
+typedef struct EpochRecord {
+    uint64_t state;     // (epoch << 1) | 1 during a GET, 0 otherwise
+    int in_use;         // owned by a live thread
+    struct EpochRecord *next;
+} __attribute__((aligned(64))) EpochRecord;
+
+/**
+ * One stripe of the hashtable: the keys whose hashes share their top
+ * HT_STRIPE_BITS bits. SET and DEL take the stripe's lock; GET reads it with
+ * atomic loads only. A stripe is rebuilt once more than 7/8 of its slots are
+ * used, at twice the size if over half of them hold keys and at the same size
+ * (to clear deleted slots) otherwise. The rebuild is incremental: the old
+ * table is kept and each set/del moves the next HT_REHASH_STEP groups of it,
+ * so no single request pays for the whole resize. Until old is drained, a key
+ * may be in either table; new keys always go to cur.
+ **/
+typedef struct Stripe {
+    Table *cur;
+    Table *old;             // being drained into cur, or NULL
+    size_t rehash_pos;      // groups of old below this have been moved
+    size_t count;
+    Retired *retired;       // unlinked nodes and tables, newest first
+    size_t num_retired;     // since the last attempt to free them
+    size_t retired_bytes;   // held by retired
     pthread_mutex_t lock;
+} __attribute__((aligned(64))) Stripe;
+
+typedef struct Hashtable {
+    Stripe stripes[1 << HT_STRIPE_BITS];
+    uint64_t seed;
+    uint64_t epoch;
+    EpochRecord *records;   // every thread that has run a GET, pushed only
+    pthread_key_t record_key;
 } Hashtable;
 
 /**
- * Initialize hashtable.
+ * Allocate a table with every slot empty.
  **/
-Hashtable* initialize() {
-    Hashtable *ht;
+Table* allocateTable(size_t size) {
+    Table *t = malloc(sizeof(Table));
+    if (t == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    t->ctrl = malloc(size);
+    t->slots = malloc(sizeof(Slot) * size);
+    if (t->ctrl == NULL || t->slots == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
+    }
+    memset(t->ctrl, CTRL_EMPTY, size);
+    t->size = size;
+    t->used = 0;
+    return t;
+}
 
-    ht = malloc(sizeof(Hashtable));
-    if (ht == NULL) {
+size_t tableBytes(Table *t) {
+    return sizeof(Table) + t->size * (1 + sizeof(Slot));
+}
+
+void destroyTable(Retired *r) {
+    Table *t = (Table *) r;
+    free(t->ctrl);
+    free(t->slots);
+    free(t);
+}
+
+Node* createNode(char *key, int key_len, char *val, int val_len) {
+    Node *n = malloc(sizeof(Node));
+    if (n == NULL) {
         perror("Malloc failed\n");
         exit(1);
     }
-    ht->arr = (Node **)malloc(sizeof(Node) * HT_SIZE);
-    if (ht->arr == NULL) {
+    n->key = key;
+    n->key_len = key_len;
+    n->val = val;
+    n->val_len = val_len;
+    return n;
+}
+
+size_t nodeBytes(Node *n) {
+    return sizeof(Node) + n->key_len + n->val_len;
+}
+
+void destroyNode(Retired *r) {
+    Node *n = (Node *) r;
+    free(n->key);
+    free(n->val);
+    free(n);
+}
+
+/**
+ * Hand a thread's epoch record back when the thread exits.
+ **/
+void releaseRecord(void *record) {
+    EpochRecord *rec = record;
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hash seed, so keys that collide cannot be chosen ahead of time.
+ **/
+uint64_t randomSeed() {
+    uint64_t seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1 || read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+        seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    return seed;
+}
+
+/**
+ * Initialize hashtable.
+ **/
+Hashtable* initialize() {
+    Hashtable* ht = NULL;
+    if (posix_memalign((void **)&ht, 64, sizeof(Hashtable)) != 0) {
         perror("Malloc failed\n");
         exit(1);
     }
-    memset(ht->arr, 0 , HT_SIZE * sizeof(Node));
-    pthread_mutex_init(&ht->lock, NULL);
+    int i;
+    for (i = 0; i < 1 << HT_STRIPE_BITS; ++i) {
+        Stripe *stripe = &ht->stripes[i];
+        stripe->cur = allocateTable(HT_SIZE);
+        stripe->old = NULL;
+        stripe->rehash_pos = 0;
+        stripe->count = 0;
+        stripe->retired = NULL;
+        stripe->num_retired = 0;
+        stripe->retired_bytes = 0;
+        pthread_mutex_init(&stripe->lock, NULL);
+    }
+    ht->seed = randomSeed();
+    ht->epoch = 0;
+    ht->records = NULL;
+    pthread_key_create(&ht->record_key, releaseRecord);
 
     return ht;
 }
 
 /**
- * Hash function used for mapping.
+ * The calling thread's epoch record, claimed from a thread that has exited or
+ * else added to the list.
+ **/
+EpochRecord* epochRecord(Hashtable *ht) {
+    EpochRecord *rec = pthread_getspecific(ht->record_key);
+    if (rec != NULL) {
+        return rec;
+    }
+    for (rec = __atomic_load_n(&ht->records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        int in_use = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &in_use, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (rec == NULL) {
+        if (posix_memalign((void **)&rec, 64, sizeof(EpochRecord)) != 0) {
+            perror("Malloc failed\n");
+            exit(1);
+        }
+        rec->state = 0;
+        rec->in_use = 1;
+        rec->next = __atomic_load_n(&ht->records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&ht->records, &rec->next, rec, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(ht->record_key, rec);
+    return rec;
+}
+
+/**
+ * Start a GET: announce the current epoch before reading any table. The
+ * announcement is a seq_cst exchange rather than a store and a fence, so no
+ * table read moves ahead of it and TSan sees the ordering too.
+ **/
+EpochRecord* epochEnter(Hashtable *ht) {
+    EpochRecord *rec = epochRecord(ht);
+    uint64_t epoch = __atomic_load_n(&ht->epoch, __ATOMIC_SEQ_CST);
+    __atomic_exchange_n(&rec->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+    return rec;
+}
+
+void epochExit(EpochRecord *rec) {
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Advance the epoch if every GET in progress started in the current one, and
+ * return the epoch.
+ **/
+uint64_t epochAdvance(Hashtable *ht) {
+    uint64_t epoch = __atomic_load_n(&ht->epoch, __ATOMIC_SEQ_CST);
+    EpochRecord *rec;
+    for (rec = __atomic_load_n(&ht->records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        uint64_t state = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    if (__atomic_compare_exchange_n(&ht->epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        ++epoch;
+    }
+    return epoch;
+}
+
+/**
+ * Free the objects a stripe retired at least two epochs ago. Called with the
+ * stripe's lock held.
+ **/
+void reclaim(Hashtable *ht, Stripe *stripe) {
+    uint64_t epoch = epochAdvance(ht);
+    Retired **link = &stripe->retired;
+    stripe->num_retired = 0;
+    while (*link != NULL && (*link)->epoch + 2 > epoch) {
+        link = &(*link)->next;
+    }
+    Retired *r = *link;
+    *link = NULL;
+    while (r != NULL) {
+        Retired *next = r->next;
+        stripe->retired_bytes -= r->bytes;
+        r->destroy(r);
+        r = next;
+    }
+}
+
+/**
+ * Try to free a stripe's retired objects once there are many of them, or
+ * they hold many bytes. A retired object is only freed two epochs later, so
+ * while the bytes stay high this is tried again on every set and del: a
+ * stripe that only grows retires few objects, but they are whole tables.
+ * Called with the stripe's lock held.
+ **/
+void reclaimIfDue(Hashtable *ht, Stripe *stripe) {
+    if (stripe->num_retired >= HT_RECLAIM_BATCH || stripe->retired_bytes >= HT_RECLAIM_BYTES) {
+        reclaim(ht, stripe);
+    }
+}
+
+/**
+ * Free an object of the given size once no GET can hold it anymore; it must
+ * already be unreachable from the stripe's tables. Called with the stripe's
+ * lock held.
+ **/
+void retire(Hashtable *ht, Stripe *stripe, Retired *r, size_t bytes, void (*destroy)(Retired *)) {
+    // A seq_cst read-modify-write, so the unlinking store above is ordered before it
+    r->epoch = __atomic_fetch_add(&ht->epoch, 0, __ATOMIC_SEQ_CST);
+    r->bytes = bytes;
+    r->destroy = destroy;
+    r->next = stripe->retired;
+    stripe->retired = r;
+    ++stripe->num_retired;
+    stripe->retired_bytes += bytes;
+    reclaimIfDue(ht, stripe);
+}
+
+/**
+ * High and low halves of a 128-bit product, folded together.
+ **/
+uint64_t hashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+    uint64_t product = a * b;
+    return product ^ (product >> 32) ^ ((a >> 32) * (b >> 32));
+#endif
+}
+
+uint64_t readWord(const char *bytes, int len) {
+    uint64_t word = 0;
+    memcpy(&word, bytes, len);
+    return word;
+}
+
+/**
+ * Hash function used for mapping: a seeded multiply-fold hash over 16 bytes at
+ * a time. The top bits choose the stripe, the middle bits the first group
+ * probed and the low 7 bits are kept in the control byte.
  **/
-int hashFunction(char *key, int key_len) {
-    int hashNum;
-    hashNum = 0;
+uint64_t hashFunction(uint64_t seed, char *key, int key_len) {
+    const uint64_t p0 = 0xa0761d6478bd642full;
+    const uint64_t p1 = 0xe7037ed1a0b428dbull;
+    uint64_t hashNum = seed ^ p0;
+    int i = 0;
+    for (; i + 16 <= key_len; i += 16) {
+        hashNum = hashMix(readWord(key + i, 8) ^ p1, readWord(key + i + 8, 8) ^ hashNum);
+    }
+    uint64_t a = 0, b = 0;
+    if (key_len - i > 8) {
+        a = readWord(key + i, 8);
+        b = readWord(key + i + 8, key_len - i - 8);
+    } else {
+        a = readWord(key + i, key_len - i);
+    }
+    hashNum = hashMix(a ^ p1, b ^ hashNum);
+    return hashMix(hashNum ^ p0, (uint64_t) key_len ^ p1);
+}
+
+/**
+ * Bit mask of the control bytes of a group equal to b. The bytes are read as
+ * two atomic words, so a concurrent writer's byte stores are seen whole.
+ **/
+unsigned groupMatch(const signed char *ctrl, signed char b) {
+#ifdef __SSE2__
+    uint64_t lo = __atomic_load_n((const uint64_t *) ctrl, __ATOMIC_ACQUIRE);
+    uint64_t hi = __atomic_load_n((const uint64_t *) (ctrl + 8), __ATOMIC_ACQUIRE);
+    __m128i group = _mm_set_epi64x(hi, lo);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+#else
+    unsigned match = 0;
+    int i;
+    for (i = 0; i < HT_GROUP; ++i) {
+        match |= (unsigned) (__atomic_load_n(&ctrl[i], __ATOMIC_ACQUIRE) == b) << i;
+    }
+    return match;
+#endif
+}
 
+/**
+ * Bit mask of the empty or deleted slots of a group (control bytes with the
+ * sign bit set). Only writers look for free slots, so plain loads do.
+ **/
+unsigned groupFree(const signed char *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) ctrl));
+#else
+    unsigned match = 0;
     int i;
-    for (i = 0; i < key_len; ++i) {
-        hashNum = (hashNum + key[i]) % HT_SIZE;
+    for (i = 0; i < HT_GROUP; ++i) {
+        match |= (unsigned) (ctrl[i] < 0) << i;
+    }
+    return match;
+#endif
+}
+
+/**
+ * Find a key in one table and return its node, setting slot to the slot that
+ * holds it. Groups are probed in triangular steps, which visit every group of
+ * a power-of-two table, until one with an empty slot. Safe without the
+ * stripe's lock, inside an epoch.
+ **/
+Node* findNode(Table *t, uint64_t hash, char *key, int key_len, Slot **slot) {
+    size_t mask = t->size / HT_GROUP - 1;
+    size_t group = (hash >> 7) & mask;
+    size_t probe;
+    for (probe = 1; probe <= mask + 1; ++probe) {
+        signed char *ctrl = t->ctrl + group * HT_GROUP;
+        unsigned match = groupMatch(ctrl, hash & 0x7f);
+        while (match != 0) {
+            Slot *s = &t->slots[group * HT_GROUP + __builtin_ctz(match)];
+            if (__atomic_load_n(&s->hash, __ATOMIC_RELAXED) == hash
+                    && __atomic_load_n(&s->key_len, __ATOMIC_RELAXED) == key_len) {
+                Node *n = __atomic_load_n(&s->node, __ATOMIC_ACQUIRE);
+                if (n != NULL && n->key_len == key_len && memcmp(n->key, key, key_len) == 0) {
+                    *slot = s;
+                    return n;
+                }
+            }
+            match &= match - 1;
+        }
+        if (groupMatch(ctrl, CTRL_EMPTY) != 0) {
+            return NULL;
+        }
+        group = (group + probe) & mask;
+    }
+    return NULL;
+}
+
+/**
+ * Put a node in the first free slot on its key's probe sequence, publishing
+ * the slot with its control byte. The key must not be in the table already.
+ **/
+void placeNode(Table *t, uint64_t hash, int key_len, Node *n) {
+    size_t mask = t->size / HT_GROUP - 1;
+    size_t group = (hash >> 7) & mask;
+    size_t probe = 1;
+    unsigned free_slots;
+    while ((free_slots = groupFree(t->ctrl + group * HT_GROUP)) == 0) {
+        group = (group + probe++) & mask;
+    }
+    size_t i = group * HT_GROUP + __builtin_ctz(free_slots);
+    if (t->ctrl[i] == CTRL_EMPTY) {
+        ++t->used;
+    }
+    __atomic_store_n(&t->slots[i].hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->slots[i].key_len, key_len, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->slots[i].node, n, __ATOMIC_RELEASE);
+    __atomic_store_n(&t->ctrl[i], (signed char) (hash & 0x7f), __ATOMIC_RELEASE);
+}
+
+/**
+ * Free a slot. A slot in a group that still has an empty one can be emptied
+ * again, since no probe has gone past that group; otherwise it is marked
+ * deleted so probes keep going.
+ **/
+void removeNode(Table *t, Slot *slot) {
+    size_t i = slot - t->slots;
+    if (groupMatch(t->ctrl + (i & ~(size_t) (HT_GROUP - 1)), CTRL_EMPTY) != 0) {
+        __atomic_store_n(&t->ctrl[i], CTRL_EMPTY, __ATOMIC_RELEASE);
+        --t->used;
+    } else {
+        __atomic_store_n(&t->ctrl[i], CTRL_DELETED, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&slot->node, NULL, __ATOMIC_RELAXED);
+}
+
+/**
+ * Move the next HT_REHASH_STEP groups of a stripe's old table into the new
+ * one, and retire the old table once it is drained. A node is placed in cur
+ * before its old slot is marked deleted, so a GET that searches old first and
+ * then cur finds it in one of them.
+ **/
+void rehashStep(Hashtable *ht, Stripe *stripe) {
+    Table *old = stripe->old;
+    if (old == NULL) {
+        return;
+    }
+    size_t groups = old->size / HT_GROUP;
+    size_t moved;
+    for (moved = 0; moved < HT_REHASH_STEP && stripe->rehash_pos < groups; ++moved) {
+        size_t i;
+        for (i = stripe->rehash_pos * HT_GROUP; i < (stripe->rehash_pos + 1) * HT_GROUP; ++i) {
+            if (old->ctrl[i] >= 0) {
+                placeNode(stripe->cur, old->slots[i].hash, old->slots[i].key_len, old->slots[i].node);
+                __atomic_store_n(&old->ctrl[i], CTRL_DELETED, __ATOMIC_RELEASE);
+            }
+        }
+        ++stripe->rehash_pos;
+    }
+    if (stripe->rehash_pos == groups) {
+        __atomic_store_n(&stripe->old, NULL, __ATOMIC_RELEASE);
+        stripe->rehash_pos = 0;
+        retire(ht, stripe, &old->retired, tableBytes(old), destroyTable);
+    }
+}
+
+/**
+ * Start rebuilding a stripe once it is over its load factor. The keys move
+ * over in later rehash steps; a rebuild still in progress is finished first.
+ **/
+void resizeTable(Hashtable *ht, Stripe *stripe) {
+    Table *cur = stripe->cur;
+    if (cur->used * HT_MAX_LOAD_DEN <= cur->size * HT_MAX_LOAD_NUM) {
+        return;
+    }
+    while (stripe->old != NULL) {
+        rehashStep(ht, stripe);
+    }
+    size_t size = stripe->count * 2 > cur->size ? cur->size * 2 : cur->size;
+    Table *next = allocateTable(size);
+    stripe->rehash_pos = 0;
+    __atomic_store_n(&stripe->old, cur, __ATOMIC_RELEASE);
+    __atomic_store_n(&stripe->cur, next, __ATOMIC_RELEASE);
+}
+
+/**
+ * Find a key in a stripe's new table, then in the old one while it is being
+ * drained; table and slot are set to where it is. Called with the stripe's
+ * lock held.
+ **/
+Node* findKey(Stripe *stripe, uint64_t hash, char *key, int key_len, Table **table, Slot **slot) {
+    Node *n = findNode(stripe->cur, hash, key, key_len, slot);
+    *table = stripe->cur;
+    if (n == NULL && stripe->old != NULL) {
+        n = findNode(stripe->old, hash, key, key_len, slot);
+        *table = stripe->old;
+    }
+    return n;
+}
+
+/**
+ * Find a key without the stripe's lock, inside an epoch. old is searched
+ * before cur, since nodes only move from old to cur. If cur was replaced
+ * during the search a new rebuild began, and the search is repeated.
+ **/
+Node* readKey(Stripe *stripe, uint64_t hash, char *key, int key_len) {
+    while (1) {
+        Table *cur = __atomic_load_n(&stripe->cur, __ATOMIC_ACQUIRE);
+        Table *old = __atomic_load_n(&stripe->old, __ATOMIC_ACQUIRE);
+        Slot *slot;
+        Node *n = NULL;
+        if (old != NULL) {
+            n = findNode(old, hash, key, key_len, &slot);
+        }
+        if (n == NULL) {
+            n = findNode(cur, hash, key, key_len, &slot);
+        }
+        if (n != NULL || __atomic_load_n(&stripe->cur, __ATOMIC_ACQUIRE) == cur) {
+            return n;
+        }
     }
-    return hashNum;
 }
 
 /*int compare(char* a, char* b, int a_len, int b_len) {
@@ -112,30 +630,31 @@ int countDigits(int val_len) {
 }
 
 /**
- * Write value details (incl. length and value) to standard output.
+ * Write a status code (OKG or OKD) with value details (incl. length and value)
+ * in one write.
  **/
-void printValDetails(Node* n, int output_fd) {
-    int output_length = n->val_len + 1;
+void printValDetails(const char* code, char* val, int val_len, int output_fd) {
+    int output_length = val_len + 1;
     int digit_alloc = countDigits(output_length);
-    // Allocates the number of digits, 2 newlines, and length of value to print value
-    int detail_len = digit_alloc + 2 + n->val_len;
+    // Allocates the code, the number of digits, 2 newlines, and length of value to print value
+    int detail_len = 4 + digit_alloc + 2 + val_len;
     char* value_details = malloc(sizeof(char) * detail_len);
     if (value_details == NULL) {
         perror("Malloc failed\n");
         exit(1);
     }
     int i, j;
+    memcpy(value_details, code, 4);
     // Loop i for each digit until digit alloc
-    for (i = digit_alloc-1; i >= 0; --i) {
+    for (i = 4 + digit_alloc - 1; i >= 4; --i) {
         value_details[i] = (output_length % 10) + '0';
         output_length = output_length / 10;
     }
-    //value_details[0] = output_length + '0';
-    value_details[digit_alloc] = '\n';
+    value_details[4 + digit_alloc] = '\n';
 
     j = 0;
-    for (i = digit_alloc + 1; j < n->val_len; ++i) {
-        value_details[i] = n->val[j];
+    for (i = 4 + digit_alloc + 1; j < val_len; ++i) {
+        value_details[i] = val[j];
         ++j;
     }
     value_details[i] = '\n';
@@ -144,173 +663,151 @@ void printValDetails(Node* n, int output_fd) {
 }
 
 /**
- * Handle collisions by appending to hashtable linked list.
+ * Stripe holding a key.
  **/
-void collisionDetector(Hashtable *ht, Node *new_node) {
-    int hashNum = hashFunction(new_node->key, new_node->key_len);
-    Node* ptr = ht->arr[hashNum];
+Stripe* stripeOf(Hashtable *ht, uint64_t hash) {
+    return &ht->stripes[hash >> (64 - HT_STRIPE_BITS)];
+}
 
-    if (ht->arr[hashNum] != NULL) {
-        ptr = ht->arr[hashNum];
-        while (ptr != NULL) {
-            if (strcmp(ptr->key, new_node->key) == 0) {
-                break;
-            }
-            ptr = ptr->next;
-        }
-        if (ptr == NULL) {
-            new_node->next = ht->arr[hashNum];
-            ht->arr[hashNum] = new_node;
-        } else {
-            free(ptr->val);
-            ptr->val = new_node->val;   // copy char
-            free(new_node->val);
-            free(new_node->key);
-            free(new_node);
-        }
-    } else {
-        new_node->next = NULL;
-        ht->arr[hashNum] = new_node;
+/**
+ * Copy of a value, made while its node cannot be freed.
+ **/
+char* copyVal(Node *node, int* val_len) {
+    char* val = malloc(node->val_len + 1);
+    if (val == NULL) {
+        perror("Malloc failed\n");
+        exit(1);
     }
+    memcpy(val, node->val, node->val_len + 1);
+    *val_len = node->val_len;
+    return val;
 }
 
 /**
- * Get value from key.
+ * Get a copy of the value of a key, so the caller can write it to the client
+ * after the node may have been freed; NULL if the key was not found. Takes no
+ * lock.
  **/
-Node* get(Hashtable *ht, char* key, int key_len, int output_fd) {
-    int hashNum;    
-    Node* ptr;
+char* get(Hashtable *ht, char* key, int key_len, int* val_len) {
+    char* val = NULL;
     
     if (ht == NULL) {
         return NULL;
     }
-
-    // Retrieve a hash # based on the properties of the key
-    hashNum = hashFunction(key, key_len);
-    ptr = ht->arr[hashNum];
-    
-    while (ptr != NULL) {
-        if (strcmp(ptr->key, key) == 0) {   // PTR->KEY
-            break;
-        }
-        ptr = ptr->next;
-    }
-    if (ptr == NULL) {  // If key was not found
-        //printKNF(output_fd);
-        return NULL;
+    uint64_t hash = hashFunction(ht->seed, key, key_len);
+    EpochRecord *rec = epochEnter(ht);
+    Node* node = readKey(stripeOf(ht, hash), hash, key, key_len);
+    if (node != NULL) {
+        val = copyVal(node, val_len);
     }
-	//write(output_fd, "OKG\n", 4);
-    //printValDetails(ptr, output_fd);
-    return ptr;
+    epochExit(rec);
+    return val;
 }
 
 /**
- * Set or update a new hashtable element.
+ * Set or update a new hashtable element. The table takes ownership of key and
+ * val.
  **/
-int set(Hashtable *ht, char *key, char *val, int key_len, int val_len, int output_fd) {
-    Node* new_node;
+int set(Hashtable *ht, char *key, char *val, int key_len, int val_len) {
+    Table *table;
+    Slot *slot;
+    Node* node;
 
     if (ht == NULL) {
         return -1;
     }
+    uint64_t hash = hashFunction(ht->seed, key, key_len);
+    Stripe *stripe = stripeOf(ht, hash);
+    Node *new_node = createNode(key, key_len, val, val_len);
+    pthread_mutex_lock(&stripe->lock);
+    rehashStep(ht, stripe);
+    reclaimIfDue(ht, stripe);
 
-    // Check if key exists with get. If so, update. Else? New node.
-    new_node = get(ht, key, key_len, output_fd);
-    if (new_node != NULL) {
-        free(new_node->val);        // free existing value
-        new_node->val = val;
-        new_node->val_len = val_len;
+    // Check if key exists. If so, swap in the new node. Else? New slot.
+    node = findKey(stripe, hash, key, key_len, &table, &slot);
+    if (node != NULL) {
+        __atomic_store_n(&slot->node, new_node, __ATOMIC_RELEASE);
+        retire(ht, stripe, &node->retired, nodeBytes(node), destroyNode);
+        pthread_mutex_unlock(&stripe->lock);
         return 0;
     }
 
-    new_node = malloc(sizeof(Node));
-    if (new_node == NULL) {
-        perror("Malloc failed\n");
-        return -1;
-    }
-    new_node->key = key;        // strdup
-    new_node->key_len = key_len;
-    new_node->val = val;    //strdup
-    new_node->val_len = val_len;
-
-    collisionDetector(ht, new_node);
+    placeNode(stripe->cur, hash, key_len, new_node);
+    ++stripe->count;
+    resizeTable(ht, stripe);
+    pthread_mutex_unlock(&stripe->lock);
 
     return 0;
 }
 
 /**
- * Delete key-value pair and return the last set value.
+ * Delete key-value pair and return a copy of the last set value, which the
+ * caller frees; NULL if the key was not found.
  **/
-void del(Hashtable* ht, char* key, int key_len, int output_fd) {
-    int hashNum;
-    Node** front;
-    Node* ptr;
+char* del(Hashtable* ht, char* key, int key_len, int* val_len) {
+    Table *table;
+    Slot *slot;
+    Node* node;
+    char* val = NULL;
     
     if (ht == NULL) {
-        printKNF(output_fd);
-        return;
+        return NULL;
     }
+    uint64_t hash = hashFunction(ht->seed, key, key_len);
+    Stripe *stripe = stripeOf(ht, hash);
+    pthread_mutex_lock(&stripe->lock);
+    rehashStep(ht, stripe);
+    reclaimIfDue(ht, stripe);
 
-    // Retrieve a hash # based on the properties of the key
-    hashNum = hashFunction(key, key_len);
-    Node* prev;
-    prev = NULL;
-    front = &(ht->arr[hashNum]);
-    ptr = *front;
-
-    if (ptr != NULL && strcmp(ptr->key, key) == 0) {
-        write(output_fd, "OKD\n", 4);
-        printValDetails(ptr, output_fd);
-        *front = ptr->next;
-        free(ptr->key);
-        free(ptr->val);
-        free(ptr);
-        return;
-    } 
-
-    while (ptr != NULL) {
-        if (strcmp(ptr->key, key) == 0) {   // PTR->KEY
-            break;
-        }
-        prev = ptr;
-        ptr = ptr->next;
+    node = findKey(stripe, hash, key, key_len, &table, &slot);
+    if (node != NULL) {
+        val = copyVal(node, val_len);
+        removeNode(table, slot);
+        --stripe->count;
+        retire(ht, stripe, &node->retired, nodeBytes(node), destroyNode);
     }
+    pthread_mutex_unlock(&stripe->lock);
+    return val;
+}
 
-    if (ptr == NULL) {  // If key was not found
-        printKNF(output_fd);
+/**
+ * Free the elements of one table, and the table.
+ **/
+void freeNodes(Table *t) {
+    size_t i;
+    if (t == NULL) {
         return;
     }
-    // Else return key_len and key
-	write(output_fd, "OKD\n", 4);
-    printValDetails(ptr, output_fd);
-    prev->next = ptr->next;
-
-    // Free node from LL
-    free(ptr->key);
-    free(ptr->val);
-    free(ptr);
+    for (i = 0; i < t->size; ++i) {
+        if (t->ctrl[i] >= 0) {
+            destroyNode(&t->slots[i].node->retired);
+        }
+    }
+    destroyTable(&t->retired);
 }
 
 /**
- * Free the elements of the hashtable.
+ * Free the elements of the hashtable. No other thread may be using it.
  **/
 void freeHT(Hashtable *ht) {
-    int i = 0;
-    for (i = 0; i < HT_SIZE; ++i) {
-        if (ht->arr[i] != NULL) {
-            Node* front = ht->arr[i];
-            Node* ptr = front;
-            while (front != NULL) {
-                ptr = front;
-                front = front->next;
-                free(ptr->key);
-                free(ptr->val);
-                free(ptr);
-            }
+    int i;
+    for (i = 0; i < 1 << HT_STRIPE_BITS; ++i) {
+        Stripe *stripe = &ht->stripes[i];
+        freeNodes(stripe->cur);
+        freeNodes(stripe->old);
+        while (stripe->retired != NULL) {
+            Retired *next = stripe->retired->next;
+            stripe->retired->destroy(stripe->retired);
+            stripe->retired = next;
         }
+        pthread_mutex_destroy(&stripe->lock);
+    }
+    while (ht->records != NULL) {
+        EpochRecord *next = ht->records->next;
+        free(ht->records);
+        ht->records = next;
     }
-    pthread_mutex_destroy(&ht->lock);
-    free(ht->arr);
+    pthread_key_delete(ht->record_key);
     free(ht);
 }
 
@@ -9,7 +9,10 @@
 #include <sys/socket.h>
 #include <pthread.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
+#include <limits.h>
 #include "ht.c"
 
 struct arg {
@@ -25,6 +28,30 @@ struct connection {
 };
 int running = 1;
 
+#define INPUT_SIZE 4096	// initial size of a connection's input buffer
+
+enum { STAGE_COMMAND, STAGE_LENGTH, STAGE_PAYLOAD };
+enum { PARSE_MORE, PARSE_REQUEST, PARSE_BAD, PARSE_LEN, PARSE_CLOSE };
+
+/**
+ * Bytes read from a client and not yet handled, and how far the request at
+ * their start has been parsed. A read() may bring any number of requests, or
+ * stop anywhere inside one; offsets are kept from start so the parser picks up
+ * where it left off.
+ **/
+struct input {
+	char *buf;
+	size_t cap;
+	size_t start;	// first byte of the current request
+	size_t end;	// end of the bytes read
+	int stage;
+	size_t cursor;	// next byte of the current request to parse
+	char command;	// 'G', 'S' or 'D'
+	long length;	// of the payload
+	size_t payload;	// offset of the payload from start
+	int newlines;	// seen in the payload so far
+};
+
 int server(char *port, Hashtable *h);
 void *update(void *args);
 
@@ -32,142 +59,153 @@ void handler(int signal){
 	running = 0;
 }
 
+/**
+ * Parse the request at the start of the input as far as it has been read.
+ * Returns PARSE_REQUEST once the whole payload is in, PARSE_MORE if more bytes
+ * are needed, or the error the request already has: a bad command or length
+ * (PARSE_BAD), a second newline before the end of the payload or a length too
+ * large (PARSE_LEN), or a length under 1 (PARSE_CLOSE).
+ **/
+int parse(struct input *in){
+	char *req = in->buf + in->start;
+	size_t avail = in->end - in->start;
+	if (in->stage == STAGE_COMMAND){
+		// Every command is three letters and a newline
+		size_t n = avail < 4 ? avail : 4;
+		if (!(memcmp(req, "GET\n", n) == 0 || memcmp(req, "SET\n", n) == 0 || memcmp(req, "DEL\n", n) == 0)){
+			return PARSE_BAD;
+		}
+		if (n < 4){
+			return PARSE_MORE;
+		}
+		in->command = req[0];
+		in->cursor = 4;
+		in->length = 0;
+		in->stage = STAGE_LENGTH;
+	}
+	if (in->stage == STAGE_LENGTH){
+		while (in->cursor < avail && req[in->cursor] != '\n'){
+			if (!isdigit((unsigned char) req[in->cursor])){
+				return PARSE_BAD;
+			}
+			in->length = in->length * 10 + (req[in->cursor] - '0');
+			if (in->length > INT_MAX){
+				return PARSE_LEN;
+			}
+			in->cursor++;
+		}
+		if (in->cursor == avail){
+			return PARSE_MORE;
+		}
+		if (in->length < 1){
+			return PARSE_CLOSE;
+		}
+		in->cursor++;
+		in->payload = in->cursor;
+		in->newlines = 0;
+		in->stage = STAGE_PAYLOAD;
+	}
+	size_t last = in->payload + in->length - 1;
+	while (in->cursor < avail && in->cursor <= last){
+		if (req[in->cursor] == '\n' && ++in->newlines == 2 && in->cursor != last){
+			return PARSE_LEN;
+		}
+		in->cursor++;
+	}
+	if (in->cursor <= last){
+		return PARSE_MORE;
+	}
+	return PARSE_REQUEST;
+}
+
+/**
+ * Make room to read more of the current request: move it to the front of the
+ * buffer, or grow the buffer (to the whole request once its length is known).
+ **/
+int makeRoom(struct input *in){
+	if (in->end < in->cap){
+		return 0;
+	}
+	if (in->start > 0){
+		memmove(in->buf, in->buf + in->start, in->end - in->start);
+		in->end -= in->start;
+		in->start = 0;
+		return 0;
+	}
+	size_t cap = in->cap * 2;
+	if (in->stage == STAGE_PAYLOAD && in->payload + in->length > cap){
+		cap = in->payload + in->length;
+	}
+	char *buf = realloc(in->buf, cap);
+	if (buf == NULL){
+		return -1;
+	}
+	in->buf = buf;
+	in->cap = cap;
+	return 0;
+}
+
 void *update(void *args){
 	
 	int run = 1;
-	char host[100], port[10];
 	struct arg *argptr = args;
 	struct connection *c = (struct connection *) argptr->con;
 	struct Hashtable *h = (struct Hashtable *) argptr->table;
-	int error;
-	error = getnameinfo((struct sockaddr *) &c->addr, c->addr_len, host, 100, port, 10, NI_NUMERICSERV);
+	struct input in;
+	memset(&in, 0, sizeof(struct input));
+	in.cap = INPUT_SIZE;
+	in.buf = malloc(in.cap);
+	if (in.buf == NULL){
+		write(c->fd, "ERR\nSRV\n", 8);
+		run = 0;
+	}
 	while (run){
-		char *command = malloc(1);
-		if (command == NULL){
-			write(c->fd, "ERR\nSRV\n", 8);
-			run = 0;
-			continue;
-		}
-		char* number = malloc(sizeof(char));
-		if (number == NULL){
-			write(c->fd, "ERR\nSRV\n", 8);
-			run = 0;
-			continue;
-		}
-		int bytes;
-		int i = 0;
-		while ((bytes = read(c->fd, &command[i], 1)) > 0){
-			if (command[i] == '\0'){
-				write(c->fd, "ERR\nBAD\n", 8);
-				free(command); 	
-				free(number);
+		// Handle every request already read before reading again
+		int status = parse(&in);
+		if (status == PARSE_MORE){
+			if (makeRoom(&in) == -1){
+				write(c->fd, "ERR\nSRV\n", 8);
 				run = 0;
-				break;
+				continue;
 			}
-			if (command[i] == '\n'){
-				command[i] = '\0';
-				break;
+			int bytes = read(c->fd, in.buf + in.end, in.cap - in.end);
+			if (bytes <= 0){
+				run = 0;
+				continue;
 			}
-			command = realloc(command, i + 2);
-			i++;
-		}
-		if (run == 0){
+			in.end += bytes;
 			continue;
 		}
-	
-		i = 0;
-		if (!(strcmp(command, "GET") == 0 || strcmp(command, "SET") == 0 || strcmp(command, "DEL") == 0)){ //we had \n here
+		if (status == PARSE_BAD){
 			write(c->fd, "ERR\nBAD\n", 8);
-			free(number);
-			free(command);
 			run = 0;
 			continue;
 		}
-		while ((bytes = read(c->fd, &number[i], 1)) > 0){
-			if (number[i] == '\n'){
-				number[i] = '\0';
-				break;
-			}
-			if (!isdigit(number[i])){
-				write(c->fd, "ERR\nBAD\n", 8);
-				free(number);
-				free(command);
-				run = 0;
-				//continue;
-				break;
-			} 
-			number = realloc(number, i + 2);
-			i++;
-		}
-		if (run == 0){
-			continue;
-		}
-		int length = atoi(number);
-		if (length < 1){
-			free(command);
-			free(number);
+		if (status == PARSE_LEN){
+			write(c->fd, "ERR\nLEN\n", 8);
 			run = 0;
 			continue;
 		}
-		char *message = malloc(sizeof(char) * length + 1); 
-		if (message == NULL){
-			write(c->fd, "ERR\nSRV\n", 8);
+		if (status == PARSE_CLOSE){
 			run = 0;
 			continue;
 		}
-		int x = 0;
-		int early = 0;
-		while (x < length){
-			bytes = read(c->fd, &message[x], 1);
-			if (message[x] == '\n'){
-				early++;
-			}
-			if (early == 2 && x != length - 1){
-				early++;
-				write(c->fd, "ERR\nLEN\n", 8);
-				run = 0;
-				free(message);
-				free(command);
-				free(number);
-				break;
-			}
-			x++;
-		}
-		if (early == 3){
-			continue;
-		}
+
+		char *message = in.buf + in.start + in.payload;
+		int length = in.length;
 		if (message[length - 1] != '\n'){
 			write(c->fd, "ERR\nLEN\n", 8);
 			run = 0;
-			free(message);
-			free(command);
-			free(number);
 			continue;
 		}
-		message[x] = '\0';
-
 		for (int j = 0; j < length; j++){
 			if (message[j] == '\0'){
-				free(message);
 				write(c->fd, "ERR\nBAD\n", 8);
-				free(command);
-				free(number);
 				run = 0;
 				break;
 			}
-			if (j == length - 1 && message[j] != '\n'){
-				free(message);
+			if (j != length - 1 && message[j] == '\n' && in.command != 'S'){
 				write(c->fd, "ERR\nBAD\n", 8);
-				free(command);
-				free(number);
-				run = 0;
-				break;
-			}
-			if (j != length - 1 && message[j] == '\n' && command[0] != 'S'){
-				free(message);
-				write(c->fd, "ERR\nBAD\n", 8);
-				free(command);
-				free(number);
 				run = 0;
 				break;
 			}
@@ -175,7 +213,8 @@ void *update(void *args){
 		if (run == 0){
 			continue;
 		}
-		if (strcmp(command, "GET") == 0){
+		if (in.command == 'G'){
+
 			int mark_get = 0;
 			for (int k = 0; k <= length; ++k){
 				if (message[k] == '\n'){
@@ -189,19 +228,19 @@ void *update(void *args){
 			}
 			key[mark_get] = '\0';
 
-			pthread_mutex_lock(&h->lock);
-			Node *ptr = get(h, key, mark_get, c->fd);
-			if (ptr != NULL){
-				write(c->fd, "OKG\n", 4);
-				printValDetails(ptr, c->fd);
+			// The value is copied out, so no lock is held while writing it
+			int val_len;
+			char *val = get(h, key, mark_get, &val_len);
+			if (val != NULL){
+				printValDetails("OKG\n", val, val_len, c->fd);
+				free(val);
 			}
 			else {
 				printKNF(c->fd);
 			}
-			pthread_mutex_unlock(&h->lock);
 			free(key);	
 		}
-		else if (strcmp(command, "DEL") == 0){
+		else if (in.command == 'D'){
 			int mark_del = 0;
 			for (int p = 0; p <= length; ++p) {
 				if (message[p] == '\n') {
@@ -214,13 +253,20 @@ void *update(void *args){
 				key[p] = message[p];
 			}
 			key[mark_del] = '\0';
-			pthread_mutex_lock(&h->lock);
-			del(h, key, mark_del, c->fd);
-			pthread_mutex_unlock(&h->lock);
+			int val_len;
+			char *val = del(h, key, mark_del, &val_len);
+			if (val != NULL){
+				printValDetails("OKD\n", val, val_len, c->fd);
+				free(val);
+			}
+			else {
+				printKNF(c->fd);
+			}
 			free(key);
 		}
-		else if (strcmp(command, "SET") == 0){
-			int mark;
+		else if (in.command == 'S'){
+			// The payload ends in a newline, so the search always stops
+			int mark = length - 1;
 			for (int j = 0; j <= length; j++){
 				if (message[j] == '\n'){
 					mark = j;
@@ -229,9 +275,6 @@ void *update(void *args){
 			}
 			if (mark == length - 1){
 				write(c->fd, "ERR\nBAD\n", 8);
-				free(message);
-				free(number);
-				free(command);
 				run = 0;
 				continue;
 			}
@@ -245,15 +288,16 @@ void *update(void *args){
 				value[j - (mark + 1)] = message[j];
 			}
 			value[length - (mark + 2)] = '\0';
-			pthread_mutex_lock(&h->lock);
-			set(h, key, value, mark, (length - (mark + 2)), c->fd);
+			set(h, key, value, mark, (length - (mark + 2)));
 			write(c->fd, "OKS\n", 4);
-			pthread_mutex_unlock(&h->lock);
 			
 		}
-		free(message); free(number); free(command);
+		// On to the next request, which may already be in the buffer
+		in.start += in.payload + length;
+		in.stage = STAGE_COMMAND;
 	}
 
+		free(in.buf);
 		close(c->fd);
 		free(argptr->con);
 		free(argptr);
@@ -314,6 +358,10 @@ int server(char *port, Hashtable *h){
 		if (connect->fd == -1){
 			continue;
 		} 
+		// A client may send many requests at once; send each reply without
+		// waiting for the previous one to be acknowledged
+		int nodelay = 1;
+		setsockopt(connect->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 		struct arg *args = malloc(sizeof(struct arg));
 		args->con = connect;
 		args->table = h;
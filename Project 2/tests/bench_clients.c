@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/**
+ * Load generator for a running server: each client thread has its own
+ * connection and sends one request at a time, GET or SET of one of 10000
+ * keys set beforehand, waiting for each reply. Prints the requests per
+ * second of all clients together.
+ * Usage: tests/bench_clients port clients [get-percent] [seconds]
+ **/
+#define BENCH_KEYS 10000
+
+int port;
+int getPercent = 90;
+int stop = 0;
+long total = 0;
+
+int connectServer() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * Read a reply of the given number of lines. Returns -1 if the connection
+ * closed.
+ **/
+int readReply(int fd, int lines) {
+    char buf[4096];
+    int seen = 0;
+    while (seen < lines) {
+        // Acknowledge at once, so the server's next reply is not delayed
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+        int bytes = read(fd, buf, sizeof(buf));
+        if (bytes <= 0) {
+            return -1;
+        }
+        int i;
+        for (i = 0; i < bytes; ++i) {
+            seen += buf[i] == '\n';
+        }
+    }
+    return 0;
+}
+
+void setKey(int fd, int key, unsigned value) {
+    char payload[64], request[96];
+    int payloadLen = snprintf(payload, sizeof(payload), "key%d\nvalue%u\n", key, value);
+    int len = snprintf(request, sizeof(request), "SET\n%d\n%s", payloadLen, payload);
+    if (write(fd, request, len) != len || readReply(fd, 1) != 0) {
+        fprintf(stderr, "SET failed\n");
+        exit(1);
+    }
+}
+
+void *client(void *arg) {
+    unsigned seed = (unsigned) (long) arg * 7919 + 1;
+    int fd = connectServer();
+    long ops = 0;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        int key = rand_r(&seed) % BENCH_KEYS;
+        if (rand_r(&seed) % 100 < getPercent) {
+            char payload[32], request[64];
+            int payloadLen = snprintf(payload, sizeof(payload), "key%d\n", key);
+            int len = snprintf(request, sizeof(request), "GET\n%d\n%s", payloadLen, payload);
+            // OKG, the length and the value
+            if (write(fd, request, len) != len || readReply(fd, 3) != 0) {
+                break;
+            }
+        } else {
+            setKey(fd, key, rand_r(&seed));
+        }
+        ++ops;
+    }
+    __atomic_fetch_add(&total, ops, __ATOMIC_RELAXED);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s port clients [get-percent] [seconds]\n", argv[0]);
+        return 1;
+    }
+    port = atoi(argv[1]);
+    int clients = atoi(argv[2]);
+    if (argc > 3) {
+        getPercent = atoi(argv[3]);
+    }
+    double seconds = argc > 4 ? atof(argv[4]) : 2.0;
+
+    int fd = connectServer();
+    int key;
+    for (key = 0; key < BENCH_KEYS; ++key) {
+        setKey(fd, key, key);
+    }
+    close(fd);
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * clients);
+    if (threads == NULL) {
+        perror("Malloc failed\n");
+        return 1;
+    }
+    long i;
+    for (i = 0; i < clients; ++i) {
+        pthread_create(&threads[i], NULL, client, (void *) i);
+    }
+    struct timespec duration = { (time_t) seconds, (long) ((seconds - (time_t) seconds) * 1e9) };
+    nanosleep(&duration, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < clients; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    printf("%3d clients: %.0f requests/s\n", clients, total / seconds);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Multi-client benchmark: a release build of the server, with 1 to 64 clients
+# each sending one request at a time. A new server is started on a new port
+# for every client count. Usage: tests/bench_clients.sh [get-percent] [port]
+set -e
+GET=${1:-90}
+PORT=${2:-15800}
+DIR=$(mktemp -d /tmp/htbench.XXXXXX)
+cd "$(dirname "$0")/.."
+gcc -O2 -std=c99 -Wvla -Wall -o "$DIR/network" network.c -lm -pthread
+gcc -O2 -std=c99 -Wvla -Wall -o "$DIR/bench_clients" tests/bench_clients.c -pthread
+SERVER=
+trap '[ -n "$SERVER" ] && kill $SERVER; rm -rf "$DIR"' EXIT
+
+echo "$(nproc) CPUs, $GET% GET"
+for clients in 1 2 4 8 16 32 64; do
+    PORT=$((PORT + 1))
+    "$DIR/network" $PORT > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 0.3
+    "$DIR/bench_clients" $PORT $clients $GET
+    kill $SERVER
+    wait $SERVER 2>/dev/null || true
+    SERVER=
+done
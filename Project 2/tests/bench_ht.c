@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../ht.c"
+
+/**
+ * Table throughput as the key count grows: SET of every key into an empty
+ * table, through all of its resizes, then GET of every key. The slowest
+ * SETs show what a resize costs one request: the 99.99th percentile, and the
+ * maximum, which also catches the process being descheduled. Built with -O2
+ * by 'make bench'. Usage: tests/bench_ht [max-keys]
+ **/
+#define LATENCY_BUCKETS 100000  // SET latency histogram, in microseconds
+
+long latency[LATENCY_BUCKETS + 1];
+
+double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int keyOf(char* buf, size_t size, long i) {
+    return snprintf(buf, size, "key%ld", i * 2654435761L % 1000000007L);
+}
+
+int main(int argc, char** argv) {
+    long maxKeys = argc > 1 ? atol(argv[1]) : 10000000;
+    printf("%10s %12s %14s %12s %12s\n", "keys", "SET ns/op", "p99.99 SET us", "max SET us", "GET ns/op");
+    long n;
+    for (n = 1000; n <= maxKeys; n *= 10) {
+        Hashtable* ht = initialize();
+        char key[32];
+        long i;
+        double worst = 0;
+        memset(latency, 0, sizeof(latency));
+        double start = now();
+        for (i = 0; i < n; ++i) {
+            int key_len = keyOf(key, sizeof(key), i);
+            char* val = strdup("value");
+            char* copy = strdup(key);
+            double before = now();
+            set(ht, copy, val, key_len, 5);
+            double took = now() - before;
+            if (took > worst) {
+                worst = took;
+            }
+            long us = (long) (took * 1e6);
+            ++latency[us < LATENCY_BUCKETS ? us : LATENCY_BUCKETS];
+        }
+        double setTime = now() - start;
+        long hits = 0;
+        start = now();
+        for (i = 0; i < n; ++i) {
+            int key_len = keyOf(key, sizeof(key), i);
+            int val_len;
+            char* val = get(ht, key, key_len, &val_len);
+            hits += val != NULL;
+            free(val);
+        }
+        double getTime = now() - start;
+        if (hits != n) {
+            fprintf(stderr, "%ld of %ld keys found\n", hits, n);
+            return 1;
+        }
+        long p9999 = 0;
+        long seen = 0;
+        while (p9999 < LATENCY_BUCKETS && (seen += latency[p9999]) < n - n / 10000) {
+            ++p9999;
+        }
+        printf("%10ld %12.0f %14ld %12.1f %12.0f\n", n, setTime / n * 1e9, p9999 + 1, worst * 1e6, getTime / n * 1e9);
+        fflush(stdout);
+        freeHT(ht);
+    }
+    return 0;
+}
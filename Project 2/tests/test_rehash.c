@@ -0,0 +1,297 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../ht.c"
+
+/**
+ * Lookups, overwrites, deletes and inserts while a stripe is being rebuilt,
+ * so its old and new tables are both live, then many random operations over
+ * every stripe, each checked against a model of what the table should hold,
+ * and the tables left behind by growth are freed rather than kept retired.
+ **/
+#define NUM_KEYS 2048
+#define NUM_OPS 300000
+
+char keys[NUM_KEYS][16];
+int keyLens[NUM_KEYS];
+char* values[NUM_KEYS];     // model: the value of each key, NULL if absent
+int failures = 0;
+
+void expect(int ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "%s\n", what);
+        ++failures;
+    }
+}
+
+void checkKey(Hashtable* ht, int k) {
+    int val_len;
+    char* val = get(ht, keys[k], keyLens[k], &val_len);
+    if ((val == NULL) != (values[k] == NULL)
+            || (val != NULL && (val_len != (int) strlen(values[k]) || memcmp(val, values[k], val_len) != 0))) {
+        fprintf(stderr, "%s is %.*s, expected %s\n", keys[k], val != NULL ? val_len : 6, val != NULL ? val : "absent",
+            values[k] != NULL ? values[k] : "absent");
+        ++failures;
+    }
+    free(val);
+}
+
+void setKey(Hashtable* ht, int k, int version) {
+    char val[32];
+    int val_len = snprintf(val, sizeof(val), "%s=%d", keys[k], version);
+    set(ht, strdup(keys[k]), strdup(val), keyLens[k], val_len);
+    free(values[k]);
+    values[k] = strdup(val);
+}
+
+void delKey(Hashtable* ht, int k) {
+    int val_len;
+    char* val = del(ht, keys[k], keyLens[k], &val_len);
+    expect((val == NULL) == (values[k] == NULL), "del found a different key");
+    if (val != NULL && values[k] != NULL) {
+        expect(val_len == (int) strlen(values[k]) && memcmp(val, values[k], val_len) == 0, "del returned a stale value");
+    }
+    free(val);
+    free(values[k]);
+    values[k] = NULL;
+}
+
+/**
+ * Where a key is: 1 in the old table (group set to its group), 2 in the new
+ * one, 3 in both, 0 in neither.
+ **/
+int whereIs(Hashtable* ht, int k, size_t* group) {
+    uint64_t hash = hashFunction(ht->seed, keys[k], keyLens[k]);
+    Stripe* stripe = stripeOf(ht, hash);
+    Slot* slot;
+    int where = 0;
+    if (stripe->old != NULL && findNode(stripe->old, hash, keys[k], keyLens[k], &slot) != NULL) {
+        *group = (slot - stripe->old->slots) / HT_GROUP;
+        where |= 1;
+    }
+    if (findNode(stripe->cur, hash, keys[k], keyLens[k], &slot) != NULL) {
+        where |= 2;
+    }
+    return where;
+}
+
+/**
+ * A key of the stripe that is still in the old table and will stay there
+ * through the next write's rehash step, or -1.
+ **/
+int keyInOld(Hashtable* ht, Stripe* stripe, int numKeys) {
+    int k;
+    for (k = 0; k < numKeys; ++k) {
+        size_t group;
+        if (values[k] != NULL && whereIs(ht, k, &group) == 1 && group >= stripe->rehash_pos + HT_REHASH_STEP) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+int keyInNew(Hashtable* ht, int numKeys) {
+    int k;
+    for (k = 0; k < numKeys; ++k) {
+        size_t group;
+        if (values[k] != NULL && whereIs(ht, k, &group) == 2) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+size_t liveKeys(int numKeys) {
+    size_t live = 0;
+    int k;
+    for (k = 0; k < numKeys; ++k) {
+        live += values[k] != NULL;
+    }
+    return live;
+}
+
+void testRebuild() {
+    Hashtable* ht = initialize();
+    // Every key lands in one stripe, so it is rebuilt several times over
+    int numKeys = 0;
+    char first[16];
+    int firstLen = snprintf(first, sizeof(first), "key0");
+    Stripe* stripe = stripeOf(ht, hashFunction(ht->seed, first, firstLen));
+    int i;
+    for (i = 0; numKeys < NUM_KEYS; ++i) {
+        int len = snprintf(keys[numKeys], sizeof(keys[numKeys]), "key%d", i);
+        if (stripeOf(ht, hashFunction(ht->seed, keys[numKeys], len)) == stripe) {
+            keyLens[numKeys++] = len;
+        }
+    }
+
+    // Fill until a rebuild starts from a table of at least 8 groups
+    int inserted = 0;
+    while (inserted < NUM_KEYS && (stripe->old == NULL || stripe->old->size < 8 * HT_GROUP)) {
+        setKey(ht, inserted++, 0);
+    }
+    expect(stripe->old != NULL, "no rebuild started");
+    if (stripe->old == NULL) {
+        freeHT(ht);
+        return;
+    }
+
+    // Both tables are live: every key is found wherever it is
+    for (i = 0; i < inserted; ++i) {
+        checkKey(ht, i);
+    }
+
+    // Overwrite a key still in the old table: it is replaced where it is
+    size_t count = stripe->count;
+    int k = keyInOld(ht, stripe, inserted);
+    expect(k >= 0, "no key left in the old table");
+    if (k >= 0) {
+        size_t group;
+        setKey(ht, k, 1);
+        checkKey(ht, k);
+        expect(whereIs(ht, k, &group) == 1, "overwriting a key in the old table duplicated or moved it");
+        expect(stripe->count == count, "overwriting a key changed the count");
+    }
+
+    // Delete a key still in the old table
+    k = keyInOld(ht, stripe, inserted);
+    if (k >= 0) {
+        size_t group;
+        delKey(ht, k);
+        checkKey(ht, k);
+        expect(whereIs(ht, k, &group) == 0, "a deleted key is still in a table");
+        expect(stripe->count == count - 1, "deleting a key left the count");
+    }
+
+    // A new key goes to the new table
+    if (inserted < NUM_KEYS) {
+        size_t group;
+        k = inserted++;
+        setKey(ht, k, 0);
+        checkKey(ht, k);
+        expect(whereIs(ht, k, &group) == 2, "a new key did not go to the new table");
+    }
+
+    // Overwrite and delete keys already moved to the new table
+    k = keyInNew(ht, inserted - 1);
+    expect(k >= 0, "no key moved to the new table yet");
+    if (k >= 0) {
+        size_t group;
+        setKey(ht, k, 2);
+        checkKey(ht, k);
+        expect(whereIs(ht, k, &group) == 2, "overwriting a moved key put it back in the old table");
+        delKey(ht, k);
+        checkKey(ht, k);
+        expect(whereIs(ht, k, &group) == 0, "a deleted moved key is still in a table");
+    }
+    expect(stripe->old != NULL, "the rebuild finished before its states were checked");
+    for (i = 0; i < inserted; ++i) {
+        checkKey(ht, i);
+    }
+
+    // Drain the rebuild with writes, then check everything again
+    while (stripe->old != NULL) {
+        setKey(ht, 0, 3);
+    }
+    for (i = 0; i < inserted; ++i) {
+        checkKey(ht, i);
+    }
+    expect(stripe->count == liveKeys(inserted), "the count does not match the live keys");
+
+    // Keep going through several more rebuilds, some of them with deletes
+    srand(5);
+    for (i = 0; i < NUM_OPS / 10; ++i) {
+        k = rand() % NUM_KEYS;
+        if (rand() % 4 == 0) {
+            delKey(ht, k);
+        } else {
+            setKey(ht, k, i);
+        }
+        if (i % 97 == 0) {
+            checkKey(ht, rand() % NUM_KEYS);
+        }
+    }
+    expect(stripe->count == liveKeys(NUM_KEYS), "the count does not match the live keys");
+    for (i = 0; i < NUM_KEYS; ++i) {
+        checkKey(ht, i);
+        free(values[i]);
+        values[i] = NULL;
+    }
+    freeHT(ht);
+}
+
+/**
+ * Random operations over every stripe, against the model.
+ **/
+void testModel() {
+    Hashtable* ht = initialize();
+    int k;
+    for (k = 0; k < NUM_KEYS; ++k) {
+        keyLens[k] = snprintf(keys[k], sizeof(keys[k]), "key%d", k * 7919);
+    }
+    srand(6);
+    int i;
+    for (i = 0; i < NUM_OPS; ++i) {
+        // The key space shrinks halfway, so deletes leave room for same-size rebuilds
+        k = rand() % (i < NUM_OPS / 2 ? NUM_KEYS : NUM_KEYS / 16);
+        int op = rand() % 3;
+        if (op == 0) {
+            setKey(ht, k, i);
+        } else if (op == 1) {
+            checkKey(ht, k);
+        } else {
+            delKey(ht, k);
+        }
+    }
+    size_t count = 0;
+    int s;
+    for (s = 0; s < 1 << HT_STRIPE_BITS; ++s) {
+        count += ht->stripes[s].count;
+    }
+    expect(count == liveKeys(NUM_KEYS), "the stripe counts do not add up to the live keys");
+    for (k = 0; k < NUM_KEYS; ++k) {
+        checkKey(ht, k);
+        free(values[k]);
+        values[k] = NULL;
+    }
+    freeHT(ht);
+}
+
+/**
+ * Inserts only retire tables, a few per stripe, so they must be freed by
+ * their bytes rather than their number: once a stripe has moved on to its
+ * next table, the one before it is gone.
+ **/
+void testReclaim() {
+    Hashtable* ht = initialize();
+    char key[16], val[16];
+    int i;
+    for (i = 0; i < 200000; ++i) {
+        int len = snprintf(key, sizeof(key), "grow%d", i);
+        snprintf(val, sizeof(val), "%d", i);
+        set(ht, strdup(key), strdup(val), len, strlen(val));
+    }
+    int s;
+    for (s = 0; s < 1 << HT_STRIPE_BITS; ++s) {
+        Stripe* stripe = &ht->stripes[s];
+        size_t bytes = 0, inStripe = 0;
+        Retired* r;
+        for (r = stripe->retired; r != NULL; r = r->next) {
+            bytes += r->bytes;
+            inStripe += r->destroy == destroyTable;
+        }
+        expect(bytes == stripe->retired_bytes, "a stripe miscounts its retired bytes");
+        expect(inStripe <= 1, "a stripe keeps more than one retired table");
+    }
+    freeHT(ht);
+}
+
+int main() {
+    testRebuild();
+    testModel();
+    testReclaim();
+    if (failures > 0) {
+        fprintf(stderr, "test_rehash: %d failures\n", failures);
+        return 1;
+    }
+    printf("test_rehash: ok\n");
+    return 0;
+}
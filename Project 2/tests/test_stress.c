@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../ht.c"
+
+/**
+ * Concurrent GET, SET and DEL while the stripes keep being rebuilt. Stable
+ * keys are only ever overwritten, so every GET must find them; churn keys
+ * are set and deleted at random; each thread also keeps inserting keys of
+ * its own, so the stripes keep growing and rebuilds overlap the GETs. A
+ * value always starts with its key, so a GET that returned a torn or freed
+ * node shows up as a mismatch. Built with ASan by 'make test', and with TSan
+ * as tests/test_stress_tsan. Usage: tests/test_stress [threads] [seconds]
+ **/
+#define STABLE 2000
+#define CHURN 2000
+#define MAX_GROW 100000     // own keys per thread
+
+Hashtable* ht;
+int stop = 0;
+long failures = 0;
+long ops = 0;
+long rebuildGets = 0;       // GETs whose stripe was being rebuilt just before
+long grown = 0;
+
+int matches(const char* key, int key_len, const char* val, int val_len) {
+    return val_len > key_len && memcmp(val, key, key_len) == 0 && val[key_len] == ':';
+}
+
+void fail(const char* what, const char* key) {
+    fprintf(stderr, "%s: %s\n", what, key);
+    __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+}
+
+void setValue(char* key, int key_len, unsigned version) {
+    char val[64];
+    int val_len = snprintf(val, sizeof(val), "%s:%u", key, version);
+    set(ht, strdup(key), strdup(val), key_len, val_len);
+}
+
+/**
+ * GET a key, checking its value; returns whether it was found.
+ **/
+int getValue(char* key, int key_len) {
+    int val_len;
+    Stripe* stripe = stripeOf(ht, hashFunction(ht->seed, key, key_len));
+    int rebuilding = __atomic_load_n(&stripe->old, __ATOMIC_ACQUIRE) != NULL;
+    char* val = get(ht, key, key_len, &val_len);
+    if (rebuilding) {
+        __atomic_fetch_add(&rebuildGets, 1, __ATOMIC_RELAXED);
+    }
+    if (val != NULL && !matches(key, key_len, val, val_len)) {
+        fail("GET returned another key's value", key);
+    }
+    free(val);
+    return val != NULL;
+}
+
+void* worker(void* arg) {
+    long id = (long) arg;
+    unsigned seed = (unsigned) id * 2654435761u + 1;
+    long own = 0;
+    long done = 0;
+    char key[32];
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        int r = rand_r(&seed) % 100;
+        int key_len;
+        if (r < 50) {
+            key_len = snprintf(key, sizeof(key), "stable%d", rand_r(&seed) % STABLE);
+            if (!getValue(key, key_len)) {
+                fail("GET missed a stable key", key);
+            }
+        } else if (r < 65) {
+            key_len = snprintf(key, sizeof(key), "churn%d", rand_r(&seed) % CHURN);
+            getValue(key, key_len);
+        } else if (r < 75) {
+            key_len = snprintf(key, sizeof(key), "stable%d", rand_r(&seed) % STABLE);
+            setValue(key, key_len, rand_r(&seed));
+        } else if (r < 85) {
+            key_len = snprintf(key, sizeof(key), "churn%d", rand_r(&seed) % CHURN);
+            setValue(key, key_len, rand_r(&seed));
+        } else if (r < 93) {
+            key_len = snprintf(key, sizeof(key), "churn%d", rand_r(&seed) % CHURN);
+            int val_len;
+            char* val = del(ht, key, key_len, &val_len);
+            if (val != NULL && !matches(key, key_len, val, val_len)) {
+                fail("DEL returned another key's value", key);
+            }
+            free(val);
+        } else if (own < MAX_GROW) {
+            key_len = snprintf(key, sizeof(key), "grow%ld-%ld", id, own++);
+            setValue(key, key_len, 0);
+            key_len = snprintf(key, sizeof(key), "grow%ld-%ld", id, rand_r(&seed) % own);
+            if (!getValue(key, key_len)) {
+                fail("GET missed a key this thread set", key);
+            }
+        }
+        ++done;
+    }
+    __atomic_fetch_add(&ops, done, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&grown, own, __ATOMIC_RELAXED);
+    return (void*) own;
+}
+
+int main(int argc, char** argv) {
+    int numThreads = argc > 1 ? atoi(argv[1]) : 8;
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+    ht = initialize();
+    char key[32];
+    int i;
+    for (i = 0; i < STABLE; ++i) {
+        setValue(key, snprintf(key, sizeof(key), "stable%d", i), 0);
+    }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * numThreads);
+    long* owned = malloc(sizeof(long) * numThreads);
+    if (threads == NULL || owned == NULL) {
+        perror("Malloc failed\n");
+        return 1;
+    }
+    long t;
+    for (t = 0; t < numThreads; ++t) {
+        pthread_create(&threads[t], NULL, worker, (void*) t);
+    }
+    struct timespec duration = { (time_t) seconds, (long) ((seconds - (time_t) seconds) * 1e9) };
+    nanosleep(&duration, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (t = 0; t < numThreads; ++t) {
+        void* own;
+        pthread_join(threads[t], &own);
+        owned[t] = (long) own;
+    }
+
+    // Quiescent: every stable and grown key is there, and the counts add up
+    size_t expected = STABLE + grown;
+    for (i = 0; i < STABLE; ++i) {
+        int key_len = snprintf(key, sizeof(key), "stable%d", i);
+        if (!getValue(key, key_len)) {
+            fail("stable key lost", key);
+        }
+    }
+    for (t = 0; t < numThreads; ++t) {
+        long k;
+        for (k = 0; k < owned[t]; ++k) {
+            int key_len = snprintf(key, sizeof(key), "grow%ld-%ld", t, k);
+            if (!getValue(key, key_len)) {
+                fail("grown key lost", key);
+            }
+        }
+    }
+    for (i = 0; i < CHURN; ++i) {
+        expected += getValue(key, snprintf(key, sizeof(key), "churn%d", i));
+    }
+    size_t count = 0;
+    int s;
+    for (s = 0; s < 1 << HT_STRIPE_BITS; ++s) {
+        count += ht->stripes[s].count;
+    }
+    if (count != expected) {
+        fprintf(stderr, "the stripes count %zu keys, %zu are there\n", count, expected);
+        ++failures;
+    }
+    if (rebuildGets == 0) {
+        fprintf(stderr, "no GET overlapped a rebuild\n");
+        ++failures;
+    }
+    printf("test_stress: %d threads, %ld operations, %ld GETs during a rebuild, %ld keys grown\n",
+        numThreads, ops, rebuildGets, grown);
+    free(owned);
+    free(threads);
+    freeHT(ht);
+    if (failures > 0) {
+        fprintf(stderr, "test_stress: %ld failures\n", failures);
+        return 1;
+    }
+    printf("test_stress: ok\n");
+    return 0;
+}